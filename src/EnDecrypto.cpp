@@ -12,24 +12,29 @@
 #include <mutex>
 #include <thread>
 #include <algorithm>
+#include <cstdio>
 #include <chrono>       // time
 #include <iomanip>      // setw, setprecision
+#include <sstream>
 #include "EnDecrypto.h"
 #include "pack.h"
+#include "fcn.h"
+#include "gunzip.h"
+#include "aio.h"
+#include "stats.h"
 #include "cryptopp/aes.h"
 #include "cryptopp/eax.h"
 #include "cryptopp/files.h"
 
 using std::vector;
 using std::cout;
-using std::cerr;
 using std::ifstream;
 using std::ofstream;
+using std::fstream;
 using std::getline;
 using std::to_string;
 using std::thread;
 using std::stoull;
-using std::chrono::high_resolution_clock;
 using std::setprecision;
 using CryptoPP::AES;
 using CryptoPP::CBC_Mode_ExternalCipher;
@@ -47,127 +52,70 @@ std::mutex mutx;    /**< @brief Mutex */
 void EnDecrypto::compressFA ()
 {
     // Start timer for compression
-    high_resolution_clock::time_point startTime = high_resolution_clock::now();
+    StageTimer timer("compact");
     
-    thread arrThread[n_threads];
     byte   t;               // For threads
-    string headers;
+    string headers, seqChars;
     pack_s pkStruct;        // Collection of inputs to pass to pack...
     
-    if (verbose)    cerr << "Calculating number of different characters...\n";
+    if (verbose)    log() << "Calculating number of different characters...\n";
     
     // Gather different chars in all headers and max length in all bases
-    gatherHdrBs(headers);
-    
-    const size_t headersLen = headers.length();
+    gatherHdrBs(headers, seqChars);
     
     // Show number of different chars in headers -- ignore '>'=62
-    if (verbose)    cerr << "In headers, they are " << headersLen << ".\n";
-    
-    // Function pointer
-    using packHdrPointer = void (*) (string&, const string&, const htbl_t&);
-    packHdrPointer packHdr;
-    
-    // Header
-    if (headersLen > MAX_C5)          // If len > 39 filter the last 39 ones
-    {
-        Hdrs = headers.substr(headersLen - MAX_C5);
-        Hdrs_g = Hdrs;
-        // ASCII char after the last char in Hdrs -- always <= (char) 127
-        HdrsX = Hdrs;    HdrsX += (char) (Hdrs.back() + 1);
-        buildHashTable(HdrMap, HdrsX, KEYLEN_C5);    packHdr=&packLargeHdr_3to2;
-    }
-    else
-    {
-        Hdrs = headers;
-        Hdrs_g = Hdrs;
-
-        if (headersLen > MAX_C4)                            // 16 <= cat 5 <= 39
-        { buildHashTable(HdrMap, Hdrs, KEYLEN_C5);    packHdr = &pack_3to2; }
-
-        else if (headersLen > MAX_C3)                       // 7 <= cat 4 <= 15
-        { buildHashTable(HdrMap, Hdrs, KEYLEN_C4);    packHdr = &pack_2to1; }
-                                                            // 4 <= cat 3 <= 6
-        else if (headersLen==MAX_C3 || headersLen==MID_C3 || headersLen==MIN_C3)
-        { buildHashTable(HdrMap, Hdrs, KEYLEN_C3);    packHdr = &pack_3to1; }
-
-        else if (headersLen == C2)                          // cat 2 = 3
-        { buildHashTable(HdrMap, Hdrs, KEYLEN_C2);    packHdr = &pack_5to1; }
-
-        else if (headersLen == C1)                          // cat 1 = 2
-        { buildHashTable(HdrMap, Hdrs, KEYLEN_C1);    packHdr = &pack_7to1; }
-
-        else                                                // headersLen = 1
-        { buildHashTable(HdrMap, Hdrs, 1);            packHdr = &pack_1to1; }
-    }
+    if (verbose)    log() << "In headers, they are " << headers.length()<<".\n";
+    if (verbose && !seqChars.empty())
+        log() << "In sequences, they are " << seqChars.length() << ".\n";
     
-    pkStruct.packHdrFPtr = packHdr;
+    // Tables and packing functions for headers and, if their alphabet
+    // is not packed as DNA, sequences
+    setHdrPacker(headers, pkStruct);
+    if (!seqChars.empty())    setSeqPacker(seqChars, pkStruct);
+    inPlace = true;                        // Output of chunks is input's
     
     // Distribute file among threads, for reading and packing
+    StageTimer packing("pack");
     for (t = 0; t != n_threads; ++t)
-        arrThread[t] = thread(&EnDecrypto::packFA, this, pkStruct, t);
-    for (t = 0; t != n_threads; ++t)
-        if (arrThread[t].joinable())    arrThread[t].join();
-    
-    if (verbose)    cerr << "Shuffling done!\n";
-    
-    // Join partially packed files
-    ifstream pkFile[n_threads];
+        threadPool().submit([=] { packFA(pkStruct, t); });
+    threadPool().wait();
+    packing.stop();
+    if (verbose)    threadPool().report(log());
     
-    // Watermark for encrypted file
-    cout << "#cryfa v" + to_string(VERSION_CRYFA) + "."
-                       + to_string(RELEASE_CRYFA) + "\n";
+    if (verbose)    log() << "Shuffling done!\n";
     
     // Open packed file
-    ofstream pckdFile(PCKD_FILENAME);
+    ofstream pckdFile(tmp(PCKD_FILENAME));
     pckdFile << (char) 127;                // Let decryptor know this is FASTA
     pckdFile << (!disable_shuffle ? (char) 128 : (char) 129); //Shuffling on/off
     pckdFile << headers;                   // Send headers to decryptor
     pckdFile << (char) 254;                // To detect headers in decompressor
+    if (!seqChars.empty())                 // Alphabet of sequences
+        pckdFile << (char) 249 << seqChars << (char) 254;
     
-    // Open input files
-    for (t = 0; t != n_threads; ++t)  pkFile[t].open(PK_FILENAME+to_string(t));
-
-    string line;
-    bool prevLineNotThrID;                 // If previous line was "THR=" or not
-    while (!pkFile[0].eof())
-    {
-        for (t = 0; t != n_threads; ++t)
-        {
-            prevLineNotThrID = false;
-
-            while (getline(pkFile[t], line).good() &&
-                   line != THR_ID_HDR+to_string(t))
-            {
-                if (prevLineNotThrID)   pckdFile << '\n';
-                pckdFile << line;
-
-                prevLineNotThrID = true;
-            }
-        }
-    }
-    pckdFile << (char) 252;
-    
-    // Stop timer for compression
-    high_resolution_clock::time_point finishTime = high_resolution_clock::now();
-    // Compression duration in seconds
-    std::chrono::duration<double> elapsed = finishTime - startTime;
-    
-    cerr << (verbose ? "Compaction done," : "Done,") << " in "
-         << std::fixed << setprecision(4) << elapsed.count() << " seconds.\n";
-    
-    // Close/delete input/output files
+    // Join partially packed files
+    joinPackedFiles(pckdFile);
     pckdFile.close();
-    string pkFileName;
-    for (t = 0; t != n_threads; ++t)
-    {
-        pkFile[t].close();
-        pkFileName=PK_FILENAME;    pkFileName+=to_string(t);
-        std::remove(pkFileName.c_str());
-    }
     
-    // Cout encrypted content
-    encrypt();
+    log() << (verbose ? "Compaction done," : "Done,") << " in "
+          << std::fixed << setprecision(4) << timer.stop() << " seconds.\n";
+    
+    // Cout encrypted content -- Members of an archive are encrypted together
+    if (!archiving)    encrypt();
+}
+
+/**
+ * @brief      Pack a sequence: 3 DNA bases in 1 byte, or by the category of
+ *             its alphabet, if set
+ * @param[out] packed    Packed sequence
+ * @param[in]  seq       Sequence
+ * @param[in]  pkStruct  Pack structure
+ */
+inline void EnDecrypto::packSeq (string &packed, const string &seq,
+                                 const pack_s &pkStruct) const
+{
+    if (!pkStruct.packSeqFPtr)    packSeq_3to1(packed, seq);
+    else                          pkStruct.packSeqFPtr(packed, seq, SeqMap);
 }
 
 /**
@@ -177,33 +125,49 @@ void EnDecrypto::compressFA ()
  */
 inline void EnDecrypto::packFA (const pack_s& pkStruct, byte threadID)
 {
-    using packHdrFPtr   = void (*) (string&, const string&, const htbl_t&);
+    using packHdrFPtr   = void (*) (string&, const string&, const ptbl_t&);
     packHdrFPtr packHdr = pkStruct.packHdrFPtr;              // Function pointer
     ifstream    in(inFileName);
     string      line, context, seq;
-    ofstream    pkfile(PK_FILENAME+to_string(threadID), std::ios_base::app);
-    
-    // Lines ignored at the beginning
-    for (u64 l = (u64) threadID*BlockLine; l--;)    IGNORE_THIS_LINE(in);
+    vector<u64> lens;                                 // Length of seq lines
+    ofstream    pkfile(tmp(PK_FILENAME) + to_string(threadID),
+                       std::ios_base::app);
+    
+    // Bases of a seq, as one stream, then its line layout, if it has many
+    const auto flushSeq = [&] {
+        packSeq(context, seq, pkStruct);
+        if (lens.size() == 1)    context += (char) 254;
+        else { context += (char) 252;    packLayout(context, lens); }
+        seq.clear();
+        lens.clear();
+    };
     
-    while (in.peek() != EOF)
+    // Chunks threadID, threadID + n_threads, ...
+    for (u64 ch = threadID; ch < chunks.size(); ch += n_threads)
     {
+        const chunk_s &chunk = chunks[ch];
+        const bool midLine = ch && chunks[ch-1].tail;   // Begins inside a line
+        in.clear();
+        in.seekg((std::streamoff) chunk.pos);
         context.clear();
         seq.clear();
+        lens.clear();
         
-        for (u64 l = BlockLine; l-- && getline(in, line).good();)
+        for (u64 l = 0; l != chunk.lines + (chunk.tail ? 1 : 0); ++l)
         {
+            // Whole line, or piece of a line continued in the next chunk
+            if (l == chunk.lines)
+            {
+                line.resize(chunk.tail);
+                if (!in.read(&line[0], (std::streamsize) chunk.tail))  break;
+            }
+            else if (!getline(in, line).good())    break;
+            
             // Header
-            if (line[0] == '>')
+            if (line[0] == '>' && !(l == 0 && midLine))
             {
                 // Previous seq
-                if (!seq.empty())
-                {
-                    seq.pop_back();                      // Remove the last '\n'
-                    packSeq_3to1(context, seq);
-                    context += (char) 254;
-                }
-                seq.clear();
+                if (!lens.empty())    flushSeq();
 
                 // Header line
                 context += (char) 253;
@@ -211,35 +175,24 @@ inline void EnDecrypto::packFA (const pack_s& pkStruct, byte threadID)
                 context += (char) 254;
             }
             
-            // Empty line. (char) 252 instead of line feed
-            else if (line.empty()) { seq += (char) 252; }
-
-            // Sequence
+            // Sequence -- Line feeds are kept as the line layout
             else
             {
                 //todo. check if it's needed to check for blank char
 //                if (line.find(' ') != string::npos)
 //              { cerr<< "Invalid sequence -- spaces not allowed.\n"; exit(1); }
                 
-                // (char) 252 instead of '\n' at the end of each seq line
                 seq += line;
-                seq += (char) 252;
+                lens.push_back(line.size());
             }
         }
-        if (!seq.empty())
-        {
-            seq.pop_back();                              // Remove the last '\n'
-
-            // The last seq
-            packSeq_3to1(context, seq);
-            context += (char) 254;
-        }
+        if (!lens.empty())    flushSeq();                // The last seq
         
         // Shuffle
         if (!disable_shuffle)
         {
             mutx.lock();//------------------------------------------------------
-            if (verbose && shufflingInProgress)    cerr << "Shuffling...\n";
+            if (verbose && shufflingInProgress)    log() << "Shuffling...\n";
             
             shufflingInProgress = false;
             mutx.unlock();//----------------------------------------------------
@@ -248,18 +201,12 @@ inline void EnDecrypto::packFA (const pack_s& pkStruct, byte threadID)
         }
 
         // For unshuffling: insert the size of packed context in the beginning
-        string contextSize;
-        contextSize += (char) 253;
-        contextSize += to_string(context.size());
-        contextSize += (char) 254;
-        context.insert(0, contextSize);
+        context.insert(0, chunkHeader(ch, context.size()));
 
         // Write header containing threadID for each
         pkfile << THR_ID_HDR << to_string(threadID) << '\n';
         pkfile << context << '\n';
-        
-        // Ignore to go to the next related chunk
-        for (u64 l = (u64) (n_threads-1)*BlockLine; l--;)  IGNORE_THIS_LINE(in);
+        ThreadPool::count(context.size());
     }
 
     pkfile.close();
@@ -272,237 +219,192 @@ inline void EnDecrypto::packFA (const pack_s& pkStruct, byte threadID)
 void EnDecrypto::compressFQ ()
 {
     // Start timer for compression
-    high_resolution_clock::time_point startTime = high_resolution_clock::now();
+    StageTimer timer("compact");
     
-    string line;
-    thread arrThread[n_threads];
     byte   t;                   // For threads
-    string headers, qscores;
+    string headers, qscores, seqChars;
     pack_s pkStruct;            // Collection of inputs to pass to pack...
     
-    if (verbose)    cerr << "Calculating number of different characters...\n";
-    
-    // Gather different chars and max length in all headers and quality scores
-    gatherHdrQs(headers, qscores);
-    
-    const size_t headersLen = headers.length();
-    const size_t qscoresLen = qscores.length();
-    
-    // Show number of different chars in headers and qs -- Ignore '@'=64 in hdr
-    if (verbose)
-        cerr << "In headers, they are " << headersLen << ".\n"
-             << "In quality scores, they are " << qscoresLen << ".\n";
+    if (verbose)    log() << "Calculating number of different characters...\n";
     
-    // Function pointers
-    using packHdrPointer = void (*) (string&, const string&, const htbl_t&);
-    packHdrPointer packHdr;
-    using packQSPointer  = void (*) (string&, const string&, const htbl_t&);
-    packQSPointer  packQS;
-
-    // Header
-    if (headersLen > MAX_C5)          // If len > 39 filter the last 39 ones
-    {
-        Hdrs = headers.substr(headersLen - MAX_C5);
-        Hdrs_g = Hdrs;
-        // ASCII char after the last char in Hdrs -- Always <= (char) 127
-        HdrsX = Hdrs;    HdrsX += (char) (Hdrs.back() + 1);
-        buildHashTable(HdrMap, HdrsX, KEYLEN_C5);    packHdr=&packLargeHdr_3to2;
-    }
-    else
-    {
-        Hdrs = headers;
-        Hdrs_g = Hdrs;
-
-        if (headersLen > MAX_C4)                            // 16 <= cat 5 <= 39
-        { buildHashTable(HdrMap, Hdrs, KEYLEN_C5);    packHdr = &pack_3to2; }
-
-        else if (headersLen > MAX_C3)                       // 7 <= cat 4 <= 15
-        { buildHashTable(HdrMap, Hdrs, KEYLEN_C4);    packHdr = &pack_2to1; }
-                                                            // 4 <= cat 3 <= 6
-        else if (headersLen==MAX_C3 || headersLen==MID_C3 || headersLen==MIN_C3)
-        { buildHashTable(HdrMap, Hdrs, KEYLEN_C3);    packHdr = &pack_3to1; }
-
-        else if (headersLen == C2)                          // cat 2 = 3
-        { buildHashTable(HdrMap, Hdrs, KEYLEN_C2);    packHdr = &pack_5to1; }
-
-        else if (headersLen == C1)                          // cat 1 = 2
-        { buildHashTable(HdrMap, Hdrs, KEYLEN_C1);    packHdr = &pack_7to1; }
-
-        else                                                // headersLen = 1
-        { buildHashTable(HdrMap, Hdrs, 1);            packHdr = &pack_1to1; }
-    }
-
-    // Quality score
-    if (qscoresLen > MAX_C5)              // If len > 39 filter the last 39 ones
+    // Paired-end: R1 and R2 share alphabets, chunks and '+' line format
+    paired = !pairFileName.empty();
+    const bool plusOnly = hasFQjustPlus(inFileName);
+    if (paired && plusOnly != hasFQjustPlus(pairFileName))
     {
-        QSs = qscores.substr(qscoresLen - MAX_C5);
-        QSs_g = QSs;
-        // ASCII char after last char in QUALITY_SCORES
-        QSsX = QSs;     QSsX += (char) (QSs.back() + 1);
-        buildHashTable(QsMap, QSsX, KEYLEN_C5);     packQS = &packLargeQs_3to2;
+        throw CryfaError(ErrCode::BAD_OPTIONS, "third lines of \"" +
+                         inFileName + "\" and \"" + pairFileName +
+                         "\" have different formats.");
     }
-    else
+    
+    // Reorder reads, then pack the reordered copies of input files
+    string perm;        // Permutation of reads, to restore their order
+    if (reorder || reorder_keep)
     {
-        QSs = qscores;
-        QSs_g = QSs;
-
-        if (qscoresLen > MAX_C4)                            // 16 <= cat 5 <= 39
-        { buildHashTable(QsMap, QSs, KEYLEN_C5);    packQS = &pack_3to2; }
-
-        else if (qscoresLen > MAX_C3)                       // 7 <= cat 4 <= 15
-        { buildHashTable(QsMap, QSs, KEYLEN_C4);    packQS = &pack_2to1; }
-                                                            // 4 <= cat 3 <= 6
-        else if (qscoresLen==MAX_C3 || qscoresLen==MID_C3 || qscoresLen==MIN_C3)
-        { buildHashTable(QsMap, QSs, KEYLEN_C3);    packQS = &pack_3to1; }
-
-        else if (qscoresLen == C2)                          // cat 2 = 3
-        { buildHashTable(QsMap, QSs, KEYLEN_C2);    packQS = &pack_5to1; }
-
-        else if (qscoresLen == C1)                          // cat 1 = 2
-        { buildHashTable(QsMap, QSs, KEYLEN_C1);    packQS = &pack_7to1; }
-
-        else                                                // qscoresLen = 1
-        { buildHashTable(QsMap, QSs, 1);            packQS = &pack_1to1; }
+        if (verbose)    log() << "Reordering reads...\n";
+        
+        reorderFQ(perm);
+        inFileName = tmp(RDR_FILENAME) + to_string(0);
+        if (paired)    pairFileName = tmp(RDR_FILENAME) + to_string(1);
     }
-
-    pkStruct.packHdrFPtr = packHdr;
-    pkStruct.packQSFPtr  = packQS;
+    
+    // Gather different chars and max length in all headers and quality scores
+    gatherHdrQs(headers, qscores, seqChars, pkStruct);
+    
+    // Show number of different chars in headers and qs -- Ignore '@'=64 in hdr
+    if (verbose)
+        log() << "In headers, they are " << headers.length() << ".\n"
+              << "In quality scores, they are " << qscores.length() << ".\n";
+    if (verbose && !seqChars.empty())
+        log() << "In sequences, they are " << seqChars.length() << ".\n";
+    
+    // Tables and packing functions for headers, quality scores and, if
+    // their alphabet is not packed as DNA, sequences
+    setHdrPacker(headers, pkStruct);
+    setQSPacker(qscores, pkStruct);
+    if (!seqChars.empty())    setSeqPacker(seqChars, pkStruct);
+    inPlace = !paired && perm.empty();  // Output of chunks is input's, if
+                                        // in one file, in the same order
 
     // Distribute file among threads, for reading and packing
+    StageTimer packing("pack");
     for (t = 0; t != n_threads; ++t)
-        arrThread[t] = thread(&EnDecrypto::packFQ, this, pkStruct, t);
-    for (t = 0; t != n_threads; ++t)
-        if (arrThread[t].joinable())    arrThread[t].join();
+        threadPool().submit([=] { packFQ(pkStruct, t); });
+    threadPool().wait();
+    packing.stop();
+    if (verbose)    threadPool().report(log());
     
-    if (verbose)    cerr << "Shuffling done!\n";
+    if (verbose)    log() << "Shuffling done!\n";
     
-    // Join partially packed files
-    ifstream pkFile[n_threads];
-    string context;
-
-    // Watermark for encrypted file
-    cout << "#cryfa v" + to_string(VERSION_CRYFA) + "."
-                       + to_string(RELEASE_CRYFA) + "\n";
-
     // Open packed file
-    ofstream pckdFile(PCKD_FILENAME);
+    ofstream pckdFile(tmp(PCKD_FILENAME));
+    if (paired)    pckdFile << (char) 126;          // Paired-end FASTQ
     pckdFile << (!disable_shuffle ? (char) 128 : (char) 129); //Shuffling on/off
     pckdFile << headers;                            // Send headers to decryptor
     pckdFile << (char) 254;                         // To detect headers in dec.
     pckdFile << qscores;                            // Send qscores to decryptor
-    pckdFile << (hasFQjustPlus() ? (char) 253 : '\n');        // If just '+'
-
-    // Open input files
-    for (t = 0; t != n_threads; ++t)  pkFile[t].open(PK_FILENAME+to_string(t));
-
-    bool prevLineNotThrID;                 // If previous line was "THR=" or not
-    while (!pkFile[0].eof())
+    pckdFile << (plusOnly ? (char) 253 : '\n');                // If just '+'
+    if (!seqChars.empty())                          // Alphabet of sequences
+        pckdFile << (char) 249 << seqChars << (char) 254;
+    if (pkStruct.readLen)                           // Length of all reads
+        pckdFile << (char) 247 << pkStruct.readLen << (char) 254;
+    if (pkStruct.qsCounted)                         // Q scores end with seqs
+        pckdFile << (char) 246;
+    if (reorder_keep)                               // Permutation of reads
     {
-        for (t = 0; t != n_threads; ++t)
-        {
-            prevLineNotThrID = false;
-
-            while (getline(pkFile[t], line).good() &&
-                    line != THR_ID_HDR+to_string(t))
-            {
-                if (prevLineNotThrID)   pckdFile << '\n';
-                pckdFile << line;
-
-                prevLineNotThrID = true;
-            }
-        }
+        pckdFile << (char) 250 << RDR_WINDOW << (char) 254
+                 << perm.size()/4 << (char) 254;
+        pckdFile.write(perm.data(), perm.size());
     }
-    pckdFile << (char) 252;
 
-    // Close/delete input/output files
+    // Join partially packed files
+    joinPackedFiles(pckdFile);
     pckdFile.close();
-    string pkFileName;
-    for (t = 0; t != n_threads; ++t)
+    
+    // Delete reordered copies of input files
+    if (reorder || reorder_keep)
     {
-        pkFile[t].close();
-        pkFileName=PK_FILENAME;    pkFileName+=to_string(t);
-        std::remove(pkFileName.c_str());
+        std::remove(inFileName.c_str());
+        if (paired)    std::remove(pairFileName.c_str());
     }
     
-    // Stop timer for compression
-    high_resolution_clock::time_point finishTime = high_resolution_clock::now();
-    // Compression duration in seconds
-    std::chrono::duration<double> elapsed = finishTime - startTime;
-    
-    cerr << (verbose ? "Compaction done," : "Done,") << " in "
-         << std::fixed << setprecision(4) << elapsed.count() << " seconds.\n";
-    
-    // Cout encrypted content
-    encrypt();
-    
+    log() << (verbose ? "Compaction done," : "Done,") << " in "
+          << std::fixed << setprecision(4) << timer.stop() << " seconds.\n";
     
-    /*
-    // get size of file
-    infile.seekg(0, infile.end);
-    long size = 1000000;//infile.tellg();
-    infile.seekg(0);
-
-    // allocate memory for file content
-    char *buffer = new char[size];
-
-    // read content of infile
-    infile.read(buffer, size);
-
-    // write to outfile
-    outfile.write(buffer, size);
-
-    // release dynamically-allocated memory
-    delete[] buffer;
-
-    outfile.close();
-    infile.close();
-    */
+    // Cout encrypted content -- Members of an archive are encrypted together
+    if (!archiving)    encrypt();
 }
 
 /**
- * @brief Pack FASTQ -- '@' at the beginning of headers is not packed
+ * @brief Pack FASTQ -- '@' at the beginning of headers is not packed. If all
+ *        reads have one length, a chunk is the number of its records, then
+ *        headers, then sequences, then quality scores, the last two of a
+ *        fixed size each and without (char) 254 after. Else, quality scores
+ *        as long as their sequences have no (char) 254 after
  * @param pkStruct  Pack structure
  * @param threadID  Thread ID
  */
 inline void EnDecrypto::packFQ (const pack_s& pkStruct, byte threadID)
 {
     // Function pointers
-    using packHdrFPtr   = void (*) (string&, const string&, const htbl_t&);
+    using packHdrFPtr   = void (*) (string&, const string&, const ptbl_t&);
     packHdrFPtr packHdr = pkStruct.packHdrFPtr;
-    using packQSPtr     = void (*) (string&, const string&, const htbl_t&);
+    using packQSPtr     = void (*) (string&, const string&, const ptbl_t&);
     packQSPtr   packQS  = pkStruct.packQSFPtr;
 
     ifstream in(inFileName);
+    ifstream inMate;        // R2, if paired-end
     string   context;       // Output string
-    string   line;
-    ofstream pkfile(PK_FILENAME+to_string(threadID), std::ios_base::app);
-
-    // Lines ignored at the beginning
-    for (u64 l = (u64) threadID*BlockLine; l--;)    IGNORE_THIS_LINE(in);
-
-    while (in.peek() != EOF)
+    string   line, hdr;
+    ofstream pkfile(tmp(PK_FILENAME)+to_string(threadID), std::ios_base::app);
+    if (paired)    inMate.open(pairFileName);
+
+    // Sequences and quality scores: in the output string, each with a
+    // (char) 254 after, or, if reads have a fixed length, in their columns.
+    // Quality scores as long as their sequences need no (char) 254
+    const bool fixedLen = pkStruct.readLen != 0;
+    string seqCol, qsCol;
+    string &seqs = fixedLen ? seqCol : context;
+    string &qss  = fixedLen ? qsCol  : context;
+    const string end   = fixedLen ? "" : string(1, (char) 254);
+    const string qsEnd = pkStruct.qsCounted ? "" : end;
+    u64 nRecords;
+
+    // Chunks threadID, threadID + n_threads, ...
+    for (u64 ch = threadID; ch < chunks.size(); ch += n_threads)
     {
+        in.clear();
+        in.seekg((std::streamoff) chunks[ch].pos);
+        if (paired)
+        {
+            inMate.clear();
+            inMate.seekg((std::streamoff) chunks[ch].matePos);
+        }
         context.clear();
+        nRecords = 0;
 
-        for (u64 l = 0; l != BlockLine; l += 4)  // Process 4 lines by 4 lines
+        for (u64 l = 0; l < chunks[ch].lines; l += 4)  // 4 lines by 4 lines
         {
-            if (getline(in, line).good())          // Header -- Ignore '@'
-            { packHdr(context, line.substr(1), HdrMap);   context+=(char) 254; }
+            if (getline(in, hdr).good())           // Header -- Ignore '@'
+            { packHdr(context, hdr.substr(1), HdrMap);    context+=(char) 254;
+              ++nRecords;                                                    }
 
             if (getline(in, line).good())          // Sequence
-            { packSeq_3to1(context, line);                context+=(char) 254; }
+            { packSeq(seqs, line, pkStruct);              seqs+=end;         }
     
             IGNORE_THIS_LINE(in);                  // +. ignore
 
             if (getline(in, line).good())          // Quality score
-            { packQS(context, line, QsMap);               context+=(char) 254; }
+            { packQS(qss, line, QsMap);                   qss+=qsEnd;        }
+            
+            // Mate (R2), right after its R1 record
+            if (paired && getline(inMate, line).good())
+            {
+                packMateHdr(context, line.substr(1), hdr.substr(1), pkStruct);
+                
+                if (getline(inMate, line).good())  // Sequence
+                { packSeq(seqs, line, pkStruct);          seqs+=end;         }
+    
+                IGNORE_THIS_LINE(inMate);          // +. ignore
+    
+                if (getline(inMate, line).good())  // Quality score
+                { packQS(qss, line, QsMap);               qss+=qsEnd;        }
+            }
+        }
+        
+        // Fixed length: number of records, headers, sequences, q scores
+        if (fixedLen)
+        {
+            context.insert(0, to_string(nRecords) + (char) 254);
+            context += seqCol;    seqCol.clear();
+            context += qsCol;     qsCol.clear();
         }
 
         // shuffle
         if (!disable_shuffle)
         {
             mutx.lock();//------------------------------------------------------
-            if (verbose && shufflingInProgress)    cerr << "Shuffling...\n";
+            if (verbose && shufflingInProgress)    log() << "Shuffling...\n";
     
             shufflingInProgress = false;
             mutx.unlock();//----------------------------------------------------
@@ -511,69 +413,694 @@ inline void EnDecrypto::packFQ (const pack_s& pkStruct, byte threadID)
         }
 
         // For unshuffling: insert the size of packed context in the beginning
-        string contextSize;
-        contextSize += (char) 253;
-        contextSize += to_string(context.size());
-        contextSize += (char) 254;
-        context.insert(0, contextSize);
+        context.insert(0, chunkHeader(ch, context.size()));
 
         // Write header containing threadID for each
         pkfile << THR_ID_HDR << to_string(threadID) << '\n';
         pkfile << context << '\n';
-
-        // Ignore to go to the next related chunk
-        for (u64 l = (u64) (n_threads-1)*BlockLine; l--;)  IGNORE_THIS_LINE(in);
+        ThreadPool::count(context.size());
     }
 
     pkfile.close();
     in.close();
+    if (paired)    inMate.close();
 }
 
 /**
- * @brief   Encrypt
- * @details AES encryption uses a secret key of a variable length (128, 196
- *          or 256 bit). This key is secretly exchanged between two parties
- *          before communication begins.
- *
- *          DEFAULT_KEYLENGTH = 16 bytes.
+ * @brief      Reorder FASTQ reads: in each window of RDR_WINDOW reads, sort
+ *             them by minimizer of their sequence, so similar reads are packed
+ *             next to each other. Mates (R2) follow the order of R1. Results
+ *             are written into RDR_FILENAME0 (and RDR_FILENAME1)
+ * @param[out] perm  Position of each read in its window, before reordering
+ *                   -- 4 bytes each, little-endian. Only if order is kept
  */
-inline void EnDecrypto::encrypt ()
+inline void EnDecrypto::reorderFQ (string &perm)
 {
-    cerr << "Encrypting...\n";
-    
-    // Start timer for encryption
-    high_resolution_clock::time_point startTime = high_resolution_clock::now();
+    StageTimer timer("reorder");
+    const string fileNames[2] = {inFileName, pairFileName};
+    const byte   nFiles = (byte) (paired ? 2 : 1);
+    ifstream     in[2];
+    ofstream     out[2];
+    for (byte f = 0; f != nFiles; ++f)
+    {
+        in[f].open(fileNames[f]);
+        out[f].open(tmp(RDR_FILENAME) + to_string(f));
+    }
     
-    byte key[AES::DEFAULT_KEYLENGTH], iv[AES::BLOCKSIZE];
-    memset(key, 0x00, (size_t) AES::DEFAULT_KEYLENGTH); // AES key
-    memset(iv,  0x00, (size_t) AES::BLOCKSIZE);         // Initialization Vector
+    vector<string> reads[2];
+    vector<std::pair<u64, u32>> keys;       // Minimizer & position in window
+    string hdr, seq, plus, qs;
     
-    const string pass = extractPass();
-    buildKey(key, pass);
-    buildIV(iv, pass);
-//    printIV(iv);      // Debug
-//    printKey(key);    // Debug
+    while (in[0].peek() != EOF)
+    {
+        reads[0].clear();    reads[1].clear();    keys.clear();
+        
+        // Take a window of reads
+        for (u32 r = 0; r != RDR_WINDOW && in[0].peek() != EOF; ++r)
+        {
+            for (byte f = 0; f != nFiles; ++f)
+            {
+                getline(in[f], hdr);    getline(in[f], seq);
+                getline(in[f], plus);   getline(in[f], qs);
+                
+                if (f == 0)    keys.push_back(std::make_pair(minimizer(seq),r));
+                reads[f].push_back(hdr+'\n' + seq+'\n' + plus+'\n' + qs+'\n');
+            }
+        }
+        
+        // Cluster by minimizer -- Ties keep the input order
+        std::sort(keys.begin(), keys.end());
+        
+        for (const auto &k : keys)
+        {
+            for (byte f = 0; f != nFiles; ++f)    out[f] << reads[f][k.second];
+            
+            if (reorder_keep)
+                for (byte b = 0; b != 4; ++b)  perm += (char) (k.second >> 8*b);
+        }
+    }
     
-    // Encrypt
-    const char* inFile = PCKD_FILENAME;
-    CBC_Mode<CryptoPP::AES>::Encryption
-            cbcEnc(key, (size_t) AES::DEFAULT_KEYLENGTH, iv);
-    FileSource(inFile, true,
-               new StreamTransformationFilter(cbcEnc, new FileSink(cout)));
+    for (byte f = 0; f != nFiles; ++f)    { in[f].close();    out[f].close(); }
+}
+
+/**
+ * @brief          Restore the original order of a window of reordered reads,
+ *                 and write them
+ * @param[in, out] window   R1 (and R2) reads, in stored order -- Emptied
+ * @param[in]      perm     Permutation of all reads
+ * @param[in, out] nDone    Number of reads restored before this window
+ * @param[out]     mateOut  Output for R2 reads
+ */
+inline void EnDecrypto::restoreOrder (vector<string> (&window)[2],
+                                      const string &perm, u64 &nDone,
+                                      std::ostream &mateOut) const
+{
+    const u64 n = window[0].size();
+    vector<string> ordered[2];
+    ordered[0].resize(n);
+    if (paired)    ordered[1].resize(n);
     
-    // Stop timer for encryption
-    high_resolution_clock::time_point finishTime = high_resolution_clock::now();
-    // Encryption duration in seconds
-    std::chrono::duration<double> elapsed = finishTime - startTime;
+    for (u64 r = 0; r != n; ++r)
+    {
+        const byte *p = (const byte*) &perm[4*(nDone + r)];
+        const u32 pos = p[0] | p[1]<<8 | p[2]<<16 | (u32) p[3]<<24;
+        
+        ordered[0][pos] = std::move(window[0][r]);
+        if (paired)    ordered[1][pos] = std::move(window[1][r]);
+    }
     
-    cerr << (verbose ? "Encryption done," : "Done,") << " in "
-         << std::fixed << setprecision(4) << elapsed.count() << " seconds.\n";
+    for (u64 r = 0; r != n; ++r)
+    {
+        *outStream << ordered[0][r];
+        if (paired)    mateOut << ordered[1][r];
+    }
     
-    // Delete packed file
-    const string pkdFileName = PCKD_FILENAME;
-    std::remove(pkdFileName.c_str());
+    nDone += n;
+    window[0].clear();
+    window[1].clear();
+}
+
+/**
+ * @brief      Pack header of a mate (R2) -- '@' not packed. (char) 253 if it
+ *             is the same as R1 header, (char) 252 followed by position, if it
+ *             only differs in mate number ('1' -> '2'), otherwise packed
+ * @param[out] context   Packed string
+ * @param[in]  hdr       Header of R2
+ * @param[in]  hdrR1     Header of R1
+ * @param[in]  pkStruct  Pack structure
+ */
+inline void EnDecrypto::packMateHdr (string &context, const string &hdr,
+                                     const string &hdrR1,
+                                     const pack_s &pkStruct)
+{
+    if (hdr == hdrR1)    { context += (char) 253;    return; }
+    
+    if (hdr.length() == hdrR1.length())
+    {
+        const auto diff = std::mismatch(hdr.begin(), hdr.end(), hdrR1.begin());
+        if (*diff.first == '2' && *diff.second == '1' &&
+            std::equal(diff.first+1, hdr.end(), diff.second+1))
+        {
+            context += (char) 252;
+            context += to_string(diff.first - hdr.begin());
+            context += (char) 254;
+            return;
+        }
+    }
+    
+    pkStruct.packHdrFPtr(context, hdr, HdrMap);
+    context += (char) 254;
+}
+
+/**
+ * @brief          Unpack header of a mate (R2), if it is built from R1 header
+ * @param[out]     out    Unpacked header
+ * @param[in, out] i      Input string iterator -- On (char) 253 or 254 after
+ * @param[in]      hdrR1  Header of R1
+ * @return         True if header is built, false if it needs unpacking
+ */
+inline bool EnDecrypto::unpackMateHdr (string &out, string::iterator &i,
+                                       const string &hdrR1) const
+{
+    if (*i == (char) 253)    { out = hdrR1;    return true; }       // Same
+    
+    if (*i == (char) 252)                                           // '1'->'2'
+    {
+        string posStr;
+        while (*(++i) != (char) 254)    posStr += *i;
+        out = hdrR1;
+        out[stoull(posStr)] = '2';
+        return true;
+    }
+    
+    return false;
+}
+
+/**
+ * @brief Compress SAM
+ */
+void EnDecrypto::compressSAM ()
+{
+    // Start timer for compression
+    StageTimer timer("compact");
+    
+    byte   t;                   // For threads
+    string qnames, quals, samHdr;
+    pack_s pkStruct;            // Collection of inputs to pass to pack...
+    
+    if (verbose)    log() << "Calculating number of different characters...\n";
+    
+    // Gather different chars in all QNAMEs and QUALs, and the header lines
+    gatherSAM(qnames, quals, samHdr);
+    
+    // Show number of different chars in QNAMEs and QUALs
+    if (verbose)
+        log() << "In read names, they are " << qnames.length() << ".\n"
+              << "In quality scores, they are " << quals.length() << ".\n";
+    
+    // QNAMEs are packed as headers and QUALs as quality scores
+    setHdrPacker(qnames, pkStruct);
+    setQSPacker(quals, pkStruct);
+    inPlace = true;                         // Output of chunks is input's
+    
+    // Distribute file among threads, for reading and packing
+    StageTimer packing("pack");
+    for (t = 0; t != n_threads; ++t)
+        threadPool().submit([=] { packSAM(pkStruct, t); });
+    threadPool().wait();
+    packing.stop();
+    if (verbose)    threadPool().report(log());
+    
+    if (verbose)    log() << "Shuffling done!\n";
+    
+    // Open packed file
+    ofstream pckdFile(tmp(PCKD_FILENAME));
+    pckdFile << (char) 125;                 // Let decryptor know this is SAM
+    pckdFile << (!disable_shuffle ? (char) 128 : (char) 129); //Shuffling on/off
+    pckdFile << qnames << (char) 254;       // Send QNAMEs chars to decryptor
+    pckdFile << quals  << (char) 254;       // Send QUALs chars to decryptor
+    pckdFile << samHdr.size() << (char) 254 << samHdr;        // Header lines
+    
+    // Join partially packed files
+    joinPackedFiles(pckdFile);
+    pckdFile.close();
+    
+    log() << (verbose ? "Compaction done," : "Done,") << " in "
+          << std::fixed << setprecision(4) << timer.stop() << " seconds.\n";
+    
+    // Cout encrypted content -- Members of an archive are encrypted together
+    if (!archiving)    encrypt();
+}
+
+/**
+ * @brief   Pack SAM. Each chunk is split into columns, which are packed one
+ *          after another, each one after its size:
+ *          QNAME (as headers), FLAG/POS/MAPQ/CIGAR (as varints -- POS is
+ *          delta of previous one), SEQ (3 bases in 1 byte), QUAL (as quality
+ *          scores) and the rest of columns (RNAME, RNEXT, PNEXT, TLEN and
+ *          optional fields, as text)
+ * @details For each record, the FLAG/POS/MAPQ/CIGAR column begins with its
+ *          kind: 0 = as above, 1 = FLAG/POS/MAPQ/CIGAR not canonical, so
+ *          they are in the rest of columns as text, 2 = less than 11
+ *          columns, so the whole line is in the rest of columns
+ * @param   pkStruct  Pack structure
+ * @param   threadID  Thread ID
+ */
+inline void EnDecrypto::packSAM (const pack_s& pkStruct, byte threadID)
+{
+    // Function pointers
+    using packHdrFPtr   = void (*) (string&, const string&, const ptbl_t&);
+    packHdrFPtr packHdr = pkStruct.packHdrFPtr;
+    using packQSPtr     = void (*) (string&, const string&, const ptbl_t&);
+    packQSPtr   packQS  = pkStruct.packQSFPtr;
+    
+    ifstream       in(inFileName);
+    string         context;                 // Output string
+    string         line, qnameCol, numCol, seqCol, qualCol, restCol, cigar;
+    vector<string> fields;
+    u64            flag=0, pos=0, mapq=0, prevPos;
+    byte           f;
+    ofstream pkfile(tmp(PK_FILENAME)+to_string(threadID), std::ios_base::app);
+    
+    // Chunks threadID, threadID + n_threads, ... -- After the header
+    for (u64 ch = threadID; ch < chunks.size(); ch += n_threads)
+    {
+        in.clear();
+        in.seekg((std::streamoff) chunks[ch].pos);
+        qnameCol.clear();  numCol.clear();  seqCol.clear();  qualCol.clear();
+        restCol.clear();
+        prevPos = 0;
+        
+        for (u64 l = chunks[ch].lines; l-- && !getline(in, line).fail();)
+        {
+            split(fields, line, '\t');
+            
+            if (fields.size() < SAM_MIN_COLS)                   // Kind 2
+            {
+                numCol += (char) 2;
+                restCol += line;    restCol += (char) 254;
+                continue;
+            }
+            
+            cigar.clear();
+            const bool canonical = canonicalNumber(fields[1], flag) &&
+                                   canonicalNumber(fields[3], pos)  &&
+                                   canonicalNumber(fields[4], mapq) &&
+                                   packCigar(cigar, fields[5]);
+            
+            packHdr(qnameCol, fields[0], HdrMap);       qnameCol += (char) 254;
+            packSeq_3to1(seqCol, fields[9]);            seqCol   += (char) 254;
+            packQS(qualCol, fields[10], QsMap);         qualCol  += (char) 254;
+            
+            if (canonical)                                      // Kind 0
+            {
+                numCol += (char) 0;
+                numCol += cigar;
+                packVarint(numCol, flag);
+                packVarint(numCol, zigzag((i64) pos - (i64) prevPos));
+                packVarint(numCol, mapq);
+                prevPos = pos;
+                
+                restCol += fields[2];                           // RNAME
+                for (f = 6; f != 9; ++f)
+                { restCol += '\t';    restCol += fields[f]; }
+            }
+            else                                                // Kind 1
+            {
+                numCol += (char) 1;
+                
+                restCol += fields[1];
+                for (f = 2; f != 9; ++f)
+                { restCol += '\t';    restCol += fields[f]; }
+            }
+            
+            // Optional fields
+            for (u64 o = SAM_MIN_COLS; o < fields.size(); ++o)
+            { restCol += '\t';    restCol += fields[o]; }
+            restCol += (char) 254;
+        }
+        
+        // Columns, each after its size. Size of the last one is implied
+        context.clear();
+        context += to_string(qnameCol.size());    context += (char) 254;
+        context += to_string(numCol.size());      context += (char) 254;
+        context += to_string(seqCol.size());      context += (char) 254;
+        context += to_string(qualCol.size());     context += (char) 254;
+        context += qnameCol;    context += numCol;     context += seqCol;
+        context += qualCol;     context += restCol;
+        
+        // Shuffle
+        if (!disable_shuffle)
+        {
+            mutx.lock();//------------------------------------------------------
+            if (verbose && shufflingInProgress)    log() << "Shuffling...\n";
+            
+            shufflingInProgress = false;
+            mutx.unlock();//----------------------------------------------------
+            
+            shufflePkd(context);
+        }
+        
+        // For unshuffling: insert the size of packed context in the beginning
+        context.insert(0, chunkHeader(ch, context.size()));
+        
+        // Write header containing threadID for each
+        pkfile << THR_ID_HDR << to_string(threadID) << '\n';
+        pkfile << context << '\n';
+        ThreadPool::count(context.size());
+    }
+    
+    pkfile.close();
+    in.close();
+}
+
+/**
+ * @brief Compress and encrypt, based on type of input. Gzip input (and mate)
+ *        is decompressed first
+ */
+void EnDecrypto::compress ()
+{
+    const string fileName = inFileName,  mateFileName = pairFileName;
+    
+    limitMemory(2);                  // Packed file is read, output written
+    un_shuffleSeedGen();             // For all chunks
+    try
+    {
+        // Gzip input: decompress it first, then treat it as text
+        if (isGzip(inFileName))
+        {
+            if (verbose)    log() << "Decompressing gzip input...\n";
+            StageTimer timer("gunzip");
+            gunzip(inFileName, tmp(GZ_FILENAME "0"), threadPool());
+            inFileName = tmp(GZ_FILENAME "0");
+        }
+        if (!pairFileName.empty() && isGzip(pairFileName))
+        {
+            StageTimer timer("gunzip");
+            gunzip(pairFileName, tmp(GZ_FILENAME "1"), threadPool());
+            pairFileName = tmp(GZ_FILENAME "1");
+        }
+        if (verbose)    threadPool().report(log());
+        
+        const char inType = fileType(inFileName);
+        
+        // Paired-end mode: both mates must be FASTQ
+        if (!pairFileName.empty() &&
+            (inType != 'Q' || fileType(pairFileName) != 'Q'))
+            throw CryfaError(ErrCode::BAD_OPTIONS,
+                             "paired-end mode needs two FASTQ files.");
+        
+        // Reordering is for FASTQ reads -- Other members of archive are kept
+        if ((reorder || reorder_keep) && inType != 'Q' && !archiving)
+            throw CryfaError(ErrCode::BAD_OPTIONS,
+                             "reordering is only for FASTQ files.");
+        
+        switch (inType)
+        {
+            case 'A': log() << "Compacting...\n";  compressFA();         break;
+            case 'Q': log() << "Compacting...\n";  compressFQ();         break;
+            case 'S': log() << "Compacting...\n";  compressSAM();        break;
+            default:  throw CryfaError(ErrCode::BAD_INPUT, "\"" + fileName +
+                                 "\" is not a valid FASTA, FASTQ or SAM file.");
+        }
+        
+        // Input, as given -- Gzip or not
+        stats().bytesIn += fileSize(fileName);
+        if (!mateFileName.empty())    stats().bytesIn += fileSize(mateFileName);
+    }
+    catch (...)
+    {
+        removeGunzipped(tmpPrefix);
+        inFileName = fileName;    pairFileName = mateFileName;
+        throw;
+    }
+    
+    removeGunzipped(tmpPrefix);
+    inFileName = fileName;    pairFileName = mateFileName;
+}
+
+/**
+ * @brief Compress and encrypt many files in one archive: each one is packed
+ *        as if it was alone, with its own tables, and all of them are
+ *        encrypted together. An index of members comes at the end
+ * @param inFileNames  Input file names
+ */
+void EnDecrypto::compressArchive (const vector<string> &inFileNames)
+{
+    // Stored names: without directories and gzip extension. Each one must
+    // be unique, to be extracted
+    vector<string> memberNames;
+    for (const string &fileName : inFileNames)
+    {
+        string memberName = fileName.substr(fileName.find_last_of('/') + 1);
+        if (memberName.size() > 3 && isGzip(fileName) &&
+            memberName.compare(memberName.size()-3, 3, ".gz") == 0)
+            memberName.erase(memberName.size()-3);
+        if (memberName.find((char) 254) != string::npos)
+            throw CryfaError(ErrCode::BAD_INPUT,
+                             "\"" + fileName + "\" is not a valid name.");
+        
+        const auto same = std::find(memberNames.begin(), memberNames.end(),
+                                    memberName);
+        if (same != memberNames.end())
+            throw CryfaError(ErrCode::BAD_OPTIONS, "\"" +
+                             inFileNames[same - memberNames.begin()] +
+                             "\" and \"" + fileName + "\" would both be \"" +
+                             memberName + "\" in the archive.");
+        memberNames.push_back(memberName);
+    }
+    
+    // Members are packed at once, each one by an object of its own, on the
+    // workers of this one, so that chunks of small members keep all of them
+    // busy. Progress of a member is shown when it is packed. With a memory
+    // budget, they are packed one after another
+    ThreadPool &workers  = threadPool();
+    const u64   nMembers = inFileNames.size();
+    const u64   nRunners = maxMemory ? 1 : std::min(nMembers,
+                                                    (u64) workers.size());
+    const auto  prefix   = [this] (u64 m)
+                           { return tmp("CRYFA_M" + to_string(m) + "_"); };
+    std::atomic<u64>           next(0);
+    std::mutex                 logMutex;
+    vector<std::exception_ptr> errors(nMembers);
+    
+    const auto packMembers = [&] {
+        for (u64 m; (m = next++) < nMembers;)
+        {
+            std::ostringstream progress;
+            EnDecrypto member;
+            member.verbose         = verbose;
+            member.disable_shuffle = disable_shuffle;
+            member.reorder         = reorder;
+            member.reorder_keep    = reorder_keep;
+            member.n_threads       = n_threads;
+            member.chunkBytes      = chunkBytes;
+            member.maxMemory       = maxMemory;
+            member.keyFileName     = keyFileName;
+            member.password        = password;
+            member.pool            = &workers;
+            member.tmpPrefix       = prefix(m);
+            member.logStream       = &progress;
+            member.archiving       = true;
+            member.inFileName      = inFileNames[m];
+            try
+            {
+                member.compress();
+            }
+            catch (...)
+            {
+                errors[m] = std::current_exception();
+                next = nMembers;                         // Start no more
+            }
+            
+            std::lock_guard<std::mutex> lock(logMutex);
+            log() << "Member \"" << memberNames[m] << "\":\n"
+                  << progress.str();
+        }
+    };
+    vector<thread> runners;
+    for (u64 r = 1; r < nRunners; ++r)    runners.emplace_back(packMembers);
+    packMembers();
+    for (thread &runner : runners)    runner.join();
+    
+    for (const std::exception_ptr &e : errors)
+        if (e)
+        {
+            for (u64 m = 0; m != nMembers; ++m)
+                std::remove((prefix(m) + PCKD_FILENAME).c_str());
+            std::rethrow_exception(e);
+        }
+    
+    // Append the packed members to the archive, in order
+    StageTimer appending("archive");
+    string   index;
+    ofstream arcFile(tmp(ARC_FILENAME));
+    arcFile << (char) 124;                 // Let decryptor know it's archive
+    for (u64 m = 0; m != nMembers; ++m)
+    {
+        const string pckdFileName = prefix(m) + PCKD_FILENAME;
+        ifstream pckdFile(pckdFileName);
+        const pos_t begPos = arcFile.tellp();
+        arcFile << pckdFile.rdbuf();
+        pckdFile.close();
+        std::remove(pckdFileName.c_str());
+        
+        index += memberNames[m];                       index += (char) 254;
+        index += to_string(arcFile.tellp() - begPos);  index += (char) 254;
+    }
+    
+    // Index, then its size
+    arcFile << index << index.size() << (char) 254;
+    arcFile.close();
+    appending.stop();
+    
+    std::rename(tmp(ARC_FILENAME).c_str(), tmp(PCKD_FILENAME).c_str());
+    
+    // Cout encrypted content
+    limitMemory(2);
+    encrypt();
+}
+
+/**
+ * @brief Decompress an archive, already decrypted. Members are written to
+ *        files with their stored names, or one of them to stdout
+ * @param memberName  Member to extract to stdout. All of them, if empty
+ */
+void EnDecrypto::decompressArchive (const string &memberName)
+{
+    std::rename(tmp(DEC_FILENAME).c_str(), tmp(ARC_FILENAME).c_str());
+    ifstream arcFile(tmp(ARC_FILENAME));
+    
+    std::ostream *archiveOut = outStream;
+    const string archiveOutName = outFileName;
+    try
+    {
+        // Index size, at the end of archive
+        char   c;
+        string indexSizeStr, name, sizeStr;
+        arcFile.seekg(-1, std::ios::end);
+        const pos_t endPos = arcFile.tellg();
+        for (arcFile.seekg(-2, std::ios::end);
+             arcFile.get(c) && c != (char) 254;
+             arcFile.seekg(-2, std::ios::cur))
+            indexSizeStr.insert(0, 1, c);
+        
+        // Index: name and size of members. Names are written as files, so
+        // they can't leave the current directory
+        const pos_t indexPos = endPos - (pos_t) (indexSizeStr.size() +
+                                                 stoull(indexSizeStr));
+        arcFile.seekg(indexPos);
+        vector<std::pair<string, u64>> members;
+        while (arcFile.tellg() < endPos - (pos_t) indexSizeStr.size())
+        {
+            name.clear();
+            while (arcFile.get(c) && c != (char) 254)    name += c;
+            sizeStr.clear();
+            while (arcFile.get(c) && c != (char) 254)    sizeStr += c;
+            if (name.empty() || name == "." || name == ".." ||
+                name.find('/') != string::npos)
+                throw CryfaError(ErrCode::BAD_ENCRYPTED, "\"" + name +
+                                 "\" is not a valid name of a member.");
+            members.emplace_back(name, stoull(sizeStr));
+        }
+        
+        // Members
+        bool  found = false;
+        pos_t begPos = 1;                           // After (char) 124
+        char  buffer[BLOCK_SIZE];
+        for (const auto &member : members)
+        {
+            if (memberName.empty() || member.first == memberName)
+            {
+                found = true;
+                
+                // Copy the member, as the only decrypted content
+                ofstream decFile(tmp(DEC_FILENAME));
+                arcFile.seekg(begPos);
+                for (u64 left = member.second, n; left; left -= n)
+                {
+                    n = std::min(left, (u64) BLOCK_SIZE);
+                    arcFile.read(buffer, (std::streamsize) n);
+                    decFile.write(buffer, (std::streamsize) n);
+                }
+                decFile.close();
+                
+                // Output to a file with the stored name, or to stdout
+                ofstream outFile;
+                if (memberName.empty())
+                {
+                    outFile.open(member.first);
+                    if (!outFile.is_open())
+                        throw CryfaError(ErrCode::OPEN_FAILED, "failed "
+                                         "opening \"" + member.first + "\".");
+                    outStream   = &outFile;
+                    outFileName = member.first;
+                }
+                
+                log() << "Decompressing \"" << member.first << "\"...\n";
+                const byte threads = n_threads;    // A member may use fewer
+                decompress();
+                n_threads = threads;
+                
+                outStream->flush();
+                outStream   = archiveOut;
+                outFileName = archiveOutName;
+            }
+            begPos += (pos_t) member.second;
+        }
+        
+        if (!found)
+            throw CryfaError(ErrCode::NOT_IN_ARCHIVE,
+                             "\"" + memberName + "\" is not in the archive.");
+    }
+    catch (...)
+    {
+        // No decrypted content is left behind
+        outStream   = archiveOut;
+        outFileName = archiveOutName;
+        arcFile.close();
+        std::remove(tmp(ARC_FILENAME).c_str());
+        std::remove(tmp(DEC_FILENAME).c_str());
+        throw;
+    }
+    
+    arcFile.close();
+    std::remove(tmp(ARC_FILENAME).c_str());
+}
+
+/**
+ * @brief Decompress the decrypted file, based on its type
+ */
+void EnDecrypto::decompress ()
+{
+    un_shuffleSeedGen();                   // For all chunks
+    
+    ifstream in(tmp(DEC_FILENAME));
+    const int inType = in.peek();
+    in.close();
+    
+    switch (inType)
+    {
+        case 127: decompressFA();                                         break;
+        case 125: decompressSAM();                                        break;
+        case 124: decompressArchive(extractName);                         break;
+        default:  decompressFQ();                                         break;
+    }
+}
+
+/**
+ * @brief   Encrypt
+ * @details AES encryption uses a secret key of a variable length (128, 196
+ *          or 256 bit). This key is secretly exchanged between two parties
+ *          before communication begins.
+ *
+ *          DEFAULT_KEYLENGTH = 16 bytes.
+ */
+inline void EnDecrypto::encrypt ()
+{
+    log() << "Encrypting...\n";
+    
+    // Output file is written directly, in large blocks. Standard output in
+    // blocks kept in flight
+    std::unique_ptr<AsyncWriter> writer;
+    if (!outFileName.empty())
+        writer.reset(new AsyncWriter(outFileName));
+    else if (outStream == &cout)
+    {
+        cout.flush();
+        fflush(stdout);
+        writer.reset(new AsyncWriter(STDOUT_FILENO));
+    }
+    
+    // Watermark for encrypted file
+    const string watermark = "#cryfa v" + to_string(VERSION_CRYFA) + "."
+                                        + to_string(RELEASE_CRYFA) + "\n";
+    if (writer)    writer->write(watermark.data(), watermark.size());
+    else           *outStream << watermark;
+    
+    // Start timer for encryption
+    StageTimer timer("encrypt");
     
-    /*
     byte key[AES::DEFAULT_KEYLENGTH], iv[AES::BLOCKSIZE];
     memset(key, 0x00, (size_t) AES::DEFAULT_KEYLENGTH); // AES key
     memset(iv,  0x00, (size_t) AES::BLOCKSIZE);         // Initialization Vector
@@ -581,33 +1108,36 @@ inline void EnDecrypto::encrypt ()
     const string pass = extractPass();
     buildKey(key, pass);
     buildIV(iv, pass);
-//    printIV(iv);      // debug
-//    printKey(key);    // debug
-    
-    string cipherText;
-    AES::Encryption aesEncryption(key, (size_t) AES::DEFAULT_KEYLENGTH);
-    CBC_Mode_ExternalCipher::Encryption cbcEncryption(aesEncryption, iv);
-    StreamTransformationFilter stfEncryptor(cbcEncryption,
-                                            new CryptoPP::StringSink(cipherText));
-    stfEncryptor.Put(reinterpret_cast<const byte*>
-                     (context.c_str()), context.length() + 1);
-    stfEncryptor.MessageEnd();
-
-//    if (verbose)
-//    {
-//        cerr << "   sym size: " << context.size()    << '\n';
-//        cerr << "cipher size: " << cipherText.size() << '\n';
-//        cerr << " block size: " << AES::BLOCKSIZE    << '\n';
-//    }
-    
-    string encryptedText;
-    for (const char &c : cipherText)
-        encryptedText += (char) (c & 0xFF);
-////        encryptedText += (char) (0xFF & static_cast<byte> (c));
-
-////    encryptedText+='\n';
-    return encryptedText;
-    */
+//    printIV(iv);      // Debug
+//    printKey(key);    // Debug
+    
+    // Encrypt. Blocks of packed file are read ahead, and blocks of output
+    // written, while the next ones are encrypted
+    CBC_Mode<CryptoPP::AES>::Encryption
+            cbcEnc(key, (size_t) AES::DEFAULT_KEYLENGTH, iv);
+    StreamTransformationFilter filter(cbcEnc, writer
+        ? (CryptoPP::BufferedTransformation*) new AsyncSink(*writer)
+        : new FileSink(*outStream));
+    const u64 packedSize = fileSize(tmp(PCKD_FILENAME));
+    {
+        AsyncReader in(tmp(PCKD_FILENAME), 0, packedSize);
+        const char *block;
+        for (size_t n; (n = in.read(block)) != 0;)
+            filter.Put((const byte*) block, n);
+    }
+    filter.MessageEnd();
+    if (writer)    writer->finish();
+    
+    // Padding makes the last block whole, adding one, if it was already
+    stats().bytesOut += watermark.size() +
+                        (packedSize / AES::BLOCKSIZE + 1) * AES::BLOCKSIZE;
+    
+    log() << (verbose ? "Encryption done," : "Done,") << " in "
+          << std::fixed << setprecision(4) << timer.stop() << " seconds.\n";
+    
+    // Delete packed file
+    const string pkdFileName = tmp(PCKD_FILENAME);
+    std::remove(pkdFileName.c_str());
 }
 
 /**
@@ -622,7 +1152,8 @@ void EnDecrypto::decrypt ()
 {
     ifstream in(inFileName);
     if (!in.good())
-    { cerr << "Error: failed opening \"" << inFileName << "\".\n";    exit(1); }
+        throw CryfaError(ErrCode::OPEN_FAILED,
+                         "failed opening \"" + inFileName + "\".");
     
     // Watermark
     string watermark = "#cryfa v";
@@ -633,20 +1164,15 @@ void EnDecrypto::decrypt ()
     string line;    getline(in, line);
     if ((line + "\n") != watermark)
     {
-        cerr << "Error: \"" << inFileName << '"'
-             << " is not a valid file encrypted by cryfa.\n";
-        exit(1);
+        throw CryfaError(ErrCode::BAD_ENCRYPTED, "\"" + inFileName +
+                         "\" is not a valid file encrypted by cryfa.");
     }
     
-////    string::size_type watermarkIdx = cipherText.find(watermark);
-////    if (watermarkIdx == string::npos)
-////    { cerr << "Error: invalid encrypted file!\n";    exit(1); }
-////    else  cipherText.erase(watermarkIdx, watermark.length());
-    
-    cerr << "Decrypting...\n";
+    log() << "Decrypting...\n";
+    limitMemory(2 * (u64) n_threads);   // Each thread reads and writes
     
     // Start timer for decryption
-    high_resolution_clock::time_point startTime = high_resolution_clock::now();
+    StageTimer timer("decrypt");
     
     byte key[AES::DEFAULT_KEYLENGTH], iv[AES::BLOCKSIZE];
     memset(key, 0x00, (size_t) AES::DEFAULT_KEYLENGTH); // AES key
@@ -657,31 +1183,82 @@ void EnDecrypto::decrypt ()
     buildIV(iv, pass);
 //    printIV(iv);      // Debug
 //    printKey(key);    // Debug
-
-//    string cipherText( (std::istreambuf_iterator<char> (in)),
-//                       std::istreambuf_iterator<char> () );
-
-//    if (verbose)
-//    {
-//        cerr << "cipher size: " << cipherText.size()-1 << '\n';
-//        cerr << " block size: " << AES::BLOCKSIZE        << '\n';
-//    }
     
-    const char* outFile = DEC_FILENAME;
-    CBC_Mode<CryptoPP::AES>::Decryption
-            cbcDec(key, (size_t) AES::DEFAULT_KEYLENGTH, iv);
-    FileSource(in, true,
-               new StreamTransformationFilter(cbcDec, new FileSink(outFile)));
+    // Each block only needs the previous cipher block to be decrypted, so
+    // ranges of blocks are shared among workers
+    const pos_t cipherBeg = in.tellg();
+    in.seekg(0, std::ios::end);
+    const u64 nBlocks = (u64) (in.tellg() - cipherBeg) / AES::BLOCKSIZE;
+    stats().bytesIn += (u64) in.tellg();
+    in.close();
+    
+    ofstream(tmp(DEC_FILENAME)).close();               // Empty it
+    const u64 nRanges = std::min((u64) threadPool().size(), nBlocks);
+    const io_limits_s limits = ioLimits();          // Of this object
+    for (u64 r = 0; r != nRanges; ++r)
+        threadPool().submit([&, r] {
+            ioLimits() = limits;
+            decryptRange(key, iv, cipherBeg, nBlocks*r/nRanges,
+                         nBlocks*(r+1)/nRanges, r == nRanges-1);
+        });
+    try
+    {
+        threadPool().wait();
+        if (verbose)    threadPool().report(log());
+    }
+    catch (CryptoPP::Exception const &)
+    {
+        std::remove(tmp(DEC_FILENAME).c_str());
+        throw CryfaError(ErrCode::BAD_ENCRYPTED, "wrong password, or \"" +
+                         inFileName + "\" is corrupted.");
+    }
+    
+    log() << (verbose ? "Decryption done," : "Done,") << " in "
+          << std::fixed << setprecision(4) << timer.stop() << " seconds.\n";
+}
+
+/**
+ * @brief Decrypt a range of cipher blocks, into their place in decrypted file
+ * @param key        Key
+ * @param iv         Initialization vector
+ * @param cipherBeg  Position of the first cipher block in input file
+ * @param first      First block of the range
+ * @param last       One after the last block of the range
+ * @param lastRange  If the range is the last one, which has the padding
+ */
+inline void EnDecrypto::decryptRange (const byte *key, const byte *iv,
+                                      pos_t cipherBeg, u64 first, u64 last,
+                                      bool lastRange) const
+{
+    const u64 BS = AES::BLOCKSIZE,  beg = (u64) cipherBeg;
+    byte      rangeIV[AES::BLOCKSIZE];
     
-    // Stop timer for decryption
-    high_resolution_clock::time_point finishTime = high_resolution_clock::now();
-    // Decryption duration in seconds
-    std::chrono::duration<double> elapsed = finishTime - startTime;
+    // IV of the range: the cipher block before it
+    if (first == 0)    memcpy(rangeIV, iv, (size_t) BS);
+    else
+    {
+        ifstream in(inFileName);
+        in.seekg((std::streamoff) (beg + (first-1) * BS));
+        in.read((char*) rangeIV, (std::streamsize) BS);
+    }
     
-    cerr << (verbose ? "Decryption done," : "Done,") << " in "
-         << std::fixed << setprecision(4) << elapsed.count() << " seconds.\n";
+    // Blocks are read ahead and written behind, while others are decrypted
+    AsyncReader in (inFileName, beg + first * BS, beg + last * BS);
+    AsyncWriter out(tmp(DEC_FILENAME), first * BS);
+    CBC_Mode<CryptoPP::AES>::Decryption
+            cbcDec(key, (size_t) AES::DEFAULT_KEYLENGTH, rangeIV);
+    StreamTransformationFilter filter(cbcDec, new AsyncSink(out),
+        lastRange ? StreamTransformationFilter::DEFAULT_PADDING
+                  : StreamTransformationFilter::NO_PADDING);
     
-    in.close();
+    const char *block;
+    for (size_t n; (n = in.read(block)) != 0;)
+    {
+        filter.Put((const byte*) block, n);
+        ThreadPool::count(n);
+    }
+    filter.MessageEnd();
+    out.finish();
 }
 
 /**
@@ -690,164 +1267,53 @@ void EnDecrypto::decrypt ()
 void EnDecrypto::decompressFA ()
 {
     // Start timer for decompression
-    high_resolution_clock::time_point startTime = high_resolution_clock::now();
+    StageTimer timer("decompress");
     
     char     c;                     // Chars in file
     string   headers;
     unpack_s upkStruct;             // Collection of inputs to pass to unpack...
-    string   chunkSizeStr;          // Chunk size (string) -- For unshuffling
-    thread   arrThread[n_threads];  // Array of threads
-    byte     t;                     // For threads
-    u64      offset;                // To traverse decompressed file
     
-    ifstream in(DEC_FILENAME);
+    ifstream in(tmp(DEC_FILENAME));
     in.ignore(1);                   // Jump over decText[0]==(char) 127
     in.get(c);    shuffled = (c==(char) 128); // Check if file had been shuffled
     while (in.get(c) && c != (char) 254)    headers += c;
-    const size_t headersLen = headers.length();
-    u16 keyLen_hdr = 0;
     
     // Show number of different chars in headers -- Ignore '>'=62
-    if (verbose)  cerr<< headersLen <<" different characters are in headers.\n";
+    if (verbose)
+        log() << headers.length() << " different characters are in headers.\n";
     
-    // Function pointer
-    using unpackHdrPtr =
-                   void (*) (string&, string::iterator&, const vector<string>&);
-    unpackHdrPtr unpackHdr;
+    // Tables and unpacking function for headers
+    setHdrUnpacker(headers, upkStruct);
     
-    // Header
-    if      (headersLen > MAX_C5)           keyLen_hdr = KEYLEN_C5;
-    else if (headersLen > MAX_C4)                                       // Cat 5
-    {   unpackHdr = &unpack_read2B;         keyLen_hdr = KEYLEN_C5; }
-    else
-    {   unpackHdr = &unpack_read1B;
-
-        if      (headersLen > MAX_C3)       keyLen_hdr = KEYLEN_C4;     // Cat 4
-        else if (headersLen==MAX_C3 || headersLen==MID_C3 || headersLen==MIN_C3)
-                                            keyLen_hdr = KEYLEN_C3;     // Cat 3
-        else if (headersLen == C2)          keyLen_hdr = KEYLEN_C2;     // Cat 2
-        else if (headersLen == C1)          keyLen_hdr = KEYLEN_C1;     // Cat 1
-        else                                keyLen_hdr = 1;             // = 1
+    // Alphabet of sequences, if they are not packed as DNA
+    if (in.peek() == 249)
+    {
+        string seqChars;
+        in.ignore(1);
+        while (in.get(c) && c != (char) 254)    seqChars += c;
+        setSeqUnpacker(seqChars, upkStruct);
+        
+        if (verbose)
+            log() << seqChars.length() << " different characters are in "
+                                         "sequences.\n";
     }
+    
+    // Distribute file among threads, for reading and unpacking
+    unpackChunks(in, upkStruct, headers.length() <= MAX_C5 ?
+                 &EnDecrypto::unpackHS : &EnDecrypto::unpackHL);
+    
+    // Close/delete decrypted file
+    in.close();
+    const string decFileName = tmp(DEC_FILENAME);
+    std::remove(decFileName.c_str());
 
-    if (headersLen <= MAX_C5)
-    {
-        // Tables for unpacking
-        buildUnpack(upkStruct.hdrUnpack, headers, keyLen_hdr);
+    // Join unpacked files, if not written in place -- Records begin at
+    // headers
+    if (inPlace)    countInPlace(1);
+    else            joinUnpackedFiles('>');
 
-        // Distribute file among threads, for reading and unpacking
-        for (t = 0; t != n_threads; ++t)
-        {
-            in.get(c);
-            if (c == (char) 253)
-            {
-                chunkSizeStr.clear();   // Chunk size
-                while (in.get(c) && c != (char) 254)    chunkSizeStr += c;
-                offset = stoull(chunkSizeStr);
-
-                upkStruct.begPos        = in.tellg();
-                upkStruct.chunkSize     = offset;
-                upkStruct.unpackHdrFPtr = unpackHdr;
-
-                arrThread[t]= thread(&EnDecrypto::unpackHS, this, upkStruct, t);
-
-                // Jump to the beginning of the next chunk
-                in.seekg((std::streamoff) offset, std::ios_base::cur);
-            }
-            // End of file
-            if (in.peek() == 252)    break;
-        }
-        // Join threads
-        for (t = 0; t != n_threads; ++t)
-            if (arrThread[t].joinable())    arrThread[t].join();
-
-        if (verbose)    cerr << "Unshuffling done!\n";
-    }
-    else
-    {
-        const string decHeaders = headers.substr(headersLen - MAX_C5);
-        // ASCII char after the last char in headers string
-        string decHeadersX = decHeaders;
-        decHeadersX += (upkStruct.XChar_hdr = (char) (decHeaders.back() + 1));
-        
-        // Tables for unpacking
-        buildUnpack(upkStruct.hdrUnpack, decHeadersX, keyLen_hdr);
-        
-        // Distribute file among threads, for reading and unpacking
-        for (t = 0; t != n_threads; ++t)
-        {
-            in.get(c);
-            if (c == (char) 253)
-            {
-                chunkSizeStr.clear();   // Chunk size
-                while (in.get(c) && c != (char) 254)    chunkSizeStr += c;
-                offset = stoull(chunkSizeStr);
-
-                upkStruct.begPos        = in.tellg();
-                upkStruct.chunkSize     = offset;
-
-                arrThread[t]= thread(&EnDecrypto::unpackHL, this, upkStruct, t);
-
-                // Jump to the beginning of the next chunk
-                in.seekg((std::streamoff) offset, std::ios_base::cur);
-            }
-            // End of file
-            if (in.peek() == 252)    break;
-        }
-        // Join threads
-        for (t = 0; t != n_threads; ++t)
-            if (arrThread[t].joinable())    arrThread[t].join();
-
-        if (verbose)    cerr << "Unshuffling done!\n";
-    }
-    
-    // Close/delete decrypted file
-    in.close();
-    const string decFileName = DEC_FILENAME;
-    std::remove(decFileName.c_str());
-
-    // Join unpacked files
-    ifstream upkdFile[n_threads];
-    string line;
-    for (t = n_threads; t--;)   upkdFile[t].open(UPK_FILENAME+to_string(t));
-
-    bool prevLineNotThrID;            // If previous line was "THRD=" or not
-    while (!upkdFile[0].eof())
-    {
-        for (t = 0; t != n_threads; ++t)
-        {
-            prevLineNotThrID = false;
-
-            while (getline(upkdFile[t], line).good() &&
-                   line != THR_ID_HDR+to_string(t))
-            {
-                if (prevLineNotThrID)
-                    cout << '\n';
-                cout << line;
-
-                prevLineNotThrID = true;
-            }
-
-            if (prevLineNotThrID)    cout << '\n';
-        }
-    }
-
-    // Stop timer for decompression
-    high_resolution_clock::time_point finishTime = high_resolution_clock::now();
-    // Decompression duration in seconds
-    std::chrono::duration<double> elapsed = finishTime - startTime;
-
-    cerr << (verbose ? "Decompression done," : "Done,") << " in "
-         << std::fixed << setprecision(4) << elapsed.count() << " seconds.\n";
-
-    // Close/delete input/output files
-    string upkdFileName;
-    for (t = n_threads; t--;)
-    {
-        upkdFile[t].close();
-        upkdFileName=UPK_FILENAME;    upkdFileName+=to_string(t);
-        std::remove(upkdFileName.c_str());
-    }
+    log() << (verbose ? "Decompression done," : "Done,") << " in "
+          << std::fixed << setprecision(4) << timer.stop() << " seconds.\n";
 }
 
 /**
@@ -858,32 +1324,34 @@ void EnDecrypto::decompressFA ()
 inline void EnDecrypto::unpackHS (const unpack_s &upkStruct, byte threadID)
 {
     using unpackHdrFPtr =
-                   void (*) (string&, string::iterator&, const vector<string>&);
+                   void (*) (string&, string::iterator&, const utbl_t&);
     unpackHdrFPtr    unpackHdr = upkStruct.unpackHdrFPtr;    // Function pointer
-    pos_t            begPos    = upkStruct.begPos;
-    u64              chunkSize = upkStruct.chunkSize;
-    ifstream         in(DEC_FILENAME);
-    string           decText, chunkSizeStr;
+    ifstream         in(tmp(DEC_FILENAME));
+    string           decText;
     string::iterator i;
-    char             c;
-    pos_t            endPos;
-    ofstream upkfile(UPK_FILENAME+to_string(threadID), std::ios_base::app);
+    ofstream upkfile;                   // Chunks to join, if not in place
+    std::ostringstream upkText;         // Unpacked chunk
     string upkhdrOut, upkSeqOut;
 
-    while (in.peek() != EOF)
+    decText.reserve(upkStruct.chunkBytes);    // Chunks fit, mostly
+    
+    // Chunks threadID, threadID + n_threads, ...
+    for (u64 ch = threadID; ch < pckdChunks.size(); ch += n_threads)
     {
-        in.seekg(begPos);      // Read the file from this position
+        const u64  chunkSize = pckdChunks[ch].size;
+        const bool continued = pckdChunks[ch].continued;
+        in.seekg(pckdChunks[ch].pos);
         // Take a chunk of decrypted file
-        decText.clear();
-        for (u64 u = chunkSize; u--;) { in.get(c);    decText += c; }
+        decText.resize(chunkSize);
+        in.read(&decText[0], (std::streamsize) chunkSize);
+        ThreadPool::count(chunkSize);
         i = decText.begin();
-        endPos = in.tellg();   // Set the end position
 
         // Unshuffle
         if (shuffled)
         {
             mutx.lock();//------------------------------------------------------
-            if (verbose && shufflingInProgress)    cerr << "Unshuffling...\n";
+            if (verbose && shufflingInProgress)    log() << "Unshuffling...\n";
 
             shufflingInProgress = false;
             mutx.unlock();//----------------------------------------------------
@@ -891,41 +1359,95 @@ inline void EnDecrypto::unpackHS (const unpack_s &upkStruct, byte threadID)
             unshufflePkd(i, chunkSize);
         }
 
-        upkfile << THR_ID_HDR + to_string(threadID) << '\n';
         do {
             if (*i == (char) 253)                                         // Hdr
             {
                 unpackHdr(upkhdrOut, ++i, upkStruct.hdrUnpack);
-                upkfile << '>' << upkhdrOut << '\n';
+                upkText << '>' << upkhdrOut;
             }
             else                                                          // Seq
             {
-                unpackSeqFA_3to1(upkSeqOut, i);
-                upkfile << upkSeqOut << '\n';
+                unpackSeqFA(upkSeqOut, i, upkStruct);
+                upkText << upkSeqOut;
             }
+            
+            // (char) 251: joined without line feed to the next chunk
+            if (continued && i+1 == decText.end())    upkText << (char) 251;
+            upkText << '\n';
         } while (++i != decText.end());        // If trouble: change "!=" to "<"
-
-        // Update the chunk size and positions (beg & end)
-        for (byte t = n_threads; t--;)
-        {
-            in.seekg(endPos);
-            in.get(c);
-            if (c == (char) 253)
-            {
-                chunkSizeStr.clear();
-                while (in.get(c) && c != (char) 254)    chunkSizeStr += c;
-
-                chunkSize = stoull(chunkSizeStr);
-                begPos    = in.tellg();
-                endPos    = begPos + (pos_t) chunkSize;
-            }
-        }
+        
+        writeUnpacked(upkfile, upkText, ch, threadID, '>');
     }
 
     upkfile.close();
     in.close();
 }
 
+/**
+ * @brief      Unpack a FASTA sequence: its bases or residues, then its line
+ *             layout, if it has many lines
+ * @param[out] out        Sequence, with line feeds
+ * @param[in]  i          Input string iterator. Ends on the last byte
+ * @param[in]  upkStruct  Unpack structure
+ */
+inline void EnDecrypto::unpackSeqFA (string &out, string::iterator &i,
+                                     const unpack_s &upkStruct) const
+{
+    if (upkStruct.seqUnpack.empty())    unpackSeqFA_3to1(out, i);
+    else
+    {
+        if (upkStruct.unpackSeqFPtr)    upkStruct.unpackSeqFPtr(out, i,
+                                                          upkStruct.seqUnpack);
+        else                            unpackLarge_read2B(out, i,
+                                    upkStruct.XChar_seq, upkStruct.seqUnpack);
+        if (*i == (char) 252)           unpackLayout(out, i);
+    }
+}
+
+/**
+ * @brief      Unpack a FASTQ sequence
+ * @param[out] out        Sequence
+ * @param[in]  i          Input string iterator. Ends on (char) 254
+ * @param[in]  upkStruct  Unpack structure
+ */
+inline void EnDecrypto::unpackSeqFQ (string &out, string::iterator &i,
+                                     const unpack_s &upkStruct) const
+{
+    if      (upkStruct.seqUnpack.empty())    unpackSeqFQ_3to1(out, i);
+    else if (upkStruct.unpackSeqFPtr)        upkStruct.unpackSeqFPtr(out, i,
+                                                          upkStruct.seqUnpack);
+    else                                     unpackLarge_read2B(out, i,
+                                    upkStruct.XChar_seq, upkStruct.seqUnpack);
+}
+
+/**
+ * @brief      Unpack a FASTQ quality score. If it has no (char) 254 after,
+ *             it is as long as its sequence
+ * @param[out] out        Quality score
+ * @param[in]  i          Input string iterator. Ends after the quality score
+ * @param[in]  len        Length of its sequence
+ * @param[in]  upkStruct  Unpack structure
+ */
+inline void EnDecrypto::unpackQsFQ (string &out, string::iterator &i, u64 len,
+                                    const unpack_s &upkStruct) const
+{
+    const auto unpackQS = upkStruct.unpackQSFPtr;
+    
+    if (upkStruct.qsCounted)
+    {
+        if (!unpackQS)    unpackLargeFixed(out, i, len, upkStruct.XChar_qs,
+                                           upkStruct.qsUnpack);
+        else              unpackFixed(out, i, len, upkStruct.qsUnpack,
+                                      unpackQS == &unpack_read2B ? 2 : 1);
+        return;
+    }
+    
+    if (!unpackQS)    unpackLarge_read2B(out, i, upkStruct.XChar_qs,
+                                         upkStruct.qsUnpack);
+    else              unpackQS(out, i, upkStruct.qsUnpack);
+    ++i;                                                        // (char) 254
+}
+
 /**
  * @brief Unpack FASTA: large header
  * @param upkStruct  Unpack structure
@@ -933,30 +1455,32 @@ inline void EnDecrypto::unpackHS (const unpack_s &upkStruct, byte threadID)
  */
 inline void EnDecrypto::unpackHL (const unpack_s &upkStruct, byte threadID)
 {
-    pos_t            begPos    = upkStruct.begPos;
-    u64              chunkSize = upkStruct.chunkSize;
-    ifstream         in(DEC_FILENAME);
-    string           decText, chunkSizeStr;
+    ifstream         in(tmp(DEC_FILENAME));
+    string           decText;
     string::iterator i;
-    char             c;
-    pos_t            endPos;
-    ofstream upkfile(UPK_FILENAME+to_string(threadID), std::ios_base::app);
+    ofstream upkfile;                   // Chunks to join, if not in place
+    std::ostringstream upkText;         // Unpacked chunk
     string upkHdrOut, upkSeqOut;
     
-    while (in.peek() != EOF)
+    decText.reserve(upkStruct.chunkBytes);    // Chunks fit, mostly
+    
+    // Chunks threadID, threadID + n_threads, ...
+    for (u64 ch = threadID; ch < pckdChunks.size(); ch += n_threads)
     {
-        in.seekg(begPos);      // Read the file from this position
+        const u64  chunkSize = pckdChunks[ch].size;
+        const bool continued = pckdChunks[ch].continued;
+        in.seekg(pckdChunks[ch].pos);
         // Take a chunk of decrypted file
-        decText.clear();
-        for (u64 u = chunkSize; u--;) { in.get(c);    decText += c; }
+        decText.resize(chunkSize);
+        in.read(&decText[0], (std::streamsize) chunkSize);
+        ThreadPool::count(chunkSize);
         i = decText.begin();
-        endPos = in.tellg();   // Set the end position
 
         // Unshuffle
         if (shuffled)
         {
             mutx.lock();//------------------------------------------------------
-            if (verbose && shufflingInProgress)    cerr << "Unshuffling...\n";
+            if (verbose && shufflingInProgress)    log() << "Unshuffling...\n";
 
             shufflingInProgress = false;
             mutx.unlock();//----------------------------------------------------
@@ -964,36 +1488,25 @@ inline void EnDecrypto::unpackHL (const unpack_s &upkStruct, byte threadID)
             unshufflePkd(i, chunkSize);
         }
 
-        upkfile << THR_ID_HDR + to_string(threadID) << '\n';
         do {
             if (*i == (char) 253)                                         // Hdr
             {
                 unpackLarge_read2B(upkHdrOut, ++i,
                                    upkStruct.XChar_hdr, upkStruct.hdrUnpack);
-                upkfile << '>' << upkHdrOut << '\n';
+                upkText << '>' << upkHdrOut;
             }
             else                                                          // Seq
             {
-                unpackSeqFA_3to1(upkSeqOut, i);
-                upkfile << upkSeqOut << '\n';
+                unpackSeqFA(upkSeqOut, i, upkStruct);
+                upkText << upkSeqOut;
             }
+            
+            // (char) 251: joined without line feed to the next chunk
+            if (continued && i+1 == decText.end())    upkText << (char) 251;
+            upkText << '\n';
         } while (++i != decText.end());        // If trouble: change "!=" to "<"
-
-        // Update the chunk size and positions (beg & end)
-        for (byte t = n_threads; t--;)
-        {
-            in.seekg(endPos);
-            in.get(c);
-            if (c == (char) 253)
-            {
-                chunkSizeStr.clear();
-                while (in.get(c) && c != (char) 254)    chunkSizeStr += c;
-
-                chunkSize = stoull(chunkSizeStr);
-                begPos    = in.tellg();
-                endPos    = begPos + (pos_t) chunkSize;
-            }
-        }
+        
+        writeUnpacked(upkfile, upkText, ch, threadID, '>');
     }
 
     upkfile.close();
@@ -1006,273 +1519,161 @@ inline void EnDecrypto::unpackHL (const unpack_s &upkStruct, byte threadID)
 void EnDecrypto::decompressFQ ()
 {
     // Start timer for decompression
-    high_resolution_clock::time_point startTime = high_resolution_clock::now();
+    StageTimer timer("decompress");
 
     char     c;                     // Chars in file
     string   headers, qscores;
     unpack_s upkStruct;             // Collection of inputs to pass to unpack...
-    string   chunkSizeStr;          // Chunk size (string) -- For unshuffling
-    thread   arrThread[n_threads];  // Array of threads
     byte     t;                     // For threads
-    u64      offset;                // To traverse decompressed file
 
-    ifstream in(DEC_FILENAME);
-    in.get(c);    shuffled = (c==(char) 128); // Check if file had been shuffled
+    ifstream in(tmp(DEC_FILENAME));
+    in.get(c);    paired = (c==(char) 126);   // Check if it is paired-end
+    if (paired)    in.get(c);
+    shuffled = (c==(char) 128);               // Check if file had been shuffled
     while (in.get(c) && c != (char) 254)                 headers += c;
     while (in.get(c) && c != '\n' && c != (char) 253)    qscores += c;
     if (c == '\n')    justPlus = false;                 // If 3rd line is just +
-
-    const size_t headersLen = headers.length();
-    const size_t qscoresLen = qscores.length();
-    u16 keyLen_hdr = 0,  keyLen_qs = 0;
-
-    // Show number of different chars in headers and qs -- ignore '@'=64
-    if (verbose)
-        cerr << headersLen << " different characters are in headers.\n"
-             << qscoresLen << " different characters are in quality scores.\n";
-
-    using unpackHdrPtr =
-                   void (*) (string&, string::iterator&, const vector<string>&);
-    unpackHdrPtr unpackHdr;                                  // Function pointer
-    using unpackQSPtr =
-                   void (*) (string&, string::iterator&, const vector<string>&);
-    unpackQSPtr unpackQS;                                    // Function pointer
-
-    // Header
-    if      (headersLen > MAX_C5)           keyLen_hdr = KEYLEN_C5;
-    else if (headersLen > MAX_C4)                                       // Cat 5
-    {   unpackHdr = &unpack_read2B;         keyLen_hdr = KEYLEN_C5; }
-    else
-    {   unpackHdr = &unpack_read1B;
-
-        if      (headersLen > MAX_C3)       keyLen_hdr = KEYLEN_C4;     // Cat 4
-        else if (headersLen==MAX_C3 || headersLen==MID_C3 || headersLen==MIN_C3)
-                                            keyLen_hdr = KEYLEN_C3;     // Cat 3
-        else if (headersLen == C2)          keyLen_hdr = KEYLEN_C2;     // Cat 2
-        else if (headersLen == C1)          keyLen_hdr = KEYLEN_C1;     // Cat 1
-        else                                keyLen_hdr = 1;             // = 1
-    }
-
-    // Quality score
-    if          (qscoresLen > MAX_C5)       keyLen_qs = KEYLEN_C5;
-    else if     (qscoresLen > MAX_C4)                                   // Cat 5
-    {   unpackQS = &unpack_read2B;          keyLen_qs = KEYLEN_C5; }
-    else
-    {   unpackQS = &unpack_read1B;
-
-        if      (qscoresLen > MAX_C3)       keyLen_qs = KEYLEN_C4;      // Cat 4
-        else if (qscoresLen==MAX_C3 || qscoresLen==MID_C3 || qscoresLen==MIN_C3)
-                                            keyLen_qs = KEYLEN_C3;      // Cat 3
-        else if (qscoresLen == C2)          keyLen_qs = KEYLEN_C2;      // Cat 2
-        else if (qscoresLen == C1)          keyLen_qs = KEYLEN_C1;      // Cat 1
-        else                                keyLen_qs = 1;              // = 1
-    }
-
-    string plusMore;
-    if (headersLen <= MAX_C5 && qscoresLen <= MAX_C5)
+    
+    // Alphabet of sequences, if they are not packed as DNA
+    string seqChars;
+    if (in.peek() == 249)
     {
-        // Tables for unpacking
-        buildUnpack(upkStruct.hdrUnpack, headers, keyLen_hdr);
-        buildUnpack(upkStruct.qsUnpack,  qscores, keyLen_qs);
-
-        // Distribute file among threads, for reading and unpacking
-        for (t = 0; t != n_threads; ++t)
-        {
-            in.get(c);
-            if (c == (char) 253)
-            {
-                chunkSizeStr.clear();   // Chunk size
-                while (in.get(c) && c != (char) 254)    chunkSizeStr += c;
-                offset = stoull(chunkSizeStr);
-
-                upkStruct.begPos        = in.tellg();
-                upkStruct.chunkSize     = offset;
-                upkStruct.unpackHdrFPtr = unpackHdr;
-                upkStruct.unpackQSFPtr  = unpackQS;
-
-                arrThread[t] =
-                        thread(&EnDecrypto::unpackHSQS, this, upkStruct, t);
-
-                // Jump to the beginning of the next chunk
-                in.seekg((std::streamoff) offset, std::ios_base::cur);
-            }
-            // End of file
-            if (in.peek() == 252)    break;
-        }
-        // Join threads
-        for (t = 0; t != n_threads; ++t)
-            if (arrThread[t].joinable())    arrThread[t].join();
-
-        if (verbose)    cerr << "Unshuffling done!\n";
+        in.ignore(1);
+        while (in.get(c) && c != (char) 254)    seqChars += c;
     }
-    else if (headersLen <= MAX_C5 && qscoresLen > MAX_C5)
+    
+    // Length of all reads, if it is fixed
+    string perm, numStr;
+    if (in.peek() == 247)
     {
-        const string decQscores = qscores.substr(qscoresLen - MAX_C5);
-        // ASCII char after the last char in decQscores string
-        string decQscoresX  = decQscores;
-        decQscoresX += (upkStruct.XChar_qs = (char) (decQscores.back() + 1));
-
-        // Tables for unpacking
-        buildUnpack(upkStruct.hdrUnpack, headers,     keyLen_hdr);
-        buildUnpack(upkStruct.qsUnpack,  decQscoresX, keyLen_qs);
-
-        // Distribute file among threads, for reading and unpacking
-        for (t = 0; t != n_threads; ++t)
-        {
-            in.get(c);
-            if (c == (char) 253)
-            {
-                chunkSizeStr.clear();   // Chunk size
-                while (in.get(c) && c != (char) 254)    chunkSizeStr += c;
-                offset = stoull(chunkSizeStr);
-
-                upkStruct.begPos        = in.tellg();
-                upkStruct.chunkSize     = offset;
-                upkStruct.unpackHdrFPtr = unpackHdr;
-
-                arrThread[t] =
-                        thread(&EnDecrypto::unpackHSQL, this, upkStruct, t);
-
-                // Jump to the beginning of the next chunk
-                in.seekg((std::streamoff) offset, std::ios_base::cur);
-            }
-            // End of file
-            if (in.peek() == 252)    break;
-        }
-        // Join threads
-        for (t = 0; t != n_threads; ++t)
-            if (arrThread[t].joinable())    arrThread[t].join();
-
-        if (verbose)    cerr << "Unshuffling done!\n";
+        in.ignore(1);
+        while (in.get(c) && c != (char) 254)    numStr += c;
+        upkStruct.readLen = stoull(numStr);    numStr.clear();
     }
-    else if (headersLen > MAX_C5 && qscoresLen > MAX_C5)
+    
+    // Quality scores have no (char) 254 after, if they end with sequences
+    if (in.peek() == 246)    { in.ignore(1);    upkStruct.qsCounted = true; }
+    
+    // Permutation of reads, if they have been reordered and order is kept
+    u64    permWindow = 0,  nReads = 0;
+    if (in.peek() == 250)
     {
-        const string decHeaders = headers.substr(headersLen - MAX_C5);
-        const string decQscores = qscores.substr(qscoresLen-MAX_C5);
-        // ASCII char after the last char in headers & quality_scores string
-        string decHeadersX = decHeaders;
-        decHeadersX += (upkStruct.XChar_hdr = (char) (decHeaders.back() + 1));
-        string decQscoresX = decQscores;
-        decQscoresX += (upkStruct.XChar_qs  = (char) (decQscores.back() + 1));
-
-        // Tables for unpacking
-        buildUnpack(upkStruct.hdrUnpack, decHeadersX, keyLen_hdr);
-        buildUnpack(upkStruct.qsUnpack,  decQscoresX, keyLen_qs);
-
-        // Distribute file among threads, for reading and unpacking
-        for (t = 0; t != n_threads; ++t)
-        {
-            in.get(c);
-            if (c == (char) 253)
-            {
-                chunkSizeStr.clear();   // Chunk size
-                while (in.get(c) && c != (char) 254)    chunkSizeStr += c;
-                offset = stoull(chunkSizeStr);
-
-                upkStruct.begPos    = in.tellg();
-                upkStruct.chunkSize = offset;
-
-                arrThread[t] =
-                        thread(&EnDecrypto::unpackHLQL, this, upkStruct, t);
-
-                // Jump to the beginning of the next chunk
-                in.seekg((std::streamoff) offset, std::ios_base::cur);
-            }
-            // End of file
-            if (in.peek() == 252)    break;
-        }
-        // Join threads
-        for (t = 0; t != n_threads; ++t)
-            if (arrThread[t].joinable())    arrThread[t].join();
-
-        if (verbose)    cerr << "Unshuffling done!\n";
+        in.ignore(1);
+        while (in.get(c) && c != (char) 254)    numStr += c;
+        permWindow = stoull(numStr);    numStr.clear();
+        while (in.get(c) && c != (char) 254)    numStr += c;
+        nReads = stoull(numStr);
+        
+        perm.resize(4 * nReads);
+        in.read(&perm[0], (std::streamsize) perm.size());
     }
-    else if (headersLen > MAX_C5 && qscoresLen <= MAX_C5)
-    {
-        const string decHeaders = headers.substr(headersLen - MAX_C5);
-        // ASCII char after the last char in headers string
-        string decHeadersX = decHeaders;
-        decHeadersX += (upkStruct.XChar_hdr = (char) (decHeaders.back() + 1));
-
-        // Tables for unpacking
-        buildUnpack(upkStruct.hdrUnpack, decHeadersX, keyLen_hdr);
-        buildUnpack(upkStruct.qsUnpack,  qscores,     keyLen_qs);
-
-        // Distribute file among threads, for reading and unpacking
-        for (t = 0; t != n_threads; ++t)
-        {
-            in.get(c);
-            if (c == (char) 253)
-            {
-                chunkSizeStr.clear();   // Chunk size
-                while (in.get(c) && c != (char) 254)    chunkSizeStr += c;
-                offset = stoull(chunkSizeStr);
-
-                upkStruct.begPos       = in.tellg();
-                upkStruct.chunkSize    = offset;
-                upkStruct.unpackQSFPtr = unpackQS;
-
-                arrThread[t] =
-                        thread(&EnDecrypto::unpackHLQS, this, upkStruct, t);
-
-                // Jump to the beginning of the next chunk
-                in.seekg((std::streamoff) offset, std::ios_base::cur);
-            }
-            // End of file
-            if (in.peek() == 252)    break;
-        }
-        // Join threads
-        for (t = 0; t != n_threads; ++t)
-            if (arrThread[t].joinable())    arrThread[t].join();
 
-        if (verbose)    cerr << "Unshuffling done!\n";
-    }
+    // Show number of different chars in headers and qs -- ignore '@'=64
+    if (verbose)
+        log() << headers.length() << " different characters are in headers.\n"
+              << qscores.length() << " different characters are in quality "
+                                    "scores.\n";
+
+    if (verbose && !seqChars.empty())
+        log() << seqChars.length() << " different characters are in "
+                                     "sequences.\n";
+
+    // Tables and unpacking functions for headers, quality scores & sequences
+    setHdrUnpacker(headers, upkStruct);
+    setQSUnpacker(qscores, upkStruct);
+    if (!seqChars.empty())    setSeqUnpacker(seqChars, upkStruct);
+
+    // Distribute file among threads, for reading and unpacking
+    const bool largeHdr = headers.length() > MAX_C5;
+    const bool largeQS  = qscores.length() > MAX_C5;
+    unpackChunks(in, upkStruct,
+                 upkStruct.readLen ? &EnDecrypto::unpackFixedFQ :
+                 !largeHdr ? (!largeQS ? &EnDecrypto::unpackHSQS
+                                       : &EnDecrypto::unpackHSQL)
+                           : (!largeQS ? &EnDecrypto::unpackHLQS
+                                       : &EnDecrypto::unpackHLQL));
 
     // Close/delete decrypted file
     in.close();
-    const string decFileName = DEC_FILENAME;
+    const string decFileName = tmp(DEC_FILENAME);
     std::remove(decFileName.c_str());
+    
+    // Written in place, as 4 lines a read
+    if (inPlace)
+    {
+        countInPlace(4);
+        log() << (verbose ? "Decompression done," : "Done,") << " in "
+              << std::fixed << setprecision(4) << timer.stop() << " seconds.\n";
+        return;
+    }
 
     // Join unpacked files
-    ifstream upkdFile[n_threads];
+    StageTimer joining("join");
+    vector<ifstream> upkdFile(n_threads);
     string line;
-    for (t = n_threads; t--;)   upkdFile[t].open(UPK_FILENAME+to_string(t));
+    for (t = n_threads; t--;)
+        upkdFile[t].open(tmp(UPK_FILENAME) + to_string(t));
+    
+    // Paired-end: R1 to standard output and R2 to its own file, if asked for
+    ofstream mateFile;
+    if (paired && !pairFileName.empty())    mateFile.open(pairFileName);
+    std::ostream &mateOut = mateFile.is_open() ? (std::ostream&) mateFile
+                                               : *outStream;
+    u64 lineNo = 0;                   // Lines 4..7 of each 8 belong to R2
+    
+    // Reordered reads: original order is restored window by window
+    string read[2];                   // R1 & R2
+    vector<string> window[2];
+    u64 nRestored = 0;
+    u64 bytes = 0,  firstLine;
 
-    bool prevLineNotThrID;            // If previous line was "THRD=" or not
     while (!upkdFile[0].eof())
     {
         for (t = 0; t != n_threads; ++t)
         {
-            prevLineNotThrID = false;
-
+            firstLine = lineNo;
             while (getline(upkdFile[t], line).good() &&
                    line != THR_ID_HDR+to_string(t))
             {
-                if (prevLineNotThrID)
-                    cout << '\n';
-                cout << line;
-
-                prevLineNotThrID = true;
+                bytes += line.size() + 1;
+                const bool isMate = paired && (lineNo & 7) > 3;
+                
+                if (perm.empty())
+                    (isMate ? mateOut : *outStream) << line << '\n';
+                else
+                {
+                    read[isMate] += line;    read[isMate] += '\n';
+                    
+                    if ((lineNo & 3) == 3 && isMate == paired)  // Read is done
+                    {
+                        window[0].push_back(std::move(read[0]));
+                        window[1].push_back(std::move(read[1]));
+                        read[0].clear();    read[1].clear();
+                        
+                        if (window[0].size() ==
+                            std::min(permWindow, nReads - nRestored))
+                            restoreOrder(window, perm, nRestored, mateOut);
+                    }
+                }
+                ++lineNo;
             }
-
-            if (prevLineNotThrID)    cout << '\n';
+            if (lineNo != firstLine)    ++stats().chunks;
         }
     }
+    if (mateFile.is_open())    mateFile.close();
+    stats().bytesOut += bytes;
+    stats().records  += lineNo / 4;
+    joining.stop();
 
-    // Stop timer for decompression
-    high_resolution_clock::time_point finishTime = high_resolution_clock::now();
-    // Decompression duration in seconds
-    std::chrono::duration<double> elapsed = finishTime - startTime;
-
-    cerr << (verbose ? "Decompression done," : "Done,") << " in "
-         << std::fixed << setprecision(4) << elapsed.count() << " seconds.\n";
+    log() << (verbose ? "Decompression done," : "Done,") << " in "
+          << std::fixed << setprecision(4) << timer.stop() << " seconds.\n";
 
     // Close/delete input/output files
     string upkdFileName;
     for (t = n_threads; t--;)
     {
         upkdFile[t].close();
-        upkdFileName=UPK_FILENAME;    upkdFileName+=to_string(t);
+        upkdFileName=tmp(UPK_FILENAME);    upkdFileName+=to_string(t);
         std::remove(upkdFileName.c_str());
     }
 }
@@ -1285,37 +1686,34 @@ void EnDecrypto::decompressFQ ()
  */
 inline void EnDecrypto::unpackHSQS (const unpack_s &upkStruct, byte threadID)
 {
-    // Function pointers
     using unpackHdrFPtr =
-                   void (*) (string&, string::iterator&, const vector<string>&);
-    unpackHdrFPtr    unpackHdr = upkStruct.unpackHdrFPtr;
-    using unpackQSFPtr  =
-                   void (*) (string&, string::iterator&, const vector<string>&);
-    unpackQSFPtr     unpackQS  = upkStruct.unpackQSFPtr;
-    pos_t            begPos    = upkStruct.begPos;
-    u64              chunkSize = upkStruct.chunkSize;
-    ifstream         in(DEC_FILENAME);
-    string           decText, plusMore, chunkSizeStr;
+                   void (*) (string&, string::iterator&, const utbl_t&);
+    unpackHdrFPtr    unpackHdr = upkStruct.unpackHdrFPtr;    // Function pointer
+    ifstream         in(tmp(DEC_FILENAME));
+    string           decText, plusMore;
     string::iterator i;
-    char             c;
-    pos_t            endPos;
-    ofstream upkfile(UPK_FILENAME+to_string(threadID), std::ios_base::app);
-    string upkHdrOut, upkSeqOut, upkQsOut;
+    ofstream upkfile;                   // Chunks to join, if not in place
+    std::ostringstream upkText;         // Unpacked chunk
+    string upkHdrOut, upkSeqOut, upkQsOut, upkMateOut;
 
-    while (in.peek() != EOF)
+    decText.reserve(upkStruct.chunkBytes);    // Chunks fit, mostly
+    
+    // Chunks threadID, threadID + n_threads, ...
+    for (u64 ch = threadID; ch < pckdChunks.size(); ch += n_threads)
     {
-        in.seekg(begPos);      // Read the file from this position
+        const u64 chunkSize = pckdChunks[ch].size;
+        in.seekg(pckdChunks[ch].pos);
         // Take a chunk of decrypted file
-        decText.clear();
-        for (u64 u = chunkSize; u--;) { in.get(c);    decText += c; }
+        decText.resize(chunkSize);
+        in.read(&decText[0], (std::streamsize) chunkSize);
+        ThreadPool::count(chunkSize);
         i = decText.begin();
-        endPos = in.tellg();   // Set the end position
 
         // Unshuffle
         if (shuffled)
         {
             mutx.lock();//------------------------------------------------------
-            if (verbose && shufflingInProgress)    cerr << "Unshuffling...\n";
+            if (verbose && shufflingInProgress)    log() << "Unshuffling...\n";
 
             shufflingInProgress = false;
             mutx.unlock();//----------------------------------------------------
@@ -1323,288 +1721,1118 @@ inline void EnDecrypto::unpackHSQS (const unpack_s &upkStruct, byte threadID)
             unshufflePkd(i, chunkSize);
         }
 
-        upkfile << THR_ID_HDR + to_string(threadID) << '\n';
         do {
-            upkfile << '@';
+            upkText << '@';
 
             unpackHdr(upkHdrOut, i, upkStruct.hdrUnpack);
-            upkfile << (plusMore = upkHdrOut) << '\n';              ++i;  // Hdr
+            upkText << (plusMore = upkHdrOut) << '\n';              ++i;  // Hdr
 
-            unpackSeqFQ_3to1(upkSeqOut, i);
-            upkfile << upkSeqOut << '\n';                                 // Seq
+            unpackSeqFQ(upkSeqOut, i, upkStruct);
+            upkText << upkSeqOut << '\n';                                 // Seq
 
-            upkfile << (justPlus ? "+" : "+" + plusMore) << '\n';   ++i;  // +
+            upkText << (justPlus ? "+" : "+" + plusMore) << '\n';   ++i;  // +
 
-            unpackQS(upkQsOut, i, upkStruct.qsUnpack);
-            upkfile << upkQsOut << '\n';                                  // Qs
-        } while (++i != decText.end());        // If trouble: change "!=" to "<"
+            unpackQsFQ(upkQsOut, i, upkSeqOut.size(), upkStruct);
+            upkText << upkQsOut << '\n';                                  // Qs
+
+            if (paired)                                                   // R2
+            {
+                upkText << '@';
+                if (!unpackMateHdr(upkMateOut, i, plusMore))
+                    unpackHdr(upkMateOut, i, upkStruct.hdrUnpack);
+                upkText << upkMateOut << '\n';                       ++i; // Hdr
+
+                unpackSeqFQ(upkSeqOut, i, upkStruct);
+                upkText << upkSeqOut << '\n';                             // Seq
+
+                upkText << (justPlus ? "+" : "+" + upkMateOut) << '\n'; ++i;//+
+
+                unpackQsFQ(upkQsOut, i, upkSeqOut.size(), upkStruct);
+                upkText << upkQsOut << '\n';                              // Qs
+            }
+        } while (i != decText.end());          // If trouble: change "!=" to "<"
+        
+        writeUnpacked(upkfile, upkText, ch, threadID, 0);
+    }
+
+    upkfile.close();
+    in.close();
+}
+
+/**
+ * @brief Unpack FQ: small header, large quality score
+ *        -- '@' at the beginning of headers not packed
+ * @param upkStruct  Unpack structure
+ * @param threadID   Thread ID
+ */
+inline void EnDecrypto::unpackHSQL (const unpack_s &upkStruct, byte threadID)
+{
+    using unpackHdrFPtr =
+                   void (*) (string&, string::iterator&, const utbl_t&);
+    unpackHdrFPtr    unpackHdr = upkStruct.unpackHdrFPtr;    // Function pointer
+    ifstream         in(tmp(DEC_FILENAME));
+    string           decText, plusMore;
+    string::iterator i;
+    ofstream upkfile;                   // Chunks to join, if not in place
+    std::ostringstream upkText;         // Unpacked chunk
+    string upkHdrOut, upkSeqOut, upkQsOut, upkMateOut;
+
+    decText.reserve(upkStruct.chunkBytes);    // Chunks fit, mostly
+    
+    // Chunks threadID, threadID + n_threads, ...
+    for (u64 ch = threadID; ch < pckdChunks.size(); ch += n_threads)
+    {
+        const u64 chunkSize = pckdChunks[ch].size;
+        in.seekg(pckdChunks[ch].pos);
+        // Take a chunk of decrypted file
+        decText.resize(chunkSize);
+        in.read(&decText[0], (std::streamsize) chunkSize);
+        ThreadPool::count(chunkSize);
+        i = decText.begin();
+
+        // Unshuffle
+        if (shuffled)
+        {
+            mutx.lock();//------------------------------------------------------
+            if (verbose && shufflingInProgress)    log() << "Unshuffling...\n";
+
+            shufflingInProgress = false;
+            mutx.unlock();//----------------------------------------------------
+
+            unshufflePkd(i, chunkSize);
+        }
+
+        do {
+            upkText << '@';
+
+            unpackHdr(upkHdrOut, i, upkStruct.hdrUnpack);
+            upkText << (plusMore = upkHdrOut) << '\n';               ++i; // Hdr
+
+            unpackSeqFQ(upkSeqOut, i, upkStruct);
+            upkText << upkSeqOut << '\n';                                 // Seq
+
+            upkText << (justPlus ? "+" : "+" + plusMore) << '\n';    ++i; // +
+
+            unpackQsFQ(upkQsOut, i, upkSeqOut.size(), upkStruct);
+            upkText << upkQsOut << '\n';                                  // Qs
+
+            if (paired)                                                   // R2
+            {
+                upkText << '@';
+                if (!unpackMateHdr(upkMateOut, i, plusMore))
+                    unpackHdr(upkMateOut, i, upkStruct.hdrUnpack);
+                upkText << upkMateOut << '\n';                       ++i; // Hdr
+
+                unpackSeqFQ(upkSeqOut, i, upkStruct);
+                upkText << upkSeqOut << '\n';                             // Seq
+
+                upkText << (justPlus ? "+" : "+" + upkMateOut) << '\n'; ++i;//+
+
+                unpackQsFQ(upkQsOut, i, upkSeqOut.size(), upkStruct);
+                upkText << upkQsOut << '\n';                              // Qs
+            }
+        } while (i != decText.end());          // If trouble: change "!=" to "<"
+        
+        writeUnpacked(upkfile, upkText, ch, threadID, 0);
+    }
+
+    upkfile.close();
+    in.close();
+}
+
+/**
+ * @brief Unpack FQ: large header, small quality score
+ *        -- '@' at the beginning of headers not packed
+ * @param upkStruct  Unpack structure
+ * @param threadID   Thread ID
+ */
+inline void EnDecrypto::unpackHLQS (const unpack_s &upkStruct, byte threadID)
+{
+    ifstream         in(tmp(DEC_FILENAME));
+    string           decText, plusMore;
+    string::iterator i;
+    ofstream upkfile;                   // Chunks to join, if not in place
+    std::ostringstream upkText;         // Unpacked chunk
+    string upkHdrOut, upkSeqOut, upkQsOut, upkMateOut;
+
+    decText.reserve(upkStruct.chunkBytes);    // Chunks fit, mostly
+    
+    // Chunks threadID, threadID + n_threads, ...
+    for (u64 ch = threadID; ch < pckdChunks.size(); ch += n_threads)
+    {
+        const u64 chunkSize = pckdChunks[ch].size;
+        in.seekg(pckdChunks[ch].pos);
+        // Take a chunk of decrypted file
+        decText.resize(chunkSize);
+        in.read(&decText[0], (std::streamsize) chunkSize);
+        ThreadPool::count(chunkSize);
+        i = decText.begin();
+
+        // Unshuffle
+        if (shuffled)
+        {
+            mutx.lock();//------------------------------------------------------
+            if (verbose && shufflingInProgress)    log() << "Unshuffling...\n";
+
+            shufflingInProgress = false;
+            mutx.unlock();//----------------------------------------------------
+
+            unshufflePkd(i, chunkSize);
+        }
+
+        do {
+            upkText << '@';
+
+            unpackLarge_read2B(upkHdrOut, i,
+                               upkStruct.XChar_hdr, upkStruct.hdrUnpack);
+            upkText << (plusMore = upkHdrOut) << '\n';              ++i;  // Hdr
+
+            unpackSeqFQ(upkSeqOut, i, upkStruct);
+            upkText << upkSeqOut << '\n';                                 // Seq
+
+            upkText << (justPlus ? "+" : "+" + plusMore) << '\n';   ++i;  // +
+
+            unpackQsFQ(upkQsOut, i, upkSeqOut.size(), upkStruct);
+            upkText << upkQsOut << '\n';                                  // Qs
+
+            if (paired)                                                   // R2
+            {
+                upkText << '@';
+                if (!unpackMateHdr(upkMateOut, i, plusMore))
+                    unpackLarge_read2B(upkMateOut, i,
+                                       upkStruct.XChar_hdr,upkStruct.hdrUnpack);
+                upkText << upkMateOut << '\n';                       ++i; // Hdr
+
+                unpackSeqFQ(upkSeqOut, i, upkStruct);
+                upkText << upkSeqOut << '\n';                             // Seq
+
+                upkText << (justPlus ? "+" : "+" + upkMateOut) << '\n'; ++i;//+
+
+                unpackQsFQ(upkQsOut, i, upkSeqOut.size(), upkStruct);
+                upkText << upkQsOut << '\n';                              // Qs
+            }
+        } while (i != decText.end());          // If trouble: change "!=" to "<"
+        
+        writeUnpacked(upkfile, upkText, ch, threadID, 0);
+    }
+
+    upkfile.close();
+    in.close();
+}
+
+/**
+ * @brief Unpack FQ: large header, large quality score
+ *        -- '@' at the beginning of headers not packed
+ * @param upkStruct  Unpack structure
+ * @param threadID   Thread ID
+ */
+inline void EnDecrypto::unpackHLQL (const unpack_s &upkStruct, byte threadID)
+{
+    ifstream         in(tmp(DEC_FILENAME));
+    string           decText, plusMore;
+    string::iterator i;
+    ofstream upkfile;                   // Chunks to join, if not in place
+    std::ostringstream upkText;         // Unpacked chunk
+    string upkHdrOut, upkSeqOut, upkQsOut, upkMateOut;
+
+    decText.reserve(upkStruct.chunkBytes);    // Chunks fit, mostly
+    
+    // Chunks threadID, threadID + n_threads, ...
+    for (u64 ch = threadID; ch < pckdChunks.size(); ch += n_threads)
+    {
+        const u64 chunkSize = pckdChunks[ch].size;
+        in.seekg(pckdChunks[ch].pos);
+        // Take a chunk of decrypted file
+        decText.resize(chunkSize);
+        in.read(&decText[0], (std::streamsize) chunkSize);
+        ThreadPool::count(chunkSize);
+        i = decText.begin();
+
+        // Unshuffle
+        if (shuffled)
+        {
+            mutx.lock();//------------------------------------------------------
+            if (verbose && shufflingInProgress)    log() << "Unshuffling...\n";
+
+            shufflingInProgress = false;
+            mutx.unlock();//----------------------------------------------------
+
+            unshufflePkd(i, chunkSize);
+        }
+
+        do {
+            upkText << '@';
+
+            unpackLarge_read2B(upkHdrOut, i,
+                               upkStruct.XChar_hdr, upkStruct.hdrUnpack);
+            upkText << (plusMore = upkHdrOut) << '\n';              ++i;  // Hdr
+
+            unpackSeqFQ(upkSeqOut, i, upkStruct);
+            upkText << upkSeqOut << '\n';                                 // Seq
+
+            upkText << (justPlus ? "+" : "+" + plusMore) << '\n';   ++i;  // +
+
+            unpackQsFQ(upkQsOut, i, upkSeqOut.size(), upkStruct);
+            upkText << upkQsOut << '\n';                                  // Qs
+
+            if (paired)                                                   // R2
+            {
+                upkText << '@';
+                if (!unpackMateHdr(upkMateOut, i, plusMore))
+                    unpackLarge_read2B(upkMateOut, i,
+                                       upkStruct.XChar_hdr,upkStruct.hdrUnpack);
+                upkText << upkMateOut << '\n';                       ++i; // Hdr
+
+                unpackSeqFQ(upkSeqOut, i, upkStruct);
+                upkText << upkSeqOut << '\n';                             // Seq
+
+                upkText << (justPlus ? "+" : "+" + upkMateOut) << '\n'; ++i;//+
+
+                unpackQsFQ(upkQsOut, i, upkSeqOut.size(), upkStruct);
+                upkText << upkQsOut << '\n';                              // Qs
+            }
+        } while (i != decText.end());          // If trouble: change "!=" to "<"
+        
+        writeUnpacked(upkfile, upkText, ch, threadID, 0);
+    }
+
+    upkfile.close();
+    in.close();
+}
+
+/**
+ * @brief Unpack FQ: reads of a fixed length. Sequences and quality scores
+ *        of a chunk are in columns after headers, and the place of each one
+ *        is known by its size -- '@' at the beginning of headers not packed
+ * @param upkStruct  Unpack structure
+ * @param threadID   Thread ID
+ */
+inline void EnDecrypto::unpackFixedFQ (const unpack_s &upkStruct,
+                                       byte threadID)
+{
+    ifstream         in(tmp(DEC_FILENAME));
+    string           decText, numStr;
+    string::iterator i, seqIt, qsIt;    // Headers, sequences & q scores
+    ofstream upkfile;                   // Chunks to join, if not in place
+    std::ostringstream upkText;         // Unpacked chunk
+    string upkHdrOut, upkSeqOut, upkQsOut, upkMateOut;
+    
+    // Packed size of a sequence and a quality score
+    const u64  len = upkStruct.readLen;
+    const bool dna = upkStruct.seqUnpack.empty();
+    const u16  seqCode =
+            (!dna && upkStruct.unpackSeqFPtr == &unpack_read2B) ? 2 : 1;
+    const u16  qsCode  = (upkStruct.unpackQSFPtr == &unpack_read2B) ? 2 : 1;
+    const u64  seqSize = dna ? fixedPackedSize(len, 3, 1)
+                             : fixedPackedSize(len, upkStruct.seqUnpack.keyLen,
+                                               seqCode);
+    const u64  qsSize  =
+            fixedPackedSize(len, upkStruct.qsUnpack.keyLen, qsCode);
+    
+    const auto unpackHdr = [&] (string &out) {
+        if (upkStruct.unpackHdrFPtr)
+            upkStruct.unpackHdrFPtr(out, i, upkStruct.hdrUnpack);
+        else
+            unpackLarge_read2B(out, i, upkStruct.XChar_hdr,upkStruct.hdrUnpack);
+    };
+    const auto unpackRead = [&] (const string &hdr) {
+        if (dna)    unpackSeqFixed_3to1(upkSeqOut, seqIt, len);
+        else        unpackFixed(upkSeqOut, seqIt, len, upkStruct.seqUnpack,
+                                seqCode);
+        unpackFixed(upkQsOut, qsIt, len, upkStruct.qsUnpack, qsCode);
+        
+        upkText << '@' << hdr << '\n' << upkSeqOut << '\n'
+                << (justPlus ? "+" : "+" + hdr) << '\n' << upkQsOut << '\n';
+    };
+    
+    decText.reserve(upkStruct.chunkBytes);    // Chunks fit, mostly
+    
+    // Chunks threadID, threadID + n_threads, ...
+    for (u64 ch = threadID; ch < pckdChunks.size(); ch += n_threads)
+    {
+        const u64 chunkSize = pckdChunks[ch].size;
+        in.seekg(pckdChunks[ch].pos);
+        // Take a chunk of decrypted file
+        decText.resize(chunkSize);
+        in.read(&decText[0], (std::streamsize) chunkSize);
+        ThreadPool::count(chunkSize);
+        i = decText.begin();
+
+        // Unshuffle
+        if (shuffled)
+        {
+            mutx.lock();//------------------------------------------------------
+            if (verbose && shufflingInProgress)    log() << "Unshuffling...\n";
+
+            shufflingInProgress = false;
+            mutx.unlock();//----------------------------------------------------
+
+            unshufflePkd(i, chunkSize);
+        }
+        
+        // Number of records, then columns of headers, sequences & q scores
+        numStr.clear();
+        for (; i != decText.end() && *i != (char) 254; ++i)    numStr += *i;
+        const u64 nRecords = stoull(numStr);
+        const u64 nReads   = (paired ? 2 : 1) * nRecords;
+        if (nReads * (seqSize + qsSize) > (u64) (decText.end() - i))
+            throw CryfaError(ErrCode::BAD_ENCRYPTED, "\"" + inFileName +
+                             "\" is corrupted.");
+        ++i;
+        seqIt = decText.end() - (std::ptrdiff_t) (nReads * (seqSize + qsSize));
+        qsIt  = seqIt + (std::ptrdiff_t) (nReads * seqSize);
+
+        for (u64 r = 0; r != nRecords; ++r)
+        {
+            unpackHdr(upkHdrOut);                                   ++i;  // R1
+            unpackRead(upkHdrOut);
+
+            if (paired)                                                   // R2
+            {
+                if (!unpackMateHdr(upkMateOut, i, upkHdrOut))
+                    unpackHdr(upkMateOut);
+                ++i;
+                unpackRead(upkMateOut);
+            }
+        }
+        
+        writeUnpacked(upkfile, upkText, ch, threadID, 0);
+    }
+
+    upkfile.close();
+    in.close();
+}
+
+/**
+ * @brief Decompress SAM
+ */
+void EnDecrypto::decompressSAM ()
+{
+    // Start timer for decompression
+    StageTimer timer("decompress");
+    
+    char     c;                     // Chars in file
+    string   qnames, quals, samHdr, samHdrSize;
+    unpack_s upkStruct;             // Collection of inputs to pass to unpack...
+    
+    ifstream in(tmp(DEC_FILENAME));
+    in.ignore(1);                   // Jump over decText[0]==(char) 125
+    in.get(c);    shuffled = (c==(char) 128); // Check if file had been shuffled
+    while (in.get(c) && c != (char) 254)    qnames += c;
+    while (in.get(c) && c != (char) 254)    quals += c;
+    while (in.get(c) && c != (char) 254)    samHdrSize += c;
+    samHdr.resize(stoull(samHdrSize));
+    in.read(&samHdr[0], (std::streamsize) samHdr.size());
+    
+    // Show number of different chars in QNAMEs and QUALs
+    if (verbose)
+        log() << qnames.length() << " different characters are in read names.\n"
+              << quals.length()  << " different characters are in quality "
+                                   "scores.\n";
+    
+    // Tables and unpacking functions for QNAMEs and QUALs
+    setHdrUnpacker(qnames, upkStruct);
+    setQSUnpacker(quals, upkStruct);
+    
+    // Distribute file among threads, for reading and unpacking. Header
+    // lines go first, if output is written in place
+    unpackChunks(in, upkStruct, &EnDecrypto::unpackSAM, samHdr);
+    
+    // Close/delete decrypted file
+    in.close();
+    const string decFileName = tmp(DEC_FILENAME);
+    std::remove(decFileName.c_str());
+    
+    // Header lines, then join unpacked files, if not written in place
+    if (inPlace)    countInPlace(1);
+    else
+    {
+        *outStream << samHdr;
+        stats().bytesOut += samHdr.size();
+        joinUnpackedFiles(0);
+    }
+    
+    log() << (verbose ? "Decompression done," : "Done,") << " in "
+          << std::fixed << setprecision(4) << timer.stop() << " seconds.\n";
+}
+
+/**
+ * @brief Unpack SAM -- Columns of each chunk are described in packSAM
+ * @param upkStruct  Unpack structure
+ * @param threadID   Thread ID
+ */
+inline void EnDecrypto::unpackSAM (const unpack_s &upkStruct, byte threadID)
+{
+    // Function pointers -- Null for more than 39 different chars
+    using unpackFPtr =
+                   void (*) (string&, string::iterator&, const utbl_t&);
+    unpackFPtr       unpackHdr = upkStruct.unpackHdrFPtr;
+    unpackFPtr       unpackQS  = upkStruct.unpackQSFPtr;
+    ifstream         in(tmp(DEC_FILENAME));
+    string           decText, colSizeStr;
+    string::iterator i, qnameIt, numIt, seqIt, qualIt, restIt;
+    ofstream upkfile;                   // Chunks to join, if not in place
+    std::ostringstream upkText;         // Unpacked chunk
+    string           upkQnameOut, upkSeqOut, upkQualOut, upkCigarOut, rest;
+    vector<string>   fields;
+    u64              colSize[4], flag, pos, mapq, prevPos;
+    byte             kind, f;
+    
+    decText.reserve(upkStruct.chunkBytes);    // Chunks fit, mostly
+    
+    // Chunks threadID, threadID + n_threads, ...
+    for (u64 ch = threadID; ch < pckdChunks.size(); ch += n_threads)
+    {
+        const u64  chunkSize = pckdChunks[ch].size;
+        const bool continued = pckdChunks[ch].continued;
+        in.seekg(pckdChunks[ch].pos);
+        // Take a chunk of decrypted file
+        decText.resize(chunkSize);
+        in.read(&decText[0], (std::streamsize) chunkSize);
+        ThreadPool::count(chunkSize);
+        i = decText.begin();
+        
+        // Unshuffle
+        if (shuffled)
+        {
+            mutx.lock();//------------------------------------------------------
+            if (verbose && shufflingInProgress)    log() << "Unshuffling...\n";
+            
+            shufflingInProgress = false;
+            mutx.unlock();//----------------------------------------------------
+            
+            unshufflePkd(i, chunkSize);
+        }
+        
+        // Columns, each after its size
+        for (byte col = 0; col != 4; ++col)
+        {
+            colSizeStr.clear();
+            for (; *i != (char) 254; ++i)    colSizeStr += *i;
+            colSize[col] = stoull(colSizeStr);
+            ++i;
+        }
+        qnameIt = i;
+        numIt   = qnameIt + colSize[0];
+        seqIt   = numIt   + colSize[1];
+        qualIt  = seqIt   + colSize[2];
+        restIt  = qualIt  + colSize[3];
+        const string::iterator numEnd = seqIt;
+        prevPos = 0;
+        
+        while (numIt != numEnd)
+        {
+            kind = (byte) *numIt++;
+            
+            rest.clear();
+            for (; *restIt != (char) 254; ++restIt)    rest += *restIt;
+            ++restIt;
+            
+            // (char) 251: the last line, which has no line feed
+            if (kind == 2)
+            {
+                upkText << rest;
+                if (continued && numIt == numEnd)    upkText << (char) 251;
+                upkText << '\n';
+                continue;
+            }
+            
+            if (unpackHdr) unpackHdr(upkQnameOut, qnameIt, upkStruct.hdrUnpack);
+            else  unpackLarge_read2B(upkQnameOut, qnameIt,
+                                     upkStruct.XChar_hdr, upkStruct.hdrUnpack);
+            ++qnameIt;
+            
+            unpackSeqFQ_3to1(upkSeqOut, seqIt);                     ++seqIt;
+            
+            if (unpackQS)     unpackQS(upkQualOut, qualIt, upkStruct.qsUnpack);
+            else  unpackLarge_read2B(upkQualOut, qualIt,
+                                     upkStruct.XChar_qs, upkStruct.qsUnpack);
+            ++qualIt;
+            
+            split(fields, rest, '\t');
+            upkText << upkQnameOut;
+            
+            if (kind == 0)
+            {
+                unpackCigar(upkCigarOut, numIt);
+                flag = unpackVarint(numIt);
+                pos  = (u64) ((i64) prevPos + unzigzag(unpackVarint(numIt)));
+                mapq = unpackVarint(numIt);
+                prevPos = pos;
+                
+                upkText << '\t' << flag << '\t' << fields[0]        // RNAME
+                        << '\t' << pos  << '\t' << mapq << '\t' << upkCigarOut;
+                for (f = 1; f != 4; ++f)    upkText << '\t' << fields[f];
+            }
+            else
+            {
+                for (f = 0; f != 8; ++f)    upkText << '\t' << fields[f];
+            }
+            
+            upkText << '\t' << upkSeqOut << '\t' << upkQualOut;
+            
+            // Optional fields
+            for (u64 o = (kind == 0 ? 4 : 8); o < fields.size(); ++o)
+                upkText << '\t' << fields[o];
+            if (continued && numIt == numEnd)    upkText << (char) 251;
+            upkText << '\n';
+        }
+        
+        writeUnpacked(upkfile, upkText, ch, threadID, 0);
+    }
+    
+    upkfile.close();
+    in.close();
+}
+
+/**
+ * @brief      Table and packing function for headers, based on the
+ *             number of different chars in them
+ * @param[in]  headers   Chars of all headers
+ * @param[out] pkStruct  Pack structure
+ */
+inline void EnDecrypto::setHdrPacker (const string &headers, pack_s &pkStruct)
+{
+    const size_t headersLen = headers.length();
+    
+    // Function pointer
+    using packHdrPointer = void (*) (string&, const string&, const ptbl_t&);
+    packHdrPointer packHdr;
+    
+    if (headersLen > MAX_C5)          // If len > 39 keep the last 39, frequent
+    {
+        Hdrs = headers.substr(headersLen - MAX_C5);
+        // ASCII char after the last char in Hdrs -- Always <= (char) 127
+        HdrsX = Hdrs;    HdrsX += (char) (Hdrs.back() + 1);
+        buildPack(HdrMap, HdrsX, KEYLEN_C5);    packHdr = &packLarge_3to2;
+    }
+    else
+    {
+        Hdrs = headers;
+
+        if (headersLen > MAX_C4)                            // 16 <= cat 5 <= 39
+        { buildPack(HdrMap, Hdrs, KEYLEN_C5);    packHdr = &pack_3to2; }
+
+        else if (headersLen > MAX_C3)                       // 7 <= cat 4 <= 15
+        { buildPack(HdrMap, Hdrs, KEYLEN_C4);    packHdr = &pack_2to1; }
+                                                            // 4 <= cat 3 <= 6
+        else if (headersLen==MAX_C3 || headersLen==MID_C3 || headersLen==MIN_C3)
+        { buildPack(HdrMap, Hdrs, KEYLEN_C3);    packHdr = &pack_3to1; }
+
+        else if (headersLen == C2)                          // cat 2 = 3
+        { buildPack(HdrMap, Hdrs, KEYLEN_C2);    packHdr = &pack_5to1; }
+
+        else if (headersLen == C1)                          // cat 1 = 2
+        { buildPack(HdrMap, Hdrs, KEYLEN_C1);    packHdr = &pack_7to1; }
+
+        else                                                // headersLen = 1
+        { buildPack(HdrMap, Hdrs, 1);            packHdr = &pack_1to1; }
+    }
+    
+    pkStruct.packHdrFPtr = packHdr;
+}
+
+/**
+ * @brief      Table and packing function for quality scores, based on
+ *             the number of different chars in them
+ * @param[in]  qscores   Chars of all quality scores
+ * @param[out] pkStruct  Pack structure
+ */
+inline void EnDecrypto::setQSPacker (const string &qscores, pack_s &pkStruct)
+{
+    const size_t qscoresLen = qscores.length();
+    
+    // Function pointer
+    using packQSPointer  = void (*) (string&, const string&, const ptbl_t&);
+    packQSPointer  packQS;
+    
+    if (qscoresLen > MAX_C5)        // If len > 39 keep the last 39, frequent
+    {
+        QSs = qscores.substr(qscoresLen - MAX_C5);
+        // ASCII char after last char in QUALITY_SCORES
+        QSsX = QSs;     QSsX += (char) (QSs.back() + 1);
+        buildPack(QsMap, QSsX, KEYLEN_C5);      packQS = &packLarge_3to2;
+    }
+    else
+    {
+        QSs = qscores;
+
+        if (qscoresLen > MAX_C4)                            // 16 <= cat 5 <= 39
+        { buildPack(QsMap, QSs, KEYLEN_C5);    packQS = &pack_3to2; }
+
+        else if (qscoresLen > MAX_C3)                       // 7 <= cat 4 <= 15
+        { buildPack(QsMap, QSs, KEYLEN_C4);    packQS = &pack_2to1; }
+                                                            // 4 <= cat 3 <= 6
+        else if (qscoresLen==MAX_C3 || qscoresLen==MID_C3 || qscoresLen==MIN_C3)
+        { buildPack(QsMap, QSs, KEYLEN_C3);    packQS = &pack_3to1; }
+
+        else if (qscoresLen == C2)                          // cat 2 = 3
+        { buildPack(QsMap, QSs, KEYLEN_C2);    packQS = &pack_5to1; }
+
+        else if (qscoresLen == C1)                          // cat 1 = 2
+        { buildPack(QsMap, QSs, KEYLEN_C1);    packQS = &pack_7to1; }
+
+        else                                                // qscoresLen = 1
+        { buildPack(QsMap, QSs, 1);            packQS = &pack_1to1; }
+    }
+    
+    pkStruct.packQSFPtr = packQS;
+}
+
+/**
+ * @brief      Table and packing function for sequences, based on the
+ *             number of different chars in them
+ * @param[in]  seqChars  Chars of all sequences
+ * @param[out] pkStruct  Pack structure
+ */
+inline void EnDecrypto::setSeqPacker (const string &seqChars, pack_s &pkStruct)
+{
+    const size_t seqCharsLen = seqChars.length();
+    
+    // Function pointer
+    using packSeqPointer = void (*) (string&, const string&, const ptbl_t&);
+    packSeqPointer packSeq;
+    
+    if (seqCharsLen > MAX_C5)       // If len > 39 keep the last 39, frequent
+    {
+        // ASCII char after the last char in the last 39 ones
+        string seqsX = seqChars.substr(seqCharsLen - MAX_C5);
+        seqsX += (char) (seqChars.back() + 1);
+        buildPack(SeqMap, seqsX, KEYLEN_C5);    packSeq = &packLarge_3to2;
+    }
+    
+    else if (seqCharsLen > MAX_C4)                          // 16 <= cat 5 <= 39
+    { buildPack(SeqMap, seqChars, KEYLEN_C5);    packSeq = &pack_3to2; }
+    
+    else if (seqCharsLen > MAX_C3)                          // 7 <= cat 4 <= 15
+    { buildPack(SeqMap, seqChars, KEYLEN_C4);    packSeq = &pack_2to1; }
+                                                            // 4 <= cat 3 <= 6
+    else if (seqCharsLen >= MIN_C3)
+    { buildPack(SeqMap, seqChars, KEYLEN_C3);    packSeq = &pack_3to1; }
+    
+    else if (seqCharsLen == C2)                             // cat 2 = 3
+    { buildPack(SeqMap, seqChars, KEYLEN_C2);    packSeq = &pack_5to1; }
+    
+    else if (seqCharsLen == C1)                             // cat 1 = 2
+    { buildPack(SeqMap, seqChars, KEYLEN_C1);    packSeq = &pack_7to1; }
+    
+    else                                                    // seqCharsLen = 1
+    { buildPack(SeqMap, seqChars, 1);            packSeq = &pack_1to1; }
+    
+    pkStruct.packSeqFPtr = packSeq;
+}
+
+/**
+ * @brief      Table and unpacking function for headers, based on the number
+ *             of different chars in them. Function is null if they are more
+ *             than 39, which need unpackLarge_read2B
+ * @param[in]  headers    Chars of all headers
+ * @param[out] upkStruct  Unpack structure
+ */
+inline void EnDecrypto::setHdrUnpacker (const string &headers,
+                                        unpack_s &upkStruct) const
+{
+    const size_t headersLen = headers.length();
+    u16 keyLen_hdr = 0;
+    
+    if      (headersLen > MAX_C5)
+    {   upkStruct.unpackHdrFPtr = nullptr;          keyLen_hdr = KEYLEN_C5; }
+    else if (headersLen > MAX_C4)                                       // Cat 5
+    {   upkStruct.unpackHdrFPtr = &unpack_read2B;   keyLen_hdr = KEYLEN_C5; }
+    else
+    {   upkStruct.unpackHdrFPtr = &unpack_read1B;
+
+        if      (headersLen > MAX_C3)       keyLen_hdr = KEYLEN_C4;     // Cat 4
+        else if (headersLen==MAX_C3 || headersLen==MID_C3 || headersLen==MIN_C3)
+                                            keyLen_hdr = KEYLEN_C3;     // Cat 3
+        else if (headersLen == C2)          keyLen_hdr = KEYLEN_C2;     // Cat 2
+        else if (headersLen == C1)          keyLen_hdr = KEYLEN_C1;     // Cat 1
+        else                                keyLen_hdr = 1;             // = 1
+    }
+    
+    if (headersLen > MAX_C5)
+    {
+        const string decHeaders = headers.substr(headersLen - MAX_C5);
+        // ASCII char after the last char in headers string
+        string decHeadersX = decHeaders;
+        decHeadersX += (upkStruct.XChar_hdr = (char) (decHeaders.back() + 1));
+        
+        buildUnpack(upkStruct.hdrUnpack, decHeadersX, keyLen_hdr);
+    }
+    else    buildUnpack(upkStruct.hdrUnpack, headers, keyLen_hdr);
+}
+
+/**
+ * @brief      Table and unpacking function for quality scores, based on the
+ *             number of different chars in them. Function is null if they are
+ *             more than 39, which need unpackLarge_read2B
+ * @param[in]  qscores    Chars of all quality scores
+ * @param[out] upkStruct  Unpack structure
+ */
+inline void EnDecrypto::setQSUnpacker (const string &qscores,
+                                       unpack_s &upkStruct) const
+{
+    const size_t qscoresLen = qscores.length();
+    u16 keyLen_qs = 0;
+    
+    if          (qscoresLen > MAX_C5)
+    {   upkStruct.unpackQSFPtr = nullptr;           keyLen_qs = KEYLEN_C5; }
+    else if     (qscoresLen > MAX_C4)                                   // Cat 5
+    {   upkStruct.unpackQSFPtr = &unpack_read2B;    keyLen_qs = KEYLEN_C5; }
+    else
+    {   upkStruct.unpackQSFPtr = &unpack_read1B;
+
+        if      (qscoresLen > MAX_C3)       keyLen_qs = KEYLEN_C4;      // Cat 4
+        else if (qscoresLen==MAX_C3 || qscoresLen==MID_C3 || qscoresLen==MIN_C3)
+                                            keyLen_qs = KEYLEN_C3;      // Cat 3
+        else if (qscoresLen == C2)          keyLen_qs = KEYLEN_C2;      // Cat 2
+        else if (qscoresLen == C1)          keyLen_qs = KEYLEN_C1;      // Cat 1
+        else                                keyLen_qs = 1;              // = 1
+    }
+    
+    if (qscoresLen > MAX_C5)
+    {
+        const string decQscores = qscores.substr(qscoresLen - MAX_C5);
+        // ASCII char after the last char in decQscores string
+        string decQscoresX = decQscores;
+        decQscoresX += (upkStruct.XChar_qs = (char) (decQscores.back() + 1));
+        
+        buildUnpack(upkStruct.qsUnpack, decQscoresX, keyLen_qs);
+    }
+    else    buildUnpack(upkStruct.qsUnpack, qscores, keyLen_qs);
+}
+
+/**
+ * @brief      Table and unpacking function for sequences, based on the number
+ *             of different chars in them. Function is null if they are more
+ *             than 39, which need unpackLarge_read2B
+ * @param[in]  seqChars   Chars of all sequences
+ * @param[out] upkStruct  Unpack structure
+ */
+inline void EnDecrypto::setSeqUnpacker (const string &seqChars,
+                                        unpack_s &upkStruct) const
+{
+    const size_t seqCharsLen = seqChars.length();
+    u16 keyLen_seq;
+    
+    if          (seqCharsLen > MAX_C5)
+    {   upkStruct.unpackSeqFPtr = nullptr;          keyLen_seq = KEYLEN_C5; }
+    else if     (seqCharsLen > MAX_C4)                                  // Cat 5
+    {   upkStruct.unpackSeqFPtr = &unpack_read2B;   keyLen_seq = KEYLEN_C5; }
+    else
+    {   upkStruct.unpackSeqFPtr = &unpack_read1B;
+        
+        if      (seqCharsLen > MAX_C3)      keyLen_seq = KEYLEN_C4;     // Cat 4
+        else if (seqCharsLen >= MIN_C3)     keyLen_seq = KEYLEN_C3;     // Cat 3
+        else if (seqCharsLen == C2)         keyLen_seq = KEYLEN_C2;     // Cat 2
+        else if (seqCharsLen == C1)         keyLen_seq = KEYLEN_C1;     // Cat 1
+        else                                keyLen_seq = 1;             // = 1
+    }
+    
+    if (seqCharsLen > MAX_C5)
+    {
+        // ASCII char after the last char in the last 39 ones
+        string seqsX = seqChars.substr(seqCharsLen - MAX_C5);
+        seqsX += (upkStruct.XChar_seq = (char) (seqChars.back() + 1));
+        
+        buildUnpack(upkStruct.seqUnpack, seqsX, keyLen_seq);
+    }
+    else    buildUnpack(upkStruct.seqUnpack, seqChars, keyLen_seq);
+}
+
+/**
+ * @brief  Header of a packed chunk: its size, then (char) 251, if its last
+ *         line goes on in the next chunk, then (char) 248 and the size of its
+ *         input, if the decryptor may write its output in place
+ * @param  ch    Chunk
+ * @param  size  Size of packed chunk
+ * @return Header
+ */
+inline string EnDecrypto::chunkHeader (u64 ch, u64 size) const
+{
+    string header;
+    header += (char) 253;
+    header += to_string(size);
+    if (chunks[ch].tail)    header += (char) 251;
+    if (inPlace)
+    {
+        const u64 end = ch+1 != chunks.size() ? chunks[ch+1].pos
+                                              : fileSize(inFileName);
+        header += (char) 248;
+        header += to_string(end - chunks[ch].pos);
+    }
+    header += (char) 254;
+    return header;
+}
+
+/**
+ * @brief Join partially packed files, written by threads, in order of chunks.
+ *        Then, delete them
+ * @param pckdFile  Packed file
+ */
+inline void EnDecrypto::joinPackedFiles (ofstream &pckdFile) const
+{
+    StageTimer timer("merge");
+    stats().chunks += chunks.size();
+    vector<ifstream> pkFile(n_threads);
+    string   line;
+    byte     t;
+    
+    // Open input files
+    for (t = 0; t != n_threads; ++t)
+        pkFile[t].open(tmp(PK_FILENAME) + to_string(t));
+    
+    // Chunk size of input, so that decryptor can size its buffers
+    pckdFile << (char) 251 << chunkTarget << (char) 254;
+
+    bool prevLineNotThrID;                 // If previous line was "THR=" or not
+    while (!pkFile[0].eof())
+    {
+        for (t = 0; t != n_threads; ++t)
+        {
+            prevLineNotThrID = false;
 
-        // Update the chunk size and positions (beg & end)
-        for (byte t = n_threads; t--;)
-        {
-            in.seekg(endPos);
-            in.get(c);
-            if (c == (char) 253)
+            while (getline(pkFile[t], line).good() &&
+                   line != THR_ID_HDR+to_string(t))
             {
-                chunkSizeStr.clear();
-                while (in.get(c) && c != (char) 254)    chunkSizeStr += c;
+                if (prevLineNotThrID)   pckdFile << '\n';
+                pckdFile << line;
 
-                chunkSize = stoull(chunkSizeStr);
-                begPos    = in.tellg();
-                endPos    = begPos + (pos_t) chunkSize;
+                prevLineNotThrID = true;
             }
         }
     }
-
-    upkfile.close();
-    in.close();
+    pckdFile << (char) 252;
+    
+    // Close/delete input files
+    string pkFileName;
+    for (t = 0; t != n_threads; ++t)
+    {
+        pkFile[t].close();
+        pkFileName=tmp(PK_FILENAME);    pkFileName+=to_string(t);
+        std::remove(pkFileName.c_str());
+    }
 }
 
 /**
- * @brief Unpack FQ: small header, large quality score
- *        -- '@' at the beginning of headers not packed
+ * @brief Distribute chunks of decrypted file among threads, for unshuffling
+ *        and unpacking. Thread t unpacks chunks t, t + n_threads, ..., so the
+ *        number of threads needs not be that of encryption. If the sizes
+ *        of their output are recorded, and it goes to a file, threads write
+ *        it in place, with what comes before the chunks
+ * @param in         Decrypted file -- On the first chunk
  * @param upkStruct  Unpack structure
- * @param threadID   Thread ID
+ * @param unpack     Unpacking function, run by each thread
+ * @param prefix     Output before the chunks, e.g. SAM header lines
  */
-inline void EnDecrypto::unpackHSQL (const unpack_s &upkStruct, byte threadID)
+inline void EnDecrypto::unpackChunks (ifstream &in, unpack_s &upkStruct,
+                             void (EnDecrypto::*unpack)(const unpack_s&, byte),
+                             const string &prefix)
 {
-    using unpackHdrFPtr =
-                   void (*) (string&, string::iterator&, const vector<string>&);
-    unpackHdrFPtr    unpackHdr = upkStruct.unpackHdrFPtr;    // Function pointer
-    pos_t            begPos    = upkStruct.begPos;
-    u64              chunkSize = upkStruct.chunkSize;
-    ifstream         in(DEC_FILENAME);
-    string           decText, plusMore, chunkSizeStr;
-    string::iterator i;
-    char             c;
-    pos_t            endPos;
-    ofstream upkfile(UPK_FILENAME + to_string(threadID), std::ios_base::app);
-    string upkHdrOut, upkSeqOut, upkQsOut;
-
-    while (in.peek() != EOF)
+    string chunkSizeStr;            // Chunk size (string) -- For unshuffling
+    char   c;
+    u64    offset;                  // To traverse decompressed file
+    byte   t;
+    pos_t  begPos;
+    
+    // Chunk size of input -- Not in files made by older versions
+    if (in.peek() == 251)
     {
-        in.seekg(begPos);       // Read file from this position
-        // Take a chunk of decrypted file
-        decText.clear();
-        for (u64 u = chunkSize; u--;) { in.get(c);    decText += c; }
-        i = decText.begin();
-        endPos = in.tellg();    // Set the end position
-
-        // Unshuffle
-        if (shuffled)
-        {
-            mutx.lock();//------------------------------------------------------
-            if (verbose && shufflingInProgress)    cerr << "Unshuffling...\n";
-
-            shufflingInProgress = false;
-            mutx.unlock();//----------------------------------------------------
-
-            unshufflePkd(i, chunkSize);
-        }
-
-        upkfile << THR_ID_HDR + to_string(threadID) << '\n';
-        do {
-            upkfile << '@';
-
-            unpackHdr(upkHdrOut, i, upkStruct.hdrUnpack);
-            upkfile << (plusMore = upkHdrOut) << '\n';               ++i; // Hdr
-
-            unpackSeqFQ_3to1(upkSeqOut, i);
-            upkfile << upkSeqOut << '\n';                                 // Seq
-
-            upkfile << (justPlus ? "+" : "+" + plusMore) << '\n';    ++i; // +
-
-            unpackLarge_read2B(upkQsOut, i,
-                               upkStruct.XChar_qs, upkStruct.qsUnpack);
-            upkfile << upkQsOut << '\n';                                  // Qs
-        } while (++i != decText.end());        // If trouble: change "!=" to "<"
-
-        // Update the chunk size and positions (beg & end)
-        for (byte t = n_threads; t--;)
+        in.ignore(1);
+        while (in.get(c) && c != (char) 254)    chunkSizeStr += c;
+        upkStruct.chunkBytes = stoull(chunkSizeStr);
+    }
+    
+    // Fewer threads, if their chunks exceed the budget -- Tables are shared
+    if (chunkMemory)
+    {
+        const u64 perThread = UNPACK_MEMORY * upkStruct.chunkBytes;
+        n_threads = (byte) std::max((u64) 1, std::min((u64) n_threads,
+                                    chunkMemory / perThread));
+    }
+    
+    // Find all chunks, up to the end of file, (char) 252. Size of output
+    // after (char) 248 -- Not in files made by older versions
+    StageTimer timer("unpack");
+    pckdChunks.clear();
+    bool sized = true;              // If sizes of output are recorded
+    u64  outPos = prefix.size(),  outSize = 0;
+    while (in.get(c) && c == (char) 253)
+    {
+        chunkSizeStr.clear();       // Chunk size
+        while (in.get(c) && c != (char) 254)    chunkSizeStr += c;
+        offset = stoull(chunkSizeStr);
+        begPos = in.tellg();
+        
+        const size_t o = chunkSizeStr.find((char) 248);
+        if (o == string::npos)    sized = false;
+        else
         {
-            in.seekg(endPos);
-            in.get(c);
-            if (c == (char) 253)
-            {
-                chunkSizeStr.clear();
-                while (in.get(c) && c != (char) 254)    chunkSizeStr += c;
-
-                chunkSize = stoull(chunkSizeStr);
-                begPos    = in.tellg();
-                endPos    = begPos + (pos_t) chunkSize;
-            }
+            outSize = stoull(chunkSizeStr.substr(o + 1));
+            chunkSizeStr.erase(o);
         }
+        pckdChunks.push_back({begPos, offset, chunkSizeStr.back()==(char) 251,
+                              outPos, outSize, 0});
+        outPos += outSize;
+        
+        // Jump to the beginning of the next chunk
+        in.seekg((std::streamoff) offset, std::ios_base::cur);
     }
-
-    upkfile.close();
-    in.close();
+    
+    // Output in place: it is sized, and what comes before chunks written
+    inPlace = sized && !pckdChunks.empty() && !outFileName.empty();
+    std::unique_ptr<PlacedWriter> writer;
+    if (inPlace)
+    {
+        writer.reset(new PlacedWriter(outFileName, outPos));
+        writer->write(prefix.data(), prefix.size(), 0);
+        placed = writer.get();
+    }
+    misplaced = false;
+    
+    // No more threads than chunks
+    n_threads = (byte) std::max((u64) 1, std::min((u64) n_threads,
+                                                  (u64) pckdChunks.size()));
+    for (t = 0; t != n_threads; ++t)
+        threadPool().submit([=] { (this->*unpack)(upkStruct, t); });
+    threadPool().wait();
+    
+    // Output of a chunk not of its recorded size, e.g. if input had no line
+    // feed at the end: chunks are unpacked again, to be joined
+    if (misplaced)
+    {
+        writer->resize(0);
+        inPlace = false;
+        for (t = 0; t != n_threads; ++t)
+            threadPool().submit([=] { (this->*unpack)(upkStruct, t); });
+        threadPool().wait();
+    }
+    placed = nullptr;
+    timer.stop();
+    if (verbose)    threadPool().report(log());
+    
+    if (verbose)    log() << "Unshuffling done!\n";
 }
 
 /**
- * @brief Unpack FQ: large header, small quality score
- *        -- '@' at the beginning of headers not packed
- * @param upkStruct  Unpack structure
- * @param threadID   Thread ID
+ * @brief Write an unpacked chunk: in place, in the output file, if it can be.
+ *        Otherwise, into the file of its thread, to be joined
+ * @param upkfile     File of the thread -- Opened for the first chunk
+ * @param upkText     Unpacked chunk -- Emptied
+ * @param ch          Chunk
+ * @param threadID    Thread ID
+ * @param recordMark  First char of lines beginning records. 0: all lines
  */
-inline void EnDecrypto::unpackHLQS (const unpack_s &upkStruct, byte threadID)
+inline void EnDecrypto::writeUnpacked (ofstream &upkfile,
+                                       std::ostringstream &upkText, u64 ch,
+                                       byte threadID, char recordMark)
 {
-    using unpackQSFPtr =
-                   void (*) (string&, string::iterator&, const vector<string>&);
-    unpackQSFPtr     unpackQS = upkStruct.unpackQSFPtr;      // Function pointer
-    pos_t            begPos    = upkStruct.begPos;
-    u64              chunkSize = upkStruct.chunkSize;
-    ifstream         in(DEC_FILENAME);
-    string           decText, plusMore, chunkSizeStr;
-    string::iterator i;
-    char             c;
-    pos_t            endPos;
-    ofstream upkfile(UPK_FILENAME + to_string(threadID), std::ios_base::app);
-    string upkHdrOut, upkSeqOut, upkQsOut;
-
-    while (in.peek() != EOF)
+    string text = upkText.str();
+    upkText.str(string());
+    
+    if (!inPlace)
     {
-        in.seekg(begPos);       // Read file from this position
-        // Take a chunk of decrypted file
-        decText.clear();
-        for (u64 u = chunkSize; u--;) { in.get(c);    decText += c; }
-        i = decText.begin();
-        endPos = in.tellg();    // Set the end position
-
-        // Unshuffle
-        if (shuffled)
-        {
-            mutx.lock();//------------------------------------------------------
-            if (verbose && shufflingInProgress)    cerr << "Unshuffling...\n";
-
-            shufflingInProgress = false;
-            mutx.unlock();//----------------------------------------------------
-
-            unshufflePkd(i, chunkSize);
-        }
-
-        upkfile << THR_ID_HDR + to_string(threadID) << '\n';
-        do {
-            upkfile << '@';
-
-            unpackLarge_read2B(upkHdrOut, i,
-                               upkStruct.XChar_hdr, upkStruct.hdrUnpack);
-            upkfile << (plusMore = upkHdrOut) << '\n';              ++i;  // Hdr
-
-            unpackSeqFQ_3to1(upkSeqOut, i);
-            upkfile << upkSeqOut << '\n';                                 // Seq
-
-            upkfile << (justPlus ? "+" : "+" + plusMore) << '\n';   ++i;  // +
-
-            unpackQS(upkQsOut, i, upkStruct.qsUnpack);
-            upkfile << upkQsOut << '\n';                                  // Qs
-        } while (++i != decText.end());        // If trouble: change "!=" to "<"
-
-        // Update the chunk size and positions (beg & end)
-        for (byte t = n_threads; t--;)
-        {
-            in.seekg(endPos);
-            in.get(c);
-            if (c == (char) 253)
-            {
-                chunkSizeStr.clear();
-                while (in.get(c) && c != (char) 254)    chunkSizeStr += c;
-
-                chunkSize = stoull(chunkSizeStr);
-                begPos    = in.tellg();
-                endPos    = begPos + (pos_t) chunkSize;
-            }
-        }
+        if (!upkfile.is_open())
+            upkfile.open(tmp(UPK_FILENAME) + to_string(threadID),
+                         std::ios_base::app);
+        upkfile << THR_ID_HDR + to_string(threadID) << '\n' << text;
+        return;
+    }
+    
+    // Without (char) 251 and line feed, if the last line goes on in the next
+    pckdChunk_s &chunk = pckdChunks[ch];
+    if (misplaced)    return;                   // Unpacked again, anyway
+    if (chunk.continued)    text.resize(text.size() - 2);
+    if (text.size() != chunk.outSize)    { misplaced = true;    return; }
+    placed->write(text.data(), text.size(), chunk.outPos);
+    
+    for (size_t l = 0; l < text.size(); ++l)
+    {
+        if (!recordMark || text[l] == recordMark)    ++chunk.records;
+        if ((l = text.find('\n', l)) == string::npos)    break;
     }
+}
 
-    upkfile.close();
-    in.close();
+/**
+ * @brief Add the output written in place to statistics
+ * @param linesPerRecord  Lines of each record, counted by writeUnpacked()
+ */
+inline void EnDecrypto::countInPlace (u64 linesPerRecord) const
+{
+    u64 records = 0;
+    for (const pckdChunk_s &chunk : pckdChunks)    records += chunk.records;
+    
+    stats().bytesOut += pckdChunks.back().outPos + pckdChunks.back().outSize;
+    stats().records  += records / linesPerRecord;
+    stats().chunks   += pckdChunks.size();
 }
 
 /**
- * @brief Unpack FQ: large header, large quality score
- *        -- '@' at the beginning of headers not packed
- * @param upkStruct  Unpack structure
- * @param threadID   Thread ID
+ * @brief Join partially unpacked files, written by threads, in order of
+ *        chunks, into standard output. Then, delete them
+ * @param recordMark  First char of lines beginning records. 0: all lines
  */
-inline void EnDecrypto::unpackHLQL (const unpack_s &upkStruct, byte threadID)
+inline void EnDecrypto::joinUnpackedFiles (char recordMark) const
 {
-    pos_t            begPos    = upkStruct.begPos;
-    u64              chunkSize = upkStruct.chunkSize;
-    ifstream         in(DEC_FILENAME);
-    string           decText, plusMore, chunkSizeStr;
-    string::iterator i;
-    char             c;
-    pos_t            endPos;
-    ofstream upkfile(UPK_FILENAME + to_string(threadID), std::ios_base::app);
-    string upkHdrOut, upkSeqOut, upkQsOut;
+    StageTimer timer("join");
+    vector<ifstream> upkdFile(n_threads);
+    string   line;
+    byte     t;
+    u64      bytes=0, records=0, nChunks=0;
+    for (t = n_threads; t--;)
+        upkdFile[t].open(tmp(UPK_FILENAME) + to_string(t));
 
-    while (in.peek() != EOF)
+    bool prevLineNotThrID;            // If previous line was "THRD=" or not
+    bool continued;                   // If line goes on in the next chunk
+    while (!upkdFile[0].eof())
     {
-        in.seekg(begPos);       // Read file from this position
-        // Take a chunk of decrypted file
-        decText.clear();
-        for (u64 u = chunkSize; u--;) { in.get(c);    decText += c; }
-        i = decText.begin();
-        endPos = in.tellg();    // Set the end position
-
-        // Unshuffle
-        if (shuffled)
+        for (t = 0; t != n_threads; ++t)
         {
-            mutx.lock();//------------------------------------------------------
-            if (verbose && shufflingInProgress)    cerr << "Unshuffling...\n";
-
-            shufflingInProgress = false;
-            mutx.unlock();//----------------------------------------------------
-
-            unshufflePkd(i, chunkSize);
-        }
-
-        upkfile << THR_ID_HDR + to_string(threadID) << '\n';
-        do {
-            upkfile << '@';
-
-            unpackLarge_read2B(upkHdrOut, i,
-                               upkStruct.XChar_hdr, upkStruct.hdrUnpack);
-            upkfile << (plusMore = upkHdrOut) << '\n';              ++i;  // Hdr
-
-            unpackSeqFQ_3to1(upkSeqOut, i);
-            upkfile << upkSeqOut << '\n';                                 // Seq
-
-            upkfile << (justPlus ? "+" : "+" + plusMore) << '\n';   ++i;  // +
-
-            unpackLarge_read2B(upkQsOut, i,
-                               upkStruct.XChar_qs, upkStruct.qsUnpack);
-            upkfile << upkQsOut << '\n';                                  // Qs
-        } while (++i != decText.end());        // If trouble: change "!=" to "<"
+            prevLineNotThrID = false;
+            continued = false;
 
-        // Update the chunk size and positions (beg & end)
-        for (byte t = n_threads; t--;)
-        {
-            in.seekg(endPos);
-            in.get(c);
-            if (c == (char) 253)
+            while (getline(upkdFile[t], line).good() &&
+                   line != THR_ID_HDR+to_string(t))
             {
-                chunkSizeStr.clear();
-                while (in.get(c) && c != (char) 254)    chunkSizeStr += c;
-
-                chunkSize = stoull(chunkSizeStr);
-                begPos    = in.tellg();
-                endPos    = begPos + (pos_t) chunkSize;
+                if (prevLineNotThrID)
+                    *outStream << '\n';
+                if ((continued = (!line.empty() && line.back()==(char) 251)))
+                    line.pop_back();
+                *outStream << line;
+                
+                bytes += line.size() + 1;
+                if (!recordMark || (!line.empty() && line[0] == recordMark))
+                    ++records;
+                prevLineNotThrID = true;
             }
+
+            if (prevLineNotThrID && !continued)    *outStream << '\n';
+            if (prevLineNotThrID)    ++nChunks;
+            if (continued)           --bytes;
         }
     }
-
-    upkfile.close();
-    in.close();
+    stats().bytesOut += bytes;
+    stats().records  += records;
+    stats().chunks   += nChunks;
+    
+    // Close/delete input files
+    string upkdFileName;
+    for (t = n_threads; t--;)
+    {
+        upkdFile[t].close();
+        upkdFileName=tmp(UPK_FILENAME);    upkdFileName+=to_string(t);
+        std::remove(upkdFileName.c_str());
+    }
 }
 
 /**
  * @brief  Check if the third line of FASTQ file contains only +
+ * @param  fileName  FASTQ file name
  * @return True or false
  */
-inline bool EnDecrypto::hasFQjustPlus () const
+inline bool EnDecrypto::hasFQjustPlus (const string &fileName) const
 {
-    ifstream in(inFileName);
+    ifstream in(fileName);
     string   line;
     
     IGNORE_THIS_LINE(in);    // Ignore header
@@ -1626,76 +2854,202 @@ inline bool EnDecrypto::hasFQjustPlus () const
 /**
  * @brief      Gather chars of all headers & max length of DNA bases lines
  *             in FASTA, excluding '>'
- * @param[out] headers  Chars of all headers
+ * @param[out] headers   Chars of all headers
+ * @param[out] seqChars  Chars of all sequences, if not packed as DNA. Else,
+ *                       empty -- See seqAlphabet()
  */
-inline void EnDecrypto::gatherHdrBs (string &headers)
+inline void EnDecrypto::gatherHdrBs (string &headers, string &seqChars)
 {
-    u32  maxBLen=0;           // Max length of each line of bases
-    bool hChars[127];
-    std::memset(hChars+32, false, 95);
-    
-    ifstream in(inFileName);
-    string   line;
-    while (getline(in, line).good())
+    StageTimer timer("prescan");
+    u64  pos=0;               // Position in input file
+    u64  lineLen=0;           // Bytes of current line, in current chunk
+    bool lineBeg=true, inHdr=false;
+    u64  hCount[256] = {0};   // Number of each symbol in headers
+    u64  sCount[256] = {0};   // Number of each symbol in sequences
+    
+    setChunkTarget();
+    chunks.assign(1, {0, 0, 0, 0});
+    
+    // Chunks of input, cut at the first line end after the target. Sequence
+    // lines longer than that are cut, too, into pieces of the target size,
+    // so that a chromosome on one line is shared by all threads
+    ifstream in(inFileName, std::ios::binary);
+    string   buf(IO_BLOCK_SIZE, 0);
+    std::streamsize n;
+    while ((n = in.read(&buf[0], (std::streamsize) buf.size()).gcount()) > 0)
     {
-        if (line[0] == 62)    // '>' = (char) 62
-            for (const char &c : line)    hChars[c] = true;
-        else
-            if (line.size() > maxBLen)    maxBLen = (u32) line.size();
+        for (const char *p = buf.data(), *end = p + n; p != end;)
+        {
+            if (lineBeg)
+            {
+                inHdr = (*p == '>');
+                stats().records += inHdr;
+                lineBeg = false;
+            }
+            
+            const char *lf   = (const char*) std::memchr(p, '\n', end - p);
+            const char *stop = lf ? lf : end;
+            if (inHdr)
+                for (const char *c = p; c != stop; ++c)    ++hCount[(byte) *c];
+            else
+            {
+                for (const char *c = p; c != stop; ++c)    ++sCount[(byte) *c];
+                while (pos + (stop-p) - chunks.back().pos > 2*chunkTarget)
+                {
+                    const u64 cut = chunks.back().pos + chunkTarget;
+                    chunks.back().tail = cut - (pos - lineLen);
+                    chunks.push_back({cut, 0, 0, 0});
+                    lineLen = pos - cut;
+                }
+            }
+            
+            lineLen += stop - p;
+            pos     += stop - p;
+            p = stop;
+            if (lf)
+            {
+                ++p;    ++pos;
+                ++chunks.back().lines;
+                lineLen = 0;
+                lineBeg = true;
+                if (pos - chunks.back().pos >= chunkTarget)
+                    chunks.push_back({pos, 0, 0, 0});
+            }
+        }
     }
     in.close();
     
-    // Number of lines read from input file while compression
-    BlockLine = (u32) (BLOCK_SIZE / maxBLen);
-    if (!BlockLine)   BlockLine = 2;
+    // The last line, if it has no line feed, is kept as a piece
+    if (lineLen)    chunks.back().tail = lineLen;
+    if (!chunks.back().lines && !chunks.back().tail)    chunks.pop_back();
 
     // Gather the characters -- Ignore '>'=62 for headers
-    for (byte i = 32; i != 62;  ++i)    if (*(hChars+i))  headers += i;
-    for (byte i = 63; i != 127; ++i)    if (*(hChars+i))  headers += i;
+    headers  = freqAlphabet(hCount, '>');
+    seqChars = seqAlphabet(sCount);
 }
 
 /**
  * @brief      Gather chars of all headers & quality scores
- *             in FASTQ, excluding '@' in headers
- * @param[out] headers  Chars of all headers
- * @param[out] qscores  Chars of all quality scores
+ *             in FASTQ, excluding '@' in headers. In paired-end mode, both
+ *             R1 and R2 files are gathered, and they must have the same
+ *             number of records
+ * @param[out] headers   Chars of all headers
+ * @param[out] qscores   Chars of all quality scores
+ * @param[out] seqChars  Chars of all sequences, if not packed as DNA. Else,
+ *                       empty -- See seqAlphabet()
+ * @param[out] pkStruct  Length of all sequences and quality scores, if it
+ *                       is the same and they are packed to a fixed size,
+ *                       else 0, and if each quality score is as long as
+ *                       its sequence
  */
-inline void EnDecrypto::gatherHdrQs (string& headers, string& qscores)
+inline void EnDecrypto::gatherHdrQs (string& headers, string& qscores,
+                                     string& seqChars, pack_s& pkStruct)
 {
-    u32  maxHLen=0,   maxQLen=0;       // Max length of headers & quality scores
-    bool hChars[127], qChars[127];
-    std::memset(hChars+32, false, 95);
-    std::memset(qChars+32, false, 95);
-    
-    ifstream in(inFileName);
-    string line;
-    while (!in.eof())
+    StageTimer timer("prescan");
+    u64  hCount[256] = {0};            // Number of each symbol in headers
+    u64  qCount[256] = {0};            // Number of each symbol in q scores
+    u64  sCount[256] = {0};            // Number of each symbol in sequences
+    u64  nRecords[2] = {0, 0};         // Number of records in R1 & R2
+    u64  nLines=0;                     // Number of seqs & q scores
+    u64  minLen=~0ULL, maxLen=0;       // Min & max length of seqs & q scores
+    u64  seqLen=0;                     // Length of the last sequence
+    bool qsLenOfSeq=true;              // Q scores are as long as sequences
+    u64  packed=0;                     // Estimated packed size of chunk
+    u64  cut=1, cutRecord=0;           // Next chunk of R2 & its first record
+    
+    setChunkTarget();
+    chunks.assign(1, {0, 0, 0, 0});
+    
+    const string fileNames[2] = {inFileName, pairFileName};
+    for (byte f = 0; f != (paired ? 2 : 1); ++f)
     {
-        if (getline(in, line).good())
-        {
-            for (const char &c : line)    hChars[c] = true;
-            if (line.size() > maxHLen)    maxHLen = (u32) line.size();
-        }
-    
-        IGNORE_THIS_LINE(in);    // Ignore sequence
-        IGNORE_THIS_LINE(in);    // Ignore +
+        ifstream in(fileNames[f]);
+        if (!in.good())
+            throw CryfaError(ErrCode::OPEN_FAILED,
+                             "failed opening \"" + fileNames[f] + "\".");
         
-        if (getline(in, line).good())
+        string line;
+        u64    hdrLen=0;
+        if (f == 1)    cutRecord = chunks[0].lines / 4;
+        
+        while (!in.eof())
         {
-            for (const char &c : line)    qChars[c] = true;
-            if (line.size() > maxQLen)    maxQLen = (u32) line.size();
+            if (getline(in, line).good())
+            {
+                for (const char &c : line)    ++hCount[(byte) c];
+                hdrLen = line.size();
+                ++nRecords[f];
+            }
+        
+            if (getline(in, line).good())
+            {
+                for (const char &c : line)    ++sCount[(byte) c];
+                minLen = std::min(minLen, seqLen = line.size());
+                maxLen = std::max(maxLen, seqLen);
+                ++nLines;
+            }
+            
+            IGNORE_THIS_LINE(in);    // Ignore +
+            
+            if (getline(in, line).good())
+            {
+                for (const char &c : line)    ++qCount[(byte) c];
+                minLen = std::min(minLen, (u64) line.size());
+                maxLen = std::max(maxLen, (u64) line.size());
+                qsLenOfSeq &= line.size() == seqLen;
+                ++nLines;
+            }
+            
+            // Chunks of R1, cut at the first record end after the target.
+            // In paired-end mode, R2 is cut at the same records
+            if (f == 0)
+            {
+                chunks.back().lines += 4;
+                packed += (paired ? 2 : 1) * (hdrLen + 2*line.size() + 4);
+                if (packed >= chunkTarget && in.peek() != EOF)
+                {
+                    chunks.push_back({(u64) in.tellg(), 0, 0, 0});
+                    packed = 0;
+                }
+            }
+            else if (cut < chunks.size() && nRecords[1] == cutRecord &&
+                     in.good())
+            {
+                chunks[cut].matePos = (u64) in.tellg();
+                cutRecord += chunks[cut++].lines / 4;
+            }
         }
+        in.close();
     }
-    in.close();
     
-    // Number of lines read from input file while compression
-    BlockLine = (u32) (4 * (BLOCK_SIZE / (maxHLen + 2*maxQLen)));
-    if (!BlockLine)   BlockLine = 4;
+    if (paired && nRecords[0] != nRecords[1])
+    {
+        throw CryfaError(ErrCode::BAD_OPTIONS, "\"" + inFileName + "\" has " +
+                         to_string(nRecords[0]) + " records, but \"" +
+                         pairFileName + "\" has " + to_string(nRecords[1]) +
+                         ".");
+    }
+    stats().records += nRecords[0] + nRecords[1];
     
     // Gather the characters -- ignore '@'=64 for headers
-    for (byte i = 32; i != 64;  ++i)    if (*(hChars+i))  headers += i;
-    for (byte i = 65; i != 127; ++i)    if (*(hChars+i))  headers += i;
-    for (byte i = 32; i != 127; ++i)    if (*(qChars+i))  qscores += i;
+    headers  = freqAlphabet(hCount, '@');
+    qscores  = freqAlphabet(qCount);
+    seqChars = seqAlphabet(sCount);
+    
+    // Reads of one length, in all records, pack to a fixed size, if no
+    // symbol is escaped: those not A, C, G, T, N in DNA, or # > 39
+    bool escaped = qscores.length() > MAX_C5 || seqChars.length() > MAX_C5;
+    if (seqChars.empty())
+        for (u16 c = 0; c != 256; ++c)
+            if (sCount[c] && baseIndex((char) c) == 5)    escaped = true;
+    
+    const bool allLines = nLines == 2 * (nRecords[0] + nRecords[1]);
+    const bool fixedLen = minLen == maxLen && minLen != 0 && allLines;
+    pkStruct.readLen = (fixedLen && !escaped) ? minLen : 0;
+    
+    // Else, a quality score needs no (char) 254 after, if it is as long as
+    // its sequence
+    pkStruct.qsCounted = !pkStruct.readLen && qsLenOfSeq && allLines;
     
     
     /* IDEA -- Slower
@@ -1726,37 +3080,143 @@ inline void EnDecrypto::gatherHdrQs (string& headers, string& qscores)
 }
 
 /**
- * @brief  Random number engine
- * @return The classic Minimum Standard rand0
+ * @brief      Gather chars of all QNAMEs & QUALs, and header lines, in SAM
+ * @param[out] qnames  Chars of all QNAMEs
+ * @param[out] quals   Chars of all QUALs
+ * @param[out] samHdr  Header lines -- Those starting with '@'
+ */
+inline void EnDecrypto::gatherSAM (string &qnames, string &quals,
+                                   string &samHdr)
+{
+    StageTimer timer("prescan");
+    u64  nCount[256] = {0};            // Number of each symbol in QNAMEs
+    u64  qCount[256] = {0};            // Number of each symbol in QUALs
+    
+    ifstream in(inFileName);
+    string line;
+    vector<string> fields;
+    
+    // Header
+    for (samHdrLines = 0; in.peek() == '@'; ++samHdrLines)
+    {
+        getline(in, line);
+        samHdr += line;    samHdr += '\n';
+    }
+    
+    // Records -- Chunks cut at the first line end after the target. The
+    // last line, if it has no line feed, is marked as going on
+    u64 pos = samHdr.size();
+    setChunkTarget();
+    chunks.assign(1, {pos, 0, 0, 0});
+    
+    while (!getline(in, line).fail())
+    {
+        pos += line.size() + 1;
+        ++chunks.back().lines;
+        if (in.eof())    chunks.back().tail = line.size();
+        if (pos - chunks.back().pos >= chunkTarget)
+            chunks.push_back({pos, 0, 0, 0});
+        
+        split(fields, line, '\t');
+        if (fields.size() < SAM_MIN_COLS)    continue;
+        
+        for (const char &c : fields[0])     ++nCount[(byte) c];
+        for (const char &c : fields[10])    ++qCount[(byte) c];
+    }
+    in.close();
+    if (!chunks.back().lines)    chunks.pop_back();
+    for (const chunk_s &chunk : chunks)    stats().records += chunk.lines;
+    
+    // Gather the characters
+    qnames = freqAlphabet(nCount);
+    quals  = freqAlphabet(qCount);
+}
+
+/**
+ * @brief Choose the size of input chunks, each packed by one thread: the
+ *        given size, if any. Otherwise, one that fits in L2 caches, with its
+ *        packed form, yet gives MIN_CHUNKS chunks of small inputs. It depends
+ *        on the input only, so the output is the same with any number of
+ *        threads, on any machine. Then, fewer threads, if their chunks exceed
+ *        the memory budget
  */
-inline std::minstd_rand0 &EnDecrypto::randomEngine ()
+inline void EnDecrypto::setChunkTarget ()
 {
-    static std::minstd_rand0 e{};
-    return e;
+    if (chunkBytes)    chunkTarget = chunkBytes;
+    else
+    {
+        u64 inSize = fileSize(inFileName);
+        if (paired)    inSize += fileSize(pairFileName);
+        chunkTarget = std::max((u64) BLOCK_SIZE, std::min(
+                               (u64) DEFAULT_CHUNK_SIZE, inSize / MIN_CHUNKS));
+    }
+    
+    // Within the memory budget, if any
+    if (chunkMemory)
+    {
+        if (!chunkBytes)
+            chunkTarget = std::max((u64) BLOCK_SIZE,
+                                   std::min(chunkTarget,
+                                            chunkMemory / PACK_MEMORY));
+        n_threads = (byte) std::max((u64) 1, std::min((u64) n_threads,
+                                    chunkMemory / (PACK_MEMORY*chunkTarget)));
+    }
+}
+
+/**
+ * @brief Share the memory budget, if any: beyond what the program itself
+ *        needs, a quarter for I/O buffers, the rest for chunks of threads
+ * @param files  Files read or written at once, with I/O buffers
+ */
+inline void EnDecrypto::limitMemory (u64 files)
+{
+    ioLimits()  = io_limits_s();
+    chunkMemory = 0;
+    if (!maxMemory)    return;
+    
+    const u64 least = BASE_MEMORY + 2 * PACK_MEMORY*BLOCK_SIZE * n_threads;
+    if (maxMemory < least)
+        throw CryfaError(ErrCode::BAD_OPTIONS, "at least " +
+                         to_string(least / (1024*1024) + 1) + "M of memory "
+                         "is needed, with " + to_string(n_threads) +
+                         " threads.");
+    
+    const u64 budget = maxMemory - BASE_MEMORY,  io = budget / 4;
+    ioLimits().depth = std::max((u64) 1, std::min((u64) IO_DEPTH,
+                                io / (files * IO_BLOCK_SIZE)));
+    ioLimits().block = (size_t) std::max((u64) DIRECT_ALIGN,
+                                std::min((u64) IO_BLOCK_SIZE, io / files));
+    ioLimits().directBlock = (size_t) std::max((u64) DIRECT_ALIGN,
+            std::min((u64) DIRECT_BLOCK_SIZE, io/2 - io/2 % DIRECT_ALIGN));
+    chunkMemory = budget - io;
 }
 
 /**
- * @brief    Random number seed -- Emulate C srand()
- * @param s  Seed
+ * @brief  Workers: given ones, or made here with n_threads
+ * @return Thread pool
  */
-inline void EnDecrypto::my_srand (u32 s)
+inline ThreadPool &EnDecrypto::threadPool ()
 {
-    randomEngine().seed(s);
+    if (pool)    return *pool;
+    
+    if (!ownPool)    ownPool.reset(new ThreadPool(n_threads, numa));
+    return *ownPool;
 }
 
 /**
  * @brief  Random number generate -- Emulate C rand()
+ * @param  e  The classic Minimum Standard rand0, seeded by the caller
  * @return Random number
  */
-inline int EnDecrypto::my_rand ()
+inline int EnDecrypto::my_rand (std::minstd_rand0 &e)
 {
-    return (int) (randomEngine()() - randomEngine().min());
+    return (int) (e() - e.min());
 }
 
 /**
- * @brief Shuffle/unshuffle seed generator -- For each chunk
+ * @brief Shuffle/unshuffle seed generator -- Once per object, before its
+ *        chunks are (un)shuffled by the workers
  */
-//inline u64 EnDecrypto::un_shuffleSeedGen (const u32 seedInit)
 inline void EnDecrypto::un_shuffleSeedGen ()
 {
     const string pass = extractPass();
@@ -1766,19 +3226,9 @@ inline void EnDecrypto::un_shuffleSeedGen ()
     
     // Using old rand to generate the new rand seed
     u64 seed = 0;
-    
-    mutx.lock();//--------------------------------------------------------------
-//    my_srand(20543 * seedInit * (u32) passDigitsMult + 81647);
-//    for (byte i = (byte) pass.size(); i--;)
-//        seed += ((u64) pass[i] * my_rand()) + my_rand();
-
-//    my_srand(20543 * seedInit + 81647);
-//    for (byte i = (byte) pass.size(); i--;)
-//        seed += (u64) pass[i] * my_rand();
-    my_srand(20543 * (u32) passDigitsMult + 81647);
+    std::minstd_rand0 rand0(20543 * (u32) passDigitsMult + 81647);
     for (byte i = (byte) pass.size(); i--;)
-        seed += (u64) pass[i] * my_rand();
-    mutx.unlock();//------------------------------------------------------------
+        seed += (u64) pass[i] * my_rand(rand0);
     
 //    seed %= 2106945901;
  
@@ -1794,8 +3244,7 @@ inline void EnDecrypto::shufflePkd (string &str)
 {
 //    const u64 seed = un_shuffleSeedGen((u32) in.size());    // Shuffling seed
 //    std::shuffle(in.begin(), in.end(), std::mt19937(seed));
-    un_shuffleSeedGen();    // shuffling seed
-    std::shuffle(str.begin(), str.end(), std::mt19937(seed_shared));
+    shuffleStr(str, seed_shared);
 }
 
 /**
@@ -1805,21 +3254,8 @@ inline void EnDecrypto::shufflePkd (string &str)
  */
 inline void EnDecrypto::unshufflePkd (string::iterator &i, u64 size)
 {
-    string shuffledStr;     // Copy of shuffled string
-    for (u64 j = 0; j != size; ++j, ++i)    shuffledStr += *i;
-    string::iterator shIt = shuffledStr.begin();
-    i -= size;
-    
-    // Shuffle vector of positions
-    vector<u64> vPos(size);
-    std::iota(vPos.begin(), vPos.end(), 0);     // Insert 0 .. N-1
 //    const u64 seed = un_shuffleSeedGen((u32) size);
-//    std::shuffle(vPos.begin(), vPos.end(), std::mt19937(seed));
-    un_shuffleSeedGen();
-    std::shuffle(vPos.begin(), vPos.end(), std::mt19937(seed_shared));
-
-    // Insert unshuffled data
-    for (const u64& vI : vPos)  *(i + vI) = *shIt++;       // *shIt, then ++shIt
+    unshuffleStr(i, size, seed_shared);
 }
 
 /**
@@ -1833,11 +3269,11 @@ inline void EnDecrypto::buildIV (byte *iv, const string &pass)
     rng_type rng;
     
     // Using old rand to generate the new rand seed
-    my_srand((u32) 7919 * pass[2] * pass[5] + 75653);
+    std::minstd_rand0 rand0((u32) 7919 * pass[2] * pass[5] + 75653);
 //    srand((u32) 7919 * pass[2] * pass[5] + 75653);
     u64 seed = 0;
     for (byte i = (byte) pass.size(); i--;)
-        seed += ((u64) pass[i] * my_rand()) + my_rand();
+        seed += ((u64) pass[i] * my_rand(rand0)) + my_rand(rand0);
 //    seed += ((u64) pass[i] * rand()) + rand();
     seed %= 4294967295;
     
@@ -1859,11 +3295,11 @@ inline void EnDecrypto::buildKey (byte *key, const string &pwd)
     rng_type rng;
     
     // Using old rand to generate the new rand seed
-    my_srand((u32) 24593 * (pwd[0] * pwd[2]) + 49157);
+    std::minstd_rand0 rand0((u32) 24593 * (pwd[0] * pwd[2]) + 49157);
 //    srand((u32) 24593 * (pwd[0] * pwd[2]) + 49157);
     u64 seed = 0;
     for (byte i = (byte) pwd.size(); i--;)
-        seed += ((u64) pwd[i] * my_rand()) + my_rand();
+        seed += ((u64) pwd[i] * my_rand(rand0)) + my_rand(rand0);
 //    seed += ((u64) pwd[i] * rand()) + rand();
     seed %= 4294967295;
     
@@ -1880,10 +3316,10 @@ inline void EnDecrypto::buildKey (byte *key, const string &pwd)
  */
 inline void EnDecrypto::printIV (byte *iv) const
 {
-    cerr << "IV = [" << (int) iv[0];
+    log() << "IV = [" << (int) iv[0];
     for (u32 i = 1; i != AES::BLOCKSIZE; ++i)
-        cerr << " " << (int) iv[i];
-    cerr << "]\n";
+        log() << " " << (int) iv[i];
+    log() << "]\n";
 }
 
 /**
@@ -1892,18 +3328,20 @@ inline void EnDecrypto::printIV (byte *iv) const
  */
 inline void EnDecrypto::printKey (byte *key) const
 {
-    cerr << "KEY: [" << (int) key[0];
+    log() << "KEY: [" << (int) key[0];
     for (u32 i = 1; i != AES::DEFAULT_KEYLENGTH; ++i)
-        cerr << " " << (int) key[i];
-    cerr << "]\n";
+        log() << " " << (int) key[i];
+    log() << "]\n";
 }
 
 /**
- * @brief  Get password from a file
+ * @brief  Get password: given directly, or from a file
  * @return Password (string)
  */
 inline string EnDecrypto::extractPass () const
 {
+    if (!password.empty())    return password;
+    
     ifstream in(keyFileName);
     char     c;
     string   pass;
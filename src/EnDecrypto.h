@@ -10,9 +10,16 @@
 #ifndef CRYFA_ENDECRYPTO_H
 #define CRYFA_ENDECRYPTO_H
 
+#include <fstream>
+#include <sstream>
+#include <memory>
+#include <atomic>
 #include "def.h"
+#include "pool.h"
 using std::string;
 using std::vector;
+using std::ifstream;
+using std::ofstream;
 
 
 /**
@@ -21,13 +28,44 @@ using std::vector;
 struct pack_s
 {
     /**
-     * @fn    void (*packHdrFPtr) (string&, const string&, const htbl_t&)
+     * @fn    void (*packHdrFPtr) (string&, const string&, const ptbl_t&)
      * @brief Points to a header packing function
-     * @fn    void (*packQSFPtr)  (string&, const string&, const htbl_t&)
+     * @fn    void (*packQSFPtr)  (string&, const string&, const ptbl_t&)
      * @brief Points to a quality score packing function
+     * @fn    void (*packSeqFPtr) (string&, const string&, const ptbl_t&)
+     * @brief Points to a sequence packing function. Null: 3 DNA bases in 1
      */
-    void (*packHdrFPtr) (string&, const string&, const htbl_t&);
-    void (*packQSFPtr)  (string&, const string&, const htbl_t&);
+    void (*packHdrFPtr) (string&, const string&, const ptbl_t&);
+    void (*packQSFPtr)  (string&, const string&, const ptbl_t&);
+    void (*packSeqFPtr) (string&, const string&, const ptbl_t&) = nullptr;
+    u64  readLen = 0;         /**< @brief Length of all reads, if fixed. Or 0 */
+    bool qsCounted = false;   /**< @brief Q scores as long as seqs: no 254 */
+};
+
+/**
+ * @brief Chunk of input, packed by one thread -- It begins on a record, or
+ *        inside a FASTA sequence line continued from the previous chunk
+ */
+struct chunk_s
+{
+    u64 pos;                  /**< @brief Position in input file */
+    u64 matePos;              /**< @brief Position in mate (R2), if paired */
+    u64 lines;                /**< @brief Number of lines */
+    u64 tail;                 /**< @brief Piece of a line after, if continued */
+};
+
+/**
+ * @brief Chunk of decrypted file, unpacked by one thread. Chunks are found
+ *        before unpacking, so any number of threads may unpack them
+ */
+struct pckdChunk_s
+{
+    pos_t pos;                /**< @brief Position, after its size */
+    u64   size;               /**< @brief Size */
+    bool  continued;          /**< @brief Last line goes on in next chunk */
+    u64   outPos;             /**< @brief Position of its output, in place */
+    u64   outSize;            /**< @brief Size of its output, if recorded */
+    u64   records;            /**< @brief Records of its output, in place */
 };
 
 /**
@@ -36,21 +74,29 @@ struct pack_s
 struct unpack_s
 {
     /**
-     * @fn void(*unpackHdrFPtr)(string&,string::iterator&,const vector<string>&)
+     * @fn    void(*unpackHdrFPtr)(string&,string::iterator&,const utbl_t&)
      * @brief Points to a header unpacking function
-     * @fn void(*unpackQSFPtr) (string&,string::iterator&,const vector<string>&)
+     * @fn    void(*unpackQSFPtr) (string&,string::iterator&,const utbl_t&)
      * @brief Points to a quality score unpacking function
+     * @fn    void(*unpackSeqFPtr)(string&,string::iterator&,const utbl_t&)
+     * @brief Points to a sequence unpacking function
      */
     char  XChar_hdr;          /**< @brief Extra char if header's length > 39 */
     char  XChar_qs;           /**< @brief Extra char if q scores length > 39 */
-    pos_t begPos;             /**< @brief Begining position for each thread */
-    u64   chunkSize;          /**< @brief Chunk size */
-    vector<string> hdrUnpack; /**< @brief Lookup table for unpacking headers */
-    vector<string> qsUnpack;  /**< @brief Lookup table for unpacking q scores */
-    void (*unpackHdrFPtr) (string&, string::iterator&, const vector<string>&);
-    void (*unpackQSFPtr)  (string&, string::iterator&, const vector<string>&);
+    char  XChar_seq;          /**< @brief Extra char if seqs length > 39 */
+    u64   chunkBytes = 0;     /**< @brief Input chunk size, if recorded */
+    u64   readLen = 0;        /**< @brief Length of all reads, if fixed. Or 0 */
+    bool  qsCounted = false;  /**< @brief Q scores as long as seqs: no 254 */
+    utbl_t hdrUnpack;         /**< @brief Lookup table for unpacking headers */
+    utbl_t qsUnpack;          /**< @brief Lookup table for unpacking q scores */
+    utbl_t seqUnpack;         /**< @brief Table for seqs. Empty: 3 DNA in 1 */
+    void (*unpackHdrFPtr) (string&, string::iterator&, const utbl_t&);
+    void (*unpackQSFPtr)  (string&, string::iterator&, const utbl_t&);
+    void (*unpackSeqFPtr) (string&, string::iterator&, const utbl_t&);
 };
 
+class PlacedWriter;
+
 /**
  * @brief Encryption / Decryption
  */
@@ -62,12 +108,31 @@ public:
      * @brief Verbose mode     @hideinitializer
      * @var   bool disable_shuffle
      * @brief Disable shuffle  @hideinitializer
+     * @var   bool reorder
+     * @brief Reorder reads    @hideinitializer
+     * @var   bool reorder_keep
+     * @brief Reorder reads, keep permutation  @hideinitializer
+     * @var   bool numa
+     * @brief Bind own workers to cores, by NUMA node  @hideinitializer
      */
     bool   verbose = false;
     bool   disable_shuffle = false;
+    bool   reorder = false;
+    bool   reorder_keep = false;
+    bool   numa = false;
     byte   n_threads;                         /**< @brief Number of threads */
+    u64    chunkBytes = 0;        /**< @brief Input chunk size. 0: automatic */
+    u64    maxMemory = 0;         /**< @brief Memory budget. 0: no limit */
     string inFileName;                        /**< @brief Input file name */
     string keyFileName;                       /**< @brief Password file name */
+    string pairFileName;                      /**< @brief Mate (R2) file name */
+    string extractName;                       /**< @brief Member to extract */
+    string password;              /**< @brief If empty, read from key file */
+    string outFileName;           /**< @brief Encrypted output, if given */
+    std::ostream *outStream = &std::cout;     /**< @brief Output */
+    std::ostream *logStream = &std::cerr;     /**< @brief Progress */
+    ThreadPool *pool = nullptr;   /**< @brief Workers. Made here, if null */
+    string tmpPrefix;   /**< @brief Of temporary files. Empty: current dir */
     
     EnDecrypto          () = default;         // Default constructor
     void   decrypt      ();                   // Decrypt
@@ -75,6 +140,12 @@ public:
     void   decompressFA ();                   // Decompress FASTA
     void   compressFQ   ();                   // Compress FASTQ
     void   decompressFQ ();                   // Decompress FASTQ
+    void   compressSAM  ();                   // Compress SAM
+    void   decompressSAM();                   // Decompress SAM
+    void   compress     ();                   // Compress, based on type
+    void   compressArchive (const vector<string>&);  // Compress many files
+    void   decompressArchive (const string&);        // Decompress archive
+    void   decompress   ();                   // Decompress, based on type
     
 private:
     /**
@@ -86,27 +157,47 @@ private:
     bool   shufflingInProgress = true;
     bool   justPlus = true;
     bool   shuffled = true;                   /**< @hideinitializer */
-    u64    seed_shared;                       /**< @brief Shared seed */
+    bool   paired = false;                    /**< @hideinitializer */
+    bool   archiving = false;                 /**< @hideinitializer */
+    u64    seed_shared;           /**< @brief (Un)shuffle seed, of password */
     string Hdrs;                              /**< @brief Max: 39 values */
     string QSs;                               /**< @brief Max: 39 values */
     string HdrsX;                             /**< @brief Extended Hdrs */
     string QSsX;                              /**< @brief Extended QSs */
-    htbl_t HdrMap;                            /**< @brief Hdrs hash table */
-    htbl_t QsMap;                             /**< @brief QSs hash table */
-    u32    BlockLine;                         /**< @brief Max block lines */
+    ptbl_t HdrMap;                            /**< @brief Hdrs packing table */
+    ptbl_t QsMap;                             /**< @brief QSs packing table */
+    ptbl_t SeqMap;                            /**< @brief Seqs packing table */
+    vector<chunk_s> chunks;                   /**< @brief Chunks of input */
+    vector<pckdChunk_s> pckdChunks;           /**< @brief Chunks, to unpack */
+    u64    chunkTarget;                       /**< @brief Chunk size, chosen */
+    u64    chunkMemory = 0;       /**< @brief Budget of chunks. 0: no limit */
+    u64    samHdrLines = 0;                   /**< @brief SAM header lines */
+    std::unique_ptr<ThreadPool> ownPool;      /**< @brief If pool is null */
+    bool   inPlace = false;       /**< @brief Output of chunks at its place */
+    std::atomic<bool> misplaced{false};   /**< @brief An output is not of its
+                                               recorded size */
+    PlacedWriter *placed = nullptr;           /**< @brief Output, in place */
     
     inline void encrypt       ();                        // Encrypt
+    inline void decryptRange  (const byte*, const byte*, pos_t, u64, u64,
+                               bool)             const;  // Decrypt blocks
+    inline ThreadPool &threadPool ();                    // Workers
+    string tmp (const string &name) const                // Temporary file
+    { return tmpPrefix + name; }
+    std::ostream &log () const    { return *logStream; } // Progress
     inline void buildIV       (byte*, const string&);    // Build IV
     inline void buildKey      (byte*, const string&);    // Build key
     inline void printIV       (byte*)            const;  // Print IV
     inline void printKey      (byte*)            const;  // Print key
     inline string extractPass ()                 const;  // Extract password
-    inline bool hasFQjustPlus ()                 const;  // Check '+' line
-    inline void gatherHdrBs   (string &);                // Gather hdr Base - FA
-    inline void gatherHdrQs   (string&, string&);        // Gather hdrs & qss
-    inline void my_srand      (u32);                     // Random no. seed
-    inline int  my_rand       ();                        // Random no generate
-    inline std::minstd_rand0 &randomEngine ();           // Random no. engine
+    inline bool hasFQjustPlus (const string&)    const;  // Check '+' line
+    inline void gatherHdrBs   (string&, string&);        // Gather hdr Base - FA
+    inline void gatherHdrQs   (string&, string&, string&,
+                               pack_s&);                 // Gather FQ chars
+    inline void gatherSAM     (string&, string&, string&);//Gather SAM qn & qs
+    inline void setChunkTarget ();                       // Chunk size
+    inline void limitMemory   (u64);                     // Share budget
+    static inline int my_rand (std::minstd_rand0&);      // Random no generate
 //    inline u64  un_shuffleSeedGen (const u32);         // (Un)shuffle seed gen
     inline void un_shuffleSeedGen ();                    // (Un)shuffle seed gen
     inline void shufflePkd    (string&);                 // Shuffle packed
@@ -114,11 +205,44 @@ private:
     inline void packFA        (const pack_s&,   byte);   // Pack FA
     inline void unpackHS      (const unpack_s&, byte);   // Unpack H:Small -- FA
     inline void unpackHL      (const unpack_s&, byte);   // Unpack H:Large -- FA
+    inline void packSeq       (string&, const string&,
+                               const pack_s&)    const;  // Pack seq
+    inline void unpackSeqFA   (string&, string::iterator&,
+                               const unpack_s&)  const;  // Unpack seq -- FA
+    inline void unpackSeqFQ   (string&, string::iterator&,
+                               const unpack_s&)  const;  // Unpack seq -- FQ
+    inline void unpackQsFQ    (string&, string::iterator&, u64,
+                               const unpack_s&)  const;  // Unpack qs -- FQ
     inline void packFQ        (const pack_s&,   byte);   // Pack FQ
     inline void unpackHSQS    (const unpack_s&, byte);   // Unpack H:Small, Q:S
     inline void unpackHSQL    (const unpack_s&, byte);   // Unpack H:S, Q:Large
     inline void unpackHLQS    (const unpack_s&, byte);   // Unpack H:Large, Q:S
     inline void unpackHLQL    (const unpack_s&, byte);   // Unpack H:Large, Q:L
+    inline void unpackFixedFQ (const unpack_s&, byte);   // Unpack fixed reads
+    inline void packSAM       (const pack_s&,   byte);   // Pack SAM
+    inline void unpackSAM     (const unpack_s&, byte);   // Unpack SAM
+    inline void setHdrPacker  (const string&, pack_s&);  // Hdr table & packer
+    inline void setQSPacker   (const string&, pack_s&);  // QS table & packer
+    inline void setSeqPacker  (const string&, pack_s&);  // Seq table & packer
+    inline void setHdrUnpacker(const string&, unpack_s&) const;// Hdr unpacker
+    inline void setQSUnpacker (const string&, unpack_s&) const;// QS unpacker
+    inline void setSeqUnpacker(const string&, unpack_s&) const;// Seq unpacker
+    inline string chunkHeader (u64, u64)         const;  // Chunk header
+    inline void joinPackedFiles   (ofstream&)    const;  // Join packed
+    inline void unpackChunks  (ifstream&, unpack_s&,     // Chunks -> threads
+                          void (EnDecrypto::*)(const unpack_s&, byte),
+                          const string& = string());
+    inline void writeUnpacked (ofstream&, std::ostringstream&, u64, byte,
+                               char);                    // Write unpacked
+    inline void countInPlace  (u64)              const;  // Stats, in place
+    inline void joinUnpackedFiles (char)         const;  // Join unpacked
+    inline void reorderFQ     (string&);                 // Reorder reads
+    inline void restoreOrder  (vector<string> (&)[2], const string&, u64&,
+                               std::ostream&)    const;  // Restore order
+    inline void packMateHdr   (string&, const string&, const string&,
+                               const pack_s&);           // Pack R2 header
+    inline bool unpackMateHdr (string&, string::iterator&,
+                               const string&)    const;  // Unpack R2 header
 };
 
 #endif //CRYFA_ENDECRYPTO_H
\ No newline at end of file
@@ -0,0 +1,694 @@
+/**
+ * @file      aio.h
+ * @brief     Asynchronous file I/O -- io_uring, or a pread/pwrite thread
+ * @author    Morteza Hosseini  (seyedmorteza@ua.pt)
+ * @author    Diogo Pratas      (pratas@ua.pt)
+ * @author    Armando J. Pinho  (ap@ua.pt)
+ * @copyright The GNU General Public License v3.0
+ */
+
+#ifndef CRYFA_AIO_H
+#define CRYFA_AIO_H
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <queue>
+#include <vector>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <new>
+#include <fcntl.h>
+#include <unistd.h>
+#include "def.h"
+#include "cryptopp/simple.h"
+#ifdef CRYFA_IO_URING
+#pragma push_macro("BLOCK_SIZE")        // <linux/fs.h> defines it, as well
+#include <linux/io_uring.h>
+#pragma pop_macro("BLOCK_SIZE")
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+using std::vector;
+
+/** @brief Read or write request */
+struct io_req_s
+{
+    int    fd;                 /**< @brief File descriptor */
+    char  *buf;                /**< @brief Buffer */
+    size_t len;                /**< @brief Size */
+    i64    off;                /**< @brief Position in file. -1: current */
+    bool   write;              /**< @brief Write, or read */
+    u64    tag;                /**< @brief Given back on completion */
+};
+
+/**
+ * @brief Queue of requests, done in the background. With CRYFA_IO_URING,
+ *        they are given to the kernel through io_uring, so no thread is
+ *        blocked on them. Otherwise, or if the kernel refuses io_uring, one
+ *        thread does them in order, with pread/pwrite
+ */
+class IoQueue
+{
+public:
+    /**
+     * @brief Constructor
+     * @param depth  Max requests in flight
+     */
+    explicit IoQueue (unsigned depth)
+    {
+#ifdef CRYFA_IO_URING
+        uring = setupRing(depth);
+        if (uring)    return;
+#endif
+        (void) depth;
+        thr = std::thread(&IoQueue::work, this);
+    }
+
+    /**
+     * @brief Destructor -- Requests in flight must be waited for, before
+     */
+    ~IoQueue ()
+    {
+#ifdef CRYFA_IO_URING
+        if (uring)
+        {
+            munmap(sqPtr, sqSize);
+            if (cqPtr != sqPtr)    munmap(cqPtr, cqSize);
+            munmap(sqes, sqesSize);
+            close(ringFd);
+            return;
+        }
+#endif
+        {
+            std::lock_guard<std::mutex> lock(mut);
+            stop = true;
+        }
+        cond.notify_all();
+        thr.join();
+    }
+
+    IoQueue (const IoQueue&) = delete;
+    IoQueue& operator= (const IoQueue&) = delete;
+
+    /**
+     * @brief Give a request
+     * @param r  Request
+     */
+    void submit (const io_req_s &r)
+    {
+#ifdef CRYFA_IO_URING
+        if (uring)
+        {
+            const unsigned tail = *sqTail,  idx = tail & *sqMask;
+            io_uring_sqe *sqe = &sqes[idx];
+            memset(sqe, 0, sizeof(*sqe));
+            sqe->opcode    = (byte) (r.write ? IORING_OP_WRITE
+                                             : IORING_OP_READ);
+            sqe->fd        = r.fd;
+            sqe->addr      = (u64) (uintptr_t) r.buf;
+            sqe->len       = (u32) r.len;
+            sqe->off       = (u64) r.off;
+            sqe->user_data = r.tag;
+            sqArray[idx]   = idx;
+            __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+
+            if (syscall(__NR_io_uring_enter, ringFd, 1, 0, 0, nullptr, 0) < 0)
+                throw CryfaError(ErrCode::IO_FAILED, "io_uring submit failed.");
+            return;
+        }
+#endif
+        {
+            std::lock_guard<std::mutex> lock(mut);
+            reqs.push(r);
+        }
+        cond.notify_all();
+    }
+
+    /**
+     * @brief      Wait for a request to be done
+     * @param[out] tag  Its tag
+     * @param[out] res  Bytes read or written. Negative: -errno
+     */
+    void wait (u64 &tag, i64 &res)
+    {
+#ifdef CRYFA_IO_URING
+        if (uring)
+        {
+            unsigned head = *cqHead;
+            while (head == __atomic_load_n(cqTail, __ATOMIC_ACQUIRE))
+                syscall(__NR_io_uring_enter, ringFd, 0, 1,
+                        IORING_ENTER_GETEVENTS, nullptr, 0);
+
+            const io_uring_cqe &cqe = cqes[head & *cqMask];
+            tag = cqe.user_data;
+            res = cqe.res;
+            __atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE);
+            return;
+        }
+#endif
+        std::unique_lock<std::mutex> lock(mut);
+        cond.wait(lock, [this] { return !done.empty(); });
+        tag = done.front().first;
+        res = done.front().second;
+        done.pop();
+    }
+
+private:
+    std::thread             thr;                 /**< @brief Fallback thread */
+    std::mutex              mut;                 /**< @brief Guards queues */
+    std::condition_variable cond;                /**< @brief Queues changed */
+    std::queue<io_req_s>    reqs;                /**< @brief To be done */
+    std::queue<std::pair<u64, i64>> done;        /**< @brief Done */
+    bool                    stop = false;        /**< @brief Queue is closing */
+#ifdef CRYFA_IO_URING
+    bool          uring = false;                 /**< @brief io_uring is used */
+    int           ringFd = -1;                   /**< @brief Ring */
+    void         *sqPtr = nullptr, *cqPtr = nullptr;   /**< @brief Rings */
+    size_t        sqSize = 0, cqSize = 0, sqesSize = 0;/**< @brief Ring sizes */
+    unsigned     *sqTail, *sqMask, *sqArray;     /**< @brief Submission ring */
+    unsigned     *cqHead, *cqTail, *cqMask;      /**< @brief Completion ring */
+    io_uring_sqe *sqes;                          /**< @brief Submissions */
+    io_uring_cqe *cqes;                          /**< @brief Completions */
+
+    /**
+     * @brief  Set up an io_uring instance
+     * @param  depth  Number of entries
+     * @return False, if the kernel does not allow it
+     */
+    bool setupRing (unsigned depth)
+    {
+        io_uring_params p;
+        memset(&p, 0, sizeof(p));
+        ringFd = (int) syscall(__NR_io_uring_setup, depth, &p);
+        if (ringFd < 0)    return false;
+        if (!(p.features & IORING_FEAT_RW_CUR_POS))      // Before Linux 5.6
+        {
+            close(ringFd);
+            return false;
+        }
+
+        sqSize   = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        cqSize   = p.cq_off.cqes  + p.cq_entries * sizeof(io_uring_cqe);
+        sqesSize = p.sq_entries * sizeof(io_uring_sqe);
+        const bool single = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (single)    sqSize = cqSize = std::max(sqSize, cqSize);
+
+        sqPtr = mmap(nullptr, sqSize, PROT_READ|PROT_WRITE,
+                     MAP_SHARED|MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+        cqPtr = single ? sqPtr
+                       : mmap(nullptr, cqSize, PROT_READ|PROT_WRITE,
+                              MAP_SHARED|MAP_POPULATE, ringFd,
+                              IORING_OFF_CQ_RING);
+        sqes  = (io_uring_sqe*) mmap(nullptr, sqesSize, PROT_READ|PROT_WRITE,
+                                     MAP_SHARED|MAP_POPULATE, ringFd,
+                                     IORING_OFF_SQES);
+        if (sqPtr == MAP_FAILED || cqPtr == MAP_FAILED ||
+            (void*) sqes == MAP_FAILED)
+        {
+            close(ringFd);
+            return false;
+        }
+
+        byte *sq = (byte*) sqPtr,  *cq = (byte*) cqPtr;
+        sqTail  = (unsigned*) (sq + p.sq_off.tail);
+        sqMask  = (unsigned*) (sq + p.sq_off.ring_mask);
+        sqArray = (unsigned*) (sq + p.sq_off.array);
+        cqHead  = (unsigned*) (cq + p.cq_off.head);
+        cqTail  = (unsigned*) (cq + p.cq_off.tail);
+        cqMask  = (unsigned*) (cq + p.cq_off.ring_mask);
+        cqes    = (io_uring_cqe*) (cq + p.cq_off.cqes);
+        return true;
+    }
+#endif
+
+    /**
+     * @brief Do requests in order, until the queue is closed -- Fallback
+     */
+    void work ()
+    {
+        io_req_s r;
+
+        while (true)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mut);
+                cond.wait(lock, [this] { return stop || !reqs.empty(); });
+                if (reqs.empty())    return;
+                r = reqs.front();
+                reqs.pop();
+            }
+
+            ssize_t res;
+            if (r.write)
+                res = r.off < 0 ? ::write(r.fd, r.buf, r.len)
+                                : pwrite(r.fd, r.buf, r.len, (off_t) r.off);
+            else
+                res = r.off < 0 ? ::read(r.fd, r.buf, r.len)
+                                : pread(r.fd, r.buf, r.len, (off_t) r.off);
+
+            {
+                std::lock_guard<std::mutex> lock(mut);
+                done.emplace(r.tag, res < 0 ? -(i64) errno : (i64) res);
+            }
+            cond.notify_all();
+        }
+    }
+};
+
+/**
+ * @brief Sizes of I/O buffers -- Lowered, to bound memory
+ */
+struct io_limits_s
+{
+    u64    depth       = IO_DEPTH;            /**< @brief Blocks per file */
+    size_t block       = IO_BLOCK_SIZE;       /**< @brief Block */
+    size_t directBlock = DIRECT_BLOCK_SIZE;   /**< @brief Block, direct mode */
+};
+
+/**
+ * @brief  Sizes of I/O buffers, for files opened from now on by this thread
+ * @return Sizes
+ */
+inline io_limits_s &ioLimits ()
+{
+    static thread_local io_limits_s limits;
+    return limits;
+}
+
+/**
+ * @brief Read a range of a file in blocks, keeping several blocks in
+ *        flight ahead of the one being used
+ */
+class AsyncReader
+{
+public:
+    /**
+     * @brief Constructor
+     * @param fileName  File name
+     * @param begin     First byte of the range
+     * @param end       One after the last byte of the range
+     */
+    AsyncReader (const string &fileName, u64 begin, u64 end)
+            : name(fileName), queue(ioLimits().depth),
+              slots(ioLimits().depth),
+              fd(open(fileName.c_str(), O_RDONLY)), next(begin), last(end)
+    {
+        if (fd < 0)
+            throw CryfaError(ErrCode::OPEN_FAILED,
+                             "failed opening \"" + fileName + "\".");
+        for (slot_s &s : slots)    s.buf.resize(ioLimits().block);
+        for (u64 s = 0; s != slots.size(); ++s)    fill(s);
+    }
+
+    /** @brief Destructor -- Waits for the reads in flight */
+    ~AsyncReader ()
+    {
+        u64 tag;    i64 res;
+        for (; inFlight; --inFlight)    queue.wait(tag, res);
+        close(fd);
+    }
+
+    AsyncReader (const AsyncReader&) = delete;
+    AsyncReader& operator= (const AsyncReader&) = delete;
+
+    /**
+     * @brief      Take the next block. It is kept until the next call
+     * @param[out] data  Block
+     * @return     Size of block. 0 at the end of range
+     */
+    size_t read (const char *&data)
+    {
+        if (cur != (u64) -1)    fill(cur);              // Reuse previous slot
+        cur = (cur + 1) % slots.size();
+        slot_s &s = slots[cur];
+        if (!s.len)    return 0;
+
+        // Wait for it, completing others meanwhile
+        while (s.done != s.len)
+        {
+            u64 tag;    i64 res;
+            queue.wait(tag, res);
+            --inFlight;
+            slot_s &t = slots[tag];
+            if (res <= 0)
+                throw CryfaError(ErrCode::IO_FAILED,
+                                 "failed reading \"" + name + "\".");
+            t.done += (u64) res;
+            if (t.done != t.len)    submit(tag);        // Short read
+        }
+        data = s.buf.data();
+        return s.len;
+    }
+
+private:
+    /** @brief Block buffer */
+    struct slot_s
+    {
+        string buf;            /**< @brief Buffer */
+        u64    off = 0;        /**< @brief Position in file */
+        u64    len = 0;        /**< @brief Size. 0: past the end */
+        u64    done = 0;       /**< @brief Bytes read */
+    };
+
+    string         name;               /**< @brief File name */
+    IoQueue        queue;              /**< @brief Requests */
+    vector<slot_s> slots;              /**< @brief Blocks in flight */
+    int            fd;                 /**< @brief File */
+    u64            next;               /**< @brief Next block to be read */
+    u64            last;               /**< @brief End of range */
+    u64            cur = (u64) -1;     /**< @brief Slot being used */
+    u64            inFlight = 0;       /**< @brief Reads in flight */
+
+    /**
+     * @brief Read the next block into a slot
+     * @param s  Slot
+     */
+    void fill (u64 s)
+    {
+        slots[s].off  = next;
+        slots[s].len  = std::min((u64) slots[s].buf.size(), last - next);
+        slots[s].done = 0;
+        next += slots[s].len;
+        if (slots[s].len)    submit(s);
+    }
+
+    /**
+     * @brief Ask for the rest of a slot
+     * @param s  Slot
+     */
+    void submit (u64 s)
+    {
+        slot_s &t = slots[s];
+        queue.submit({fd, &t.buf[t.done], t.len - t.done,
+                      (i64) (t.off + t.done), false, s});
+        ++inFlight;
+    }
+};
+
+/**
+ * @brief Write in blocks, each one given to the kernel as it is full, while
+ *        the next one is filled. Several blocks are in flight at positions
+ *        of a seekable file; one at a time otherwise (e.g. a pipe).
+ *        In direct mode, a new file is written in large aligned blocks,
+ *        double-buffered, bypassing the page cache where the file system
+ *        allows it
+ */
+class AsyncWriter
+{
+public:
+    /**
+     * @brief Constructor -- Write into a file, from a position
+     * @param fileName  File name -- Must exist
+     * @param begin     Position
+     */
+    AsyncWriter (const string &fileName, u64 begin)
+            : name(fileName), queue(ioLimits().depth),
+              fd(open(fileName.c_str(), O_WRONLY)), own(true), pos((i64) begin)
+    {
+        if (fd < 0)
+            throw CryfaError(ErrCode::OPEN_FAILED,
+                             "failed opening \"" + fileName + "\".");
+        setUp(ioLimits().depth, ioLimits().block);
+    }
+
+    /**
+     * @brief Constructor -- Write into an open file, e.g. standard output,
+     *        from its current position
+     * @param fileDesc  File descriptor
+     */
+    explicit AsyncWriter (int fileDesc)
+            : name("standard output"), queue(ioLimits().depth),
+              fd(fileDesc), own(false), pos(lseek(fileDesc, 0, SEEK_CUR))
+    {
+        if (fcntl(fd, F_GETFL) & O_APPEND)    pos = -1;  // Positions ignored
+        setUp(ioLimits().depth, ioLimits().block);
+    }
+
+    /**
+     * @brief Constructor -- Direct mode: make a new file, or empty it
+     * @param fileName  File name
+     */
+    explicit AsyncWriter (const string &fileName)
+            : name(fileName), queue(2), fd(-1), own(true), pos(0),
+              direct(true)
+    {
+        const int flags = O_WRONLY | O_CREAT | O_TRUNC;
+#ifdef O_DIRECT
+        fd = open(fileName.c_str(), flags | O_DIRECT, 0644);
+#endif
+        if (fd < 0)                  // No O_DIRECT here, or on this system
+        {
+            fd = open(fileName.c_str(), flags, 0644);
+#ifdef F_NOCACHE
+            if (fd >= 0)    fcntl(fd, F_NOCACHE, 1);
+#endif
+        }
+        if (fd < 0)
+            throw CryfaError(ErrCode::OPEN_FAILED,
+                             "failed opening \"" + fileName + "\".");
+        setUp(2, ioLimits().directBlock);
+    }
+
+    /** @brief Destructor -- Waits for the writes in flight */
+    ~AsyncWriter ()
+    {
+        u64 tag;    i64 res;
+        for (; inFlight; --inFlight)    queue.wait(tag, res);
+        for (slot_s &s : slots)    free(s.buf);
+        if (own)    close(fd);
+    }
+
+    AsyncWriter (const AsyncWriter&) = delete;
+    AsyncWriter& operator= (const AsyncWriter&) = delete;
+
+    /**
+     * @brief Write
+     * @param data  Data
+     * @param size  Size
+     */
+    void write (const char *data, size_t size)
+    {
+        while (size)
+        {
+            slot_s &s = slots[cur];
+            const size_t n = std::min(size, blockSize - s.size);
+            memcpy(s.buf + s.size, data, n);
+            s.size += n;
+            data   += n;    size -= n;
+            if (s.size == blockSize)    flush();
+        }
+    }
+
+    /**
+     * @brief Write what is left, and wait for all writes. A file written
+     *        from its current position is left at the end of what is written.
+     *        In direct mode, the last block is padded to be aligned, then
+     *        cut off
+     */
+    void finish ()
+    {
+        slot_s &s = slots[cur];
+        const i64 end = pos + (i64) s.size;
+        if (direct && s.size % DIRECT_ALIGN)
+        {
+            const size_t pad = DIRECT_ALIGN - s.size % DIRECT_ALIGN;
+            memset(s.buf + s.size, 0, pad);
+            s.size += pad;
+        }
+        if (s.size)    flush();
+        drain(0);
+
+        if (direct && ftruncate(fd, (off_t) end))
+            throw CryfaError(ErrCode::IO_FAILED,
+                             "failed writing \"" + name + "\".");
+        if (!own && pos >= 0)    lseek(fd, (off_t) pos, SEEK_SET);
+    }
+
+private:
+    /** @brief Block buffer */
+    struct slot_s
+    {
+        char  *buf = nullptr;  /**< @brief Buffer, aligned */
+        size_t size = 0;       /**< @brief Bytes in buffer */
+        i64    off = -1;       /**< @brief Position in file. -1: current */
+        u64    done = 0;       /**< @brief Bytes written */
+        bool   busy = false;   /**< @brief In flight */
+    };
+
+    string         name;               /**< @brief File name */
+    IoQueue        queue;              /**< @brief Requests */
+    vector<slot_s> slots;              /**< @brief Blocks */
+    int            fd;                 /**< @brief File */
+    bool           own;                /**< @brief File opened here */
+    i64            pos;                /**< @brief Next position. -1: pipe */
+    bool           direct = false;     /**< @brief Direct mode */
+    size_t         blockSize;          /**< @brief Size of each block */
+    u64            cur = 0;            /**< @brief Slot being filled */
+    u64            inFlight = 0;       /**< @brief Writes in flight */
+    u64            maxInFlight;        /**< @brief Max writes in flight */
+
+    /**
+     * @brief Make the blocks
+     * @param n     Number of blocks
+     * @param size  Size of each block
+     */
+    void setUp (u64 n, size_t size)
+    {
+        blockSize   = size;
+        maxInFlight = pos < 0 ? 1 : n;
+        slots.resize(n);
+        for (slot_s &s : slots)
+            if (posix_memalign((void**) &s.buf, DIRECT_ALIGN, blockSize))
+                throw std::bad_alloc();
+    }
+
+    /**
+     * @brief Give the slot being filled, and go to the next free one
+     */
+    void flush ()
+    {
+        slot_s &s = slots[cur];
+        s.off  = pos;
+        s.done = 0;
+        s.busy = true;
+        if (pos >= 0)    pos += (i64) s.size;
+        drain(maxInFlight - 1);
+        submit(cur);
+
+        cur = (cur + 1) % slots.size();
+        while (slots[cur].busy)    complete();
+    }
+
+    /**
+     * @brief Ask for the rest of a slot
+     * @param s  Slot
+     */
+    void submit (u64 s)
+    {
+        slot_s &t = slots[s];
+        queue.submit({fd, t.buf + t.done, t.size - t.done,
+                      t.off < 0 ? -1 : t.off + (i64) t.done, true, s});
+        ++inFlight;
+    }
+
+    /**
+     * @brief Wait until at most a number of writes are in flight
+     * @param n  Number of writes
+     */
+    void drain (u64 n)
+    {
+        while (inFlight > n)    complete();
+    }
+
+    /**
+     * @brief Wait for one write. A short one is given again, for the rest
+     */
+    void complete ()
+    {
+        u64 tag;    i64 res;
+        queue.wait(tag, res);
+        --inFlight;
+
+        slot_s &t = slots[tag];
+        if (res <= 0)
+        {
+            t.busy = false;
+            throw CryfaError(ErrCode::IO_FAILED,
+                             "failed writing \"" + name + "\".");
+        }
+        t.done += (u64) res;
+        if (t.done != t.size)    { submit(tag);    return; }
+
+        t.size = 0;
+        t.busy = false;
+    }
+};
+
+/**
+ * @brief Writes into a file at given positions, from many threads at once,
+ *        e.g. each chunk of output at its place
+ */
+class PlacedWriter
+{
+public:
+    /**
+     * @brief Constructor -- Give a file its size, with its blocks allocated
+     *        at once, if the file system can
+     * @param fileName  File name -- Must exist
+     * @param size      Size
+     */
+    PlacedWriter (const string &fileName, u64 size)
+            : name(fileName), fd(open(fileName.c_str(), O_WRONLY))
+    {
+        if (fd < 0)
+            throw CryfaError(ErrCode::OPEN_FAILED,
+                             "failed opening \"" + fileName + "\".");
+        resize(size);
+#ifdef __linux__
+        if (size)    fallocate(fd, 0, 0, (off_t) size);
+#endif
+    }
+
+    /** @brief Destructor */
+    ~PlacedWriter ()    { close(fd); }
+
+    PlacedWriter (const PlacedWriter&) = delete;
+    PlacedWriter& operator= (const PlacedWriter&) = delete;
+
+    /**
+     * @brief Write
+     * @param data  Data
+     * @param size  Size
+     * @param pos   Position in file
+     */
+    void write (const char *data, size_t size, u64 pos) const
+    {
+        for (ssize_t n; size; data += n, size -= (size_t) n, pos += (u64) n)
+            if ((n = pwrite(fd, data, size, (off_t) pos)) <= 0)
+                throw CryfaError(ErrCode::IO_FAILED,
+                                 "failed writing \"" + name + "\".");
+    }
+
+    /**
+     * @brief Resize the file
+     * @param size  Size
+     */
+    void resize (u64 size) const
+    {
+        if (ftruncate(fd, (off_t) size) != 0)
+            throw CryfaError(ErrCode::IO_FAILED,
+                             "failed writing \"" + name + "\".");
+    }
+
+private:
+    string name;                      /**< @brief File name, for errors */
+    int    fd;                        /**< @brief File descriptor */
+};
+
+/**
+ * @brief Crypto++ sink, into an AsyncWriter
+ */
+class AsyncSink : public CryptoPP::Bufferless<CryptoPP::Sink>
+{
+public:
+    /**
+     * @brief Constructor
+     * @param w  Writer
+     */
+    explicit AsyncSink (AsyncWriter &w) : writer(w) {}
+
+    size_t Put2 (const byte *inString, size_t length, int, bool) override
+    {
+        writer.write((const char*) inString, length);
+        return 0;
+    }
+
+private:
+    AsyncWriter &writer;               /**< @brief Writer */
+};
+
+#endif //CRYFA_AIO_H
@@ -0,0 +1,420 @@
+/**
+ * @file      bench.cpp
+ * @brief     Micro-benchmarks of kernels -- Packing, unpacking, shuffling
+ *            and cipher, each one alone, on synthetic data
+ * @author    Morteza Hosseini  (seyedmorteza@ua.pt)
+ * @author    Diogo Pratas      (pratas@ua.pt)
+ * @author    Armando J. Pinho  (ap@ua.pt)
+ * @copyright The GNU General Public License v3.0
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <random>
+#include <stdexcept>
+#include <getopt.h>
+#include "def.h"
+#include "fcn.h"
+#include "pack.h"
+#include "cryptopp/aes.h"
+#include "cryptopp/modes.h"
+#include "cryptopp/filters.h"
+
+using std::cout;
+using std::setw;
+using std::to_string;
+using std::chrono::steady_clock;
+using CryptoPP::AES;
+using CryptoPP::CBC_Mode;
+using CryptoPP::StringSource;
+using CryptoPP::StringSink;
+using CryptoPP::StreamTransformationFilter;
+
+/** @brief Packing function of headers and quality scores */
+using packFn_t = void (*) (string&, const string&, const ptbl_t&);
+
+/**
+ * @brief Options
+ */
+struct bench_s
+{
+    u64    size     = 16*1024*1024;   /**< @brief Input size of each kernel */
+    double nDensity = 0.01;           /**< @brief Share of 'N' in bases */
+    double iupac    = 0;              /**< @brief Share of other IUPAC codes */
+    u32    alphabet = 0;              /**< @brief Header alphabet. 0: all */
+    u32    line     = 100;            /**< @brief Line length */
+    u32    repeats  = 3;              /**< @brief Runs -- The best is kept */
+    string kernel;                    /**< @brief Kernels with this in name */
+};
+
+static bench_s opts;                  /**< @brief Options */
+static u64     sink = 0;              /**< @brief Keeps results alive */
+
+/**
+ * @brief Usage guide
+ */
+inline void benchHelp ()
+{
+    cout                                                                << '\n'
+        << "Synopsis:"                                                  << '\n'
+        << "    cryfa_bench [OPTION]..."                                << '\n'
+                                                                        << '\n'
+        << "Options:"                                                   << '\n'
+        << "    -s [SIZE]     input size of each kernel, e.g. 64M"      << '\n'
+        << "    -n [SHARE]    share of 'N' in bases, e.g. 0.01"         << '\n'
+        << "    -i [SHARE]    share of other IUPAC codes in bases"      << '\n'
+        << "    -a [NUMBER]   header alphabet size, 1 to 94. By"        << '\n'
+        << "                  default, one of each packing category"    << '\n'
+        << "    -l [NUMBER]   line length"                              << '\n'
+        << "    -r [NUMBER]   runs of each kernel; the best is kept"    << '\n'
+        << "    -k [NAME]     only kernels having NAME in their name"   << '\n'
+        << "    -h            usage guide"                              << '\n'
+                                                                        << '\n';
+}
+
+/**
+ * @brief  Time a kernel, keeping the best of its runs
+ * @param  run  Kernel
+ * @return Seconds
+ */
+template <typename Run>
+inline double best (Run run)
+{
+    double secs = 1e300;
+    for (u32 r = opts.repeats; r--;)
+    {
+        const steady_clock::time_point start = steady_clock::now();
+        run();
+        const std::chrono::duration<double> t = steady_clock::now() - start;
+        secs = std::min(secs, t.count());
+    }
+    return secs;
+}
+
+/**
+ * @brief Run a kernel, if selected, and print its speed
+ * @param name   Name
+ * @param bytes  Bytes it handles, on each run
+ * @param run    Kernel
+ */
+template <typename Run>
+inline void bench (const string &name, u64 bytes, Run run)
+{
+    if (name.find(opts.kernel) == string::npos)    return;
+
+    const double secs = best(run);
+    cout << std::left << setw(32) << name << std::right << std::fixed
+         << std::setprecision(1) << setw(12) << bytes / secs / 1e6
+         << std::setprecision(2) << setw(12) << secs * 1e9 / bytes << '\n';
+}
+
+/**
+ * @brief Run a table build, if selected, and print its time
+ * @param name  Name
+ * @param run   Build
+ */
+template <typename Run>
+inline void benchBuild (const string &name, Run run)
+{
+    if (name.find(opts.kernel) == string::npos)    return;
+
+    const double secs = best(run);
+    cout << std::left << setw(32) << name << std::right << std::fixed
+         << std::setprecision(3) << setw(24) << secs * 1e6 << " us/build\n";
+}
+
+/**
+ * @brief Check that an unpacking kernel, if selected, gives back the lines
+ *        packed, so that a broken one can't post a fast time
+ * @param name    Name
+ * @param lines   Lines
+ * @param packed  Lines, packed, each one followed by (char) 254
+ * @param unpack  Unpacking of one line
+ */
+template <typename Unpack>
+inline void check (const string &name, const vector<string> &lines,
+                   string &packed, Unpack unpack)
+{
+    if (name.find(opts.kernel) == string::npos)    return;
+
+    string out;
+    u64    n = 0;
+    for (string::iterator i = packed.begin(); i != packed.end(); ++i, ++n)
+    {
+        unpack(out, i);
+        if (n == lines.size() || out != lines[n])    break;
+    }
+    if (n != lines.size())
+        throw std::runtime_error(name + " does not give back its input.");
+}
+
+/**
+ * @brief  Lines of bases -- A, C, G, T, with N and other IUPAC codes
+ * @param  rng  Random number engine
+ * @return Lines
+ */
+inline vector<string> makeBases (std::mt19937 &rng)
+{
+    const string acgt = "ACGT",  iupac = "RYKMSWBDHV";
+    std::uniform_real_distribution<double> share(0, 1);
+    vector<string> lines(opts.size / opts.line);
+
+    for (string &l : lines)
+    {
+        l.resize(opts.line);
+        for (char &c : l)
+        {
+            const double p = share(rng);
+            c = p < opts.nDensity               ? 'N'
+              : p < opts.nDensity + opts.iupac  ? iupac[rng() % iupac.size()]
+              :                                   acgt[rng() & 3];
+        }
+    }
+    return lines;
+}
+
+/**
+ * @brief  Lines of symbols of an alphabet
+ * @param  rng       Random number engine
+ * @param  alphabet  Alphabet
+ * @return Lines
+ */
+inline vector<string> makeSymbols (std::mt19937 &rng, const string &alphabet)
+{
+    vector<string> lines(opts.size / opts.line);
+    for (string &l : lines)
+    {
+        l.resize(opts.line);
+        for (char &c : l)    c = alphabet[rng() % alphabet.size()];
+    }
+    return lines;
+}
+
+/**
+ * @brief Bases: 3 to 1 byte, and back, as in FASTA and FASTQ
+ * @param rng  Random number engine
+ */
+inline void benchBases (std::mt19937 &rng)
+{
+    const vector<string> lines = makeBases(rng);
+    const u64 bytes = lines.size() * opts.line;
+    string packed, out;
+
+    const auto packAll = [&] {
+        packed.clear();
+        for (const string &l : lines) { packSeq_3to1(packed, l);
+                                        packed += (char) 254; }
+        sink += packed.size();
+    };
+    packAll();                         // Input of unpacking, in any case
+    bench("packSeq_3to1", bytes, packAll);
+
+    check("unpackSeqFA_3to1", lines, packed, unpackSeqFA_3to1);
+    bench("unpackSeqFA_3to1", bytes, [&] {
+        for (string::iterator i = packed.begin(); i != packed.end(); ++i)
+        { unpackSeqFA_3to1(out, i);    sink += out.size(); }
+    });
+
+    check("unpackSeqFQ_3to1", lines, packed, unpackSeqFQ_3to1);
+    bench("unpackSeqFQ_3to1", bytes, [&] {
+        for (string::iterator i = packed.begin(); i != packed.end(); ++i)
+        { unpackSeqFQ_3to1(out, i);    sink += out.size(); }
+    });
+}
+
+/**
+ * @brief Headers or quality scores of an alphabet: packing by its category,
+ *        and back. Tables are made as in EnDecrypto
+ * @param rng   Random number engine
+ * @param size  Size of alphabet
+ */
+inline void benchSymbols (std::mt19937 &rng, u32 size)
+{
+    string alphabet;
+    for (u32 c = 0; c != size; ++c)    alphabet += (char) ('!' + c);
+
+    const vector<string> lines = makeSymbols(rng, alphabet);
+    const u64 bytes = lines.size() * opts.line;
+    const bool large = size > MAX_C5;
+
+    // Packing function and key length, by category
+    packFn_t pack = &pack_1to1;    string pname = "pack_1to1";
+    u16 keyLen = 1;
+    if      (large)          pack = &packLarge_3to2, pname = "packLarge_3to2",
+                             keyLen = KEYLEN_C5;
+    else if (size > MAX_C4)  pack = &pack_3to2, pname = "pack_3to2",
+                             keyLen = KEYLEN_C5;
+    else if (size > MAX_C3)  pack = &pack_2to1, pname = "pack_2to1",
+                             keyLen = KEYLEN_C4;
+    else if (size >= MIN_C3) pack = &pack_3to1, pname = "pack_3to1",
+                             keyLen = KEYLEN_C3;
+    else if (size == C2)     pack = &pack_5to1, pname = "pack_5to1",
+                             keyLen = KEYLEN_C2;
+    else if (size == C1)     pack = &pack_7to1, pname = "pack_7to1",
+                             keyLen = KEYLEN_C1;
+
+    // More than 39 symbols: the last 39, and one for the rest
+    string keys = alphabet;
+    char   XChar = 0;
+    if (large)
+    {
+        keys = alphabet.substr(size - MAX_C5);
+        keys += (XChar = (char) (keys.back() + 1));
+    }
+
+    const string tag = " (" + to_string(size) + ")";
+    ptbl_t map;
+    utbl_t unpack;
+
+    // Tables and packed lines are made, whichever kernels are selected
+    buildPack(map, keys, keyLen);
+    buildUnpack(unpack, keys, keyLen);
+    benchBuild("buildPack" + tag, [&] {
+        buildPack(map, keys, keyLen);    sink += map.n; });
+    benchBuild("buildUnpack" + tag, [&] {
+        buildUnpack(unpack, keys, keyLen);    sink += unpack.syms->size(); });
+
+    string packed, out;
+    const auto packAll = [&] {
+        packed.clear();
+        for (const string &l : lines) { pack(packed, l, map);
+                                        packed += (char) 254; }
+        sink += packed.size();
+    };
+    packAll();
+    bench(pname + tag, bytes, packAll);
+
+    const string uname = large ? "unpackLarge_read2B"
+                       : size > MAX_C4 ? "unpack_read2B" : "unpack_read1B";
+    const auto unpackLine = [&] (string &o, string::iterator &i) {
+        if (large)               unpackLarge_read2B(o, i, XChar, unpack);
+        else if (size > MAX_C4)  unpack_read2B(o, i, unpack);
+        else                     unpack_read1B(o, i, unpack);
+    };
+    check(uname + tag, lines, packed, unpackLine);
+    bench(uname + tag, bytes, [&] {
+        for (string::iterator i = packed.begin(); i != packed.end(); ++i)
+        { unpackLine(out, i);    sink += out.size(); }
+    });
+}
+
+/**
+ * @brief Shuffling and unshuffling packed chunks
+ * @param rng  Random number engine
+ */
+inline void benchShuffle (std::mt19937 &rng)
+{
+    const u64 chunk = std::min(opts.size, (u64) DEFAULT_CHUNK_SIZE);
+    string data(opts.size / chunk * chunk, 0);
+    for (char &c : data)    c = (char) rng();
+
+    bench("shuffleStr", data.size(), [&] {
+        for (u64 c = 0; c != data.size(); c += chunk)
+        {
+            string part = data.substr(c, chunk);
+            shuffleStr(part, c);
+            sink += (byte) part[0];
+        }
+    });
+    bench("unshuffleStr", data.size(), [&] {
+        for (u64 c = 0; c != data.size(); c += chunk)
+            unshuffleStr(data.begin() + (std::ptrdiff_t) c, chunk, c);
+        sink += (byte) data[0];
+    });
+}
+
+/**
+ * @brief AES-CBC encryption and decryption, as of packed files
+ * @param rng  Random number engine
+ */
+inline void benchCipher (std::mt19937 &rng)
+{
+    byte key[AES::DEFAULT_KEYLENGTH], iv[AES::BLOCKSIZE];
+    for (byte &b : key)    b = (byte) rng();
+    for (byte &b : iv)     b = (byte) rng();
+
+    string plain(opts.size, 0),  cipher,  out;
+    for (char &c : plain)    c = (char) rng();
+
+    bench("CBC encrypt", plain.size(), [&] {
+        cipher.clear();
+        CBC_Mode<AES>::Encryption enc(key, sizeof(key), iv);
+        StringSource(plain, true,
+                     new StreamTransformationFilter(enc,
+                                                    new StringSink(cipher)));
+        sink += cipher.size();
+    });
+    bench("CBC decrypt", plain.size(), [&] {
+        out.clear();
+        CBC_Mode<AES>::Decryption dec(key, sizeof(key), iv);
+        StringSource(cipher, true,
+                     new StreamTransformationFilter(dec, new StringSink(out)));
+        sink += out.size();
+    });
+}
+
+/**
+ * @brief Main function
+ */
+int main (int argc, char* argv[])
+{
+    int c;
+    opterr = 0;
+
+    try
+    {
+        while ((c = getopt(argc, argv, ":hs:n:i:a:l:r:k:")) != -1)
+            switch (c)
+            {
+                case 's': opts.size     = parseSize(optarg);              break;
+                case 'n': opts.nDensity = std::stod(optarg);              break;
+                case 'i': opts.iupac    = std::stod(optarg);              break;
+                case 'a': opts.alphabet = (u32) std::stoul(optarg);       break;
+                case 'l': opts.line     = (u32) std::stoul(optarg);       break;
+                case 'r': opts.repeats  = (u32) std::stoul(optarg);       break;
+                case 'k': opts.kernel   = optarg;                         break;
+                case 'h': benchHelp();                                 return 0;
+                default:
+                    cerr << "Option '" << (char) optopt << "' is invalid.\n";
+                    return 1;
+            }
+
+        if (opts.alphabet > 94 || !opts.line || !opts.repeats ||
+            opts.size < opts.line)
+            throw CryfaError(ErrCode::BAD_OPTIONS, "invalid options.");
+    }
+    catch (std::exception const &e)
+    {
+        cerr << "Error: " << e.what() << '\n';
+        return 1;
+    }
+
+    cout << "Size " << opts.size << " B, line " << opts.line << ", N "
+         << opts.nDensity << ", IUPAC " << opts.iupac << ", best of "
+         << opts.repeats << " runs.\n\n"
+         << std::left << setw(32) << "Kernel" << std::right
+         << setw(12) << "MB/s" << setw(12) << "ns/byte" << '\n';
+
+    std::mt19937 rng(1);
+    try
+    {
+        benchBases(rng);
+
+        // One alphabet of each packing category, or the one given
+        const vector<u32> sizes = opts.alphabet
+                                  ? vector<u32>{opts.alphabet}
+                                  : vector<u32>{1,2,3,5,11,27,60};
+        for (u32 size : sizes)    benchSymbols(rng, size);
+
+        benchShuffle(rng);
+        benchCipher(rng);
+    }
+    catch (std::exception const &e)
+    {
+        cerr << "Error: " << e.what() << '\n';
+        return 1;
+    }
+
+    return sink == 0;    // Never, but results can't be dropped
+}
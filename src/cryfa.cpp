@@ -21,13 +21,17 @@
  */
 
 #include <iostream>
+#include <fstream>
 #include <getopt.h>
 //#include <chrono>       // time
 #include <iomanip>      // setw, setprecision
 #include "def.h"
 #include "EnDecrypto.h"
 #include "fcn.h"
+#include "pool.h"
+#include "stats.h"
 using std::string;
+using std::vector;
 using std::cout;
 using std::cerr;
 //using std::chrono::high_resolution_clock;
@@ -45,8 +49,10 @@ int main (int argc, char* argv[])
     cryptObj.inFileName = argv[argc-1];  // Input file name
     cryptObj.n_threads = DEFAULT_N_THR;  // Initialize number of threads
     
-    static int h_flag, a_flag, v_flag, d_flag, s_flag;
+    static int h_flag, a_flag, v_flag, d_flag, s_flag, r_flag, R_flag, N_flag;
     bool k_flag = false;
+    string chunkArg, memoryArg;          // Sizes, parsed later
+    string statsFileName;                // Statistics, if asked for
     int  c;                              // Deal with getopt_long()
     int  option_index;                   // Option index stored by getopt_long()
     opterr = 0;  // Force getopt_long() to remain silent when it finds a problem
@@ -58,15 +64,24 @@ int main (int argc, char* argv[])
         {"verbose",         no_argument, &v_flag, (int) 'v'},   // Verbose
         {"disable_shuffle", no_argument, &s_flag, (int) 's'},   // D (un)shuffle
         {"decrypt",         no_argument, &d_flag, (int) 'd'},   // Decrypt mode
+        {"reorder",         no_argument, &r_flag, (int) 'r'},   // Reorder reads
+        {"reorder_keep",    no_argument, &R_flag, (int) 'R'},   // Reorder, keep
+        {"numa",            no_argument, &N_flag, (int) 'N'},   // Pin threads
         {"key",       required_argument,       0,       'k'},   // Key file
         {"thread",    required_argument,       0,       't'},   // #threads >= 1
+        {"chunk",     required_argument,       0,       'c'},   // Chunk bytes
+        {"max-memory",required_argument,       0,       'm'},   // Budget
+        {"pair",      required_argument,       0,       'p'},   // Mate (R2)
+        {"extract",   required_argument,       0,       'x'},   // One member
+        {"output",    required_argument,       0,       'o'},   // Output file
+        {"stats",     required_argument,       0,       'S'},   // JSON report
         {0,                           0,       0,         0}
     };
 
     while (1)
     {
         option_index = 0;
-        if ((c = getopt_long(argc, argv, ":havsdk:t:",
+        if ((c = getopt_long(argc, argv, ":havsdrRNk:t:c:m:p:x:o:",
                              long_options, &option_index)) == -1)         break;
         
         switch (c)
@@ -88,61 +103,108 @@ int main (int argc, char* argv[])
             case 'v': v_flag = 1;    cryptObj.verbose = true;             break;
             case 's': s_flag = 1;    cryptObj.disable_shuffle = true;     break;
             case 'd': d_flag = 1;                                         break;
+            case 'r': r_flag = 1;                                         break;
+            case 'R': R_flag = 1;                                         break;
+            case 'N': N_flag = 1;                                         break;
             case 't': cryptObj.n_threads = (byte) stoi(string(optarg));   break;
+            case 'c': chunkArg = string(optarg);                          break;
+            case 'm': memoryArg = string(optarg);                         break;
+            case 'p': cryptObj.pairFileName = string(optarg);             break;
+            case 'x': cryptObj.extractName = string(optarg);              break;
+            case 'o': cryptObj.outFileName = string(optarg);              break;
+            case 'S': statsFileName = string(optarg);                     break;
 
             default:
                 cerr << "Option '" << (char) optopt << "' is invalid.\n"; break;
         }
     }
     
-    // Check password file
-    if (!h_flag && !a_flag)    checkPass(cryptObj.keyFileName, k_flag);
+    // Flags set by long options
+    if (v_flag)    cryptObj.verbose         = true;
+    if (s_flag)    cryptObj.disable_shuffle = true;
+    cryptObj.reorder      = (r_flag != 0);
+    cryptObj.reorder_keep = (R_flag != 0);
+    cryptObj.numa         = (N_flag != 0);
     
-    if (v_flag)
-        cerr << "Verbose mode on.\n";
-
-    if (d_flag)
-    {
-        cryptObj.decrypt();                                         // Decrypt
-
-        ifstream in(DEC_FILENAME);
-        cerr << "Decompressing...\n";
-        (in.peek() == (char) 127) ? cryptObj.decompressFA()         // FASTA
-                                  : cryptObj.decompressFQ();        // FASTQ
-        in.close();
-
-//        // Stop timer
-//        high_resolution_clock::time_point finishTime =
-//                high_resolution_clock::now();
-//        // Duration in seconds
-//        std::chrono::duration<double> elapsed = finishTime - startTime;
-//        cerr << "took " << std::fixed << setprecision(4) << elapsed.count()
-//             << " seconds.\n";
-
-        return 0;
-    }
+    // Workers, for all stages
+    ThreadPool pool(cryptObj.n_threads, cryptObj.numa);
+    cryptObj.pool = &pool;
     
-    if (!h_flag && !a_flag)
+    try
     {
-        switch (fileType(cryptObj.inFileName))
+        // Check password file
+        if (!h_flag && !a_flag)    checkPass(cryptObj.keyFileName, k_flag);
+        
+        if (!chunkArg.empty())     cryptObj.chunkBytes = parseSize(chunkArg);
+        if (!memoryArg.empty())    cryptObj.maxMemory  = parseSize(memoryArg);
+        
+        if (v_flag)
+            cerr << "Verbose mode on.\n";
+        
+        stats().mode = d_flag ? "decrypt" : "encrypt";
+        if (d_flag)
+        {
+            // Output file, instead of standard output
+            std::ofstream outFile;
+            if (!cryptObj.outFileName.empty())
+            {
+                outFile.open(cryptObj.outFileName, std::ios::binary);
+                if (!outFile.good())
+                    throw CryfaError(ErrCode::OPEN_FAILED, "failed opening \""
+                                     + cryptObj.outFileName + "\".");
+                cryptObj.outStream = &outFile;
+            }
+            
+            cryptObj.decrypt();                                     // Decrypt
+            
+            cerr << "Decompressing...\n";
+            cryptObj.decompress();
+            
+//            // Stop timer
+//            high_resolution_clock::time_point finishTime =
+//                    high_resolution_clock::now();
+//            // Duration in seconds
+//            std::chrono::duration<double> elapsed = finishTime - startTime;
+//            cerr << "took " << std::fixed << setprecision(4)
+//                 << elapsed.count() << " seconds.\n";
+        }
+        else if (!h_flag && !a_flag)
         {
-            case 'A': cerr << "Compacting...\n";  cryptObj.compressFA();  break;
-            case 'Q': cerr << "Compacting...\n";  cryptObj.compressFQ();  break;
-            case 'S': cerr << "Compacting...\n";  cerr<<"SAM";            break;
-            case 'n':
-            default:  cerr << "Error: \"" << cryptObj.inFileName << "\" is not"
-                           << " a valid FASTA or FASTQ file.\n";
-                      return 0;                                           break;
+            // Many input files: one archive
+            if (argc - optind > 1)
+            {
+                if (!cryptObj.pairFileName.empty())
+                    throw CryfaError(ErrCode::BAD_OPTIONS,
+                                     "paired-end mode needs two FASTQ files.");
+                
+                cryptObj.compressArchive(vector<string>(argv+optind,
+                                                        argv+argc));
+            }
+            else
+                cryptObj.compress();
+            
+//            // Stop timer
+//            high_resolution_clock::time_point finishTime =
+//                    high_resolution_clock::now();
+//            // Duration in seconds
+//            std::chrono::duration<double> elapsed = finishTime - startTime;
+//            cerr << "took " << std::fixed << setprecision(4)
+//                 << elapsed.count() << " seconds.\n";
         }
         
-//        // Stop timer
-//        high_resolution_clock::time_point finishTime =
-//                high_resolution_clock::now();
-//        // Duration in seconds
-//        std::chrono::duration<double> elapsed = finishTime - startTime;
-//        cerr << "took " << std::fixed << setprecision(4) << elapsed.count()
-//             << " seconds.\n";
+        // Time of stages, sizes and workers, in JSON
+        if (!statsFileName.empty() && !h_flag && !a_flag)
+            writeStats(statsFileName, pool);
     }
+    catch (CryfaError const &e)
+    {
+        cerr << "Error: " << e.what() << '\n';
+        return 1;
+    }
+    
+    if (v_flag)
+        cerr << "Peak memory: " << std::fixed << setprecision(1)
+             << peakMemory() / (1024.0*1024) << " MB.\n";
     
     return 0;
 }
\ No newline at end of file
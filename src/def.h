@@ -11,11 +11,11 @@
 #define CRYFA_DEF_H
 
 #include <iostream>
-#include <unordered_map>    // Hash table
+#include <memory>           // std::shared_ptr
 #include <random>           // std::mt19937
+#include <stdexcept>        // std::runtime_error
 using std::cout;
 using std::string;
-using std::unordered_map;
 
 
 // Version and release
@@ -30,9 +30,74 @@ typedef unsigned int                      u32;
 typedef unsigned long long                u64;
 typedef long long                         i64;
 typedef std::mt19937                      rng_type;
-typedef std::unordered_map<string, u64>   htbl_t;
 typedef std::char_traits<char>::pos_type  pos_t; /**< @brief tellg(), tellp() */
 
+/**
+ * @brief Table for packing -- Code of a tuple is its symbols' indices in the
+ *        keys, in base n. Of fixed size, so it needs no heap
+ */
+struct ptbl_t
+{
+    byte index[256];                     /**< @brief Index of each symbol */
+    u16  n = 0;                          /**< @brief Number of keys */
+    u16  keyLen = 0;                     /**< @brief Symbols of each code */
+    
+    /** @brief Code of the keyLen symbols from s */
+    template <typename Iter>
+    u16 code (Iter s) const
+    {
+        u16 c = 0;
+        for (u16 k = keyLen; k--; ++s)    c = (u16) (c*n + index[(byte) *s]);
+        return c;
+    }
+};
+
+/**
+ * @brief Table for unpacking -- Symbols of code c are at [c*keyLen]. Built
+ *        once; copies share it, read only
+ */
+struct utbl_t
+{
+    std::shared_ptr<const string> syms;  /**< @brief Symbols of all codes */
+    u16 keyLen = 0;                      /**< @brief Symbols of each code */
+    
+    /** @brief Symbols of a code */
+    const char *operator[] (u64 code) const
+    { return syms->data() + code*keyLen; }
+    
+    /** @brief If not built */
+    bool empty () const    { return !syms; }
+};
+
+
+// Errors
+/** @brief Error codes -- Returned by the library API */
+enum class ErrCode : byte
+{
+    NONE = 0,           /**< @brief No error */
+    OPEN_FAILED,        /**< @brief Failed opening a file */
+    BAD_KEY,            /**< @brief Password is missing or too short */
+    BAD_INPUT,          /**< @brief Input is not FASTA, FASTQ or SAM */
+    BAD_OPTIONS,        /**< @brief Options do not fit the input */
+    BAD_GZIP,           /**< @brief Corrupted gzip input */
+    BAD_ENCRYPTED,      /**< @brief Input is not encrypted by cryfa */
+    NOT_IN_ARCHIVE,     /**< @brief Member to extract is not in archive */
+    IO_FAILED           /**< @brief Failed reading or writing a file */
+};
+
+/**
+ * @brief Error. Thrown where it happens, and turned into a message by main,
+ *        or into an error code by the library API
+ */
+class CryfaError : public std::runtime_error
+{
+public:
+    ErrCode code;       /**< @brief Error code */
+    
+    CryfaError (ErrCode c, const string &msg) : std::runtime_error(msg), code(c)
+    {}
+};
+
 
 // Metaprograms
 /**
@@ -70,8 +135,24 @@ struct POWER<B, 0> { static const u64 val = 1; };
 #define PCKD_FILENAME  "CRYFA_PCKD" /**< @brief Packed file name -- joined */
 #define DEC_FILENAME   "CRYFA_DEC"  /**< @brief Decrypted file name */
 #define UPK_FILENAME   "CRYFA_UPK"  /**< @brief Unpacked file name */
+#define RDR_FILENAME   "CRYFA_RDR"  /**< @brief Reordered file name */
+#define GZ_FILENAME    "CRYFA_GZ"   /**< @brief Gunzipped input file name */
+#define ARC_FILENAME   "CRYFA_ARC"  /**< @brief Archive file name */
 #define DEFAULT_N_THR  1            /**< @brief Default number of threads */
 #define BLOCK_SIZE     8*1024       /**< @brief To read from input file */
+#define IO_BLOCK_SIZE  (1024*1024)  /**< @brief Block of asynchronous I/O */
+#define IO_DEPTH       4            /**< @brief Blocks in flight, per file */
+#define DIRECT_BLOCK_SIZE (8*1024*1024) /**< @brief Block of direct output */
+#define DIRECT_ALIGN   4096         /**< @brief Alignment of direct I/O */
+#define DEFAULT_CHUNK_SIZE (1024*1024) /**< @brief Input chunk, automatic */
+#define MIN_CHUNKS     64           /**< @brief Of small inputs, automatic */
+#define BASE_MEMORY    (16*1024*1024) /**< @brief Program, tables, streams */
+#define PACK_MEMORY    4            /**< @brief Memory/chunk of each thread */
+#define UNPACK_MEMORY  8            /**< @brief Memory/packed chunk, ditto */
+#define RDR_WINDOW     262144       /**< @brief Reads reordered together */
+#define MINIMIZER_K    15           /**< @brief k-mer size for reordering */
+#define SAM_MIN_COLS   11           /**< @brief Mandatory columns of SAM */
+#define CIGAR_OPS      "MIDNSHP=X"  /**< @brief CIGAR operations, by code */
 #define C1             2            /**< @brief       Cat 1  =  2 */
 #define C2             3            /**< @brief       Cat 2  =  3 */
 #define MIN_C3         4            /**< @brief  4 <= Cat 3 <=  6 */
@@ -81,7 +162,7 @@ struct POWER<B, 0> { static const u64 val = 1; };
 #define MAX_C4         15
 #define MIN_C5         16           /**< @brief 16 <= Cat 5 <= 39 */
 #define MAX_C5         39
-#define KEYLEN_C1      7     /**< @brief 7 to 1 byte. For building hash table */
+#define KEYLEN_C1      7     /**< @brief 7 to 1 byte. For building tables */
 #define KEYLEN_C2      5            /**< @brief 5 to 1 byte */
 #define KEYLEN_C3      3            /**< @brief 3 to 1 byte */
 #define KEYLEN_C4      2            /**< @brief 2 to 1 byte */
@@ -89,10 +170,11 @@ struct POWER<B, 0> { static const u64 val = 1; };
 
 
 /**
- * @brief Lookup table for unpacking -- 216 elements
+ * @brief Lookup table for unpacking -- 216 elements. Built at compile time.
+ *        Code of a tuple is its bases' indices, in base 6 -- See baseIndex()
  * @hideinitializer
  */
-const string DNA_UNPACK[] =
+constexpr char DNA_UNPACK[216][4] =
 {
     "AAA", "AAC", "AAG", "AAT", "AAN", "AAX", "ACA", "ACC", "ACG", "ACT", "ACN",
     "ACX", "AGA", "AGC", "AGG", "AGT", "AGN", "AGX", "ATA", "ATC", "ATG", "ATT",
@@ -116,58 +198,6 @@ const string DNA_UNPACK[] =
     "XNX", "XXA", "XXC", "XXG", "XXT", "XXN", "XXX"
 };
 
-/**
- * @brief Hash table for packing
- * @hideinitializer
- */
-const htbl_t DNA_MAP =
-{
-    {"AAA",   0}, {"AAC",   1}, {"AAG",   2}, {"AAT",   3}, {"AAN",   4},
-    {"AAX",   5}, {"ACA",   6}, {"ACC",   7}, {"ACG",   8}, {"ACT",   9},
-    {"ACN",  10}, {"ACX",  11}, {"AGA",  12}, {"AGC",  13}, {"AGG",  14},
-    {"AGT",  15}, {"AGN",  16}, {"AGX",  17}, {"ATA",  18}, {"ATC",  19},
-    {"ATG",  20}, {"ATT",  21}, {"ATN",  22}, {"ATX",  23}, {"ANA",  24},
-    {"ANC",  25}, {"ANG",  26}, {"ANT",  27}, {"ANN",  28}, {"ANX",  29},
-    {"AXA",  30}, {"AXC",  31}, {"AXG",  32}, {"AXT",  33}, {"AXN",  34},
-    {"AXX",  35}, {"CAA",  36}, {"CAC",  37}, {"CAG",  38}, {"CAT",  39},
-    {"CAN",  40}, {"CAX",  41}, {"CCA",  42}, {"CCC",  43}, {"CCG",  44},
-    {"CCT",  45}, {"CCN",  46}, {"CCX",  47}, {"CGA",  48}, {"CGC",  49},
-    {"CGG",  50}, {"CGT",  51}, {"CGN",  52}, {"CGX",  53}, {"CTA",  54},
-    {"CTC",  55}, {"CTG",  56}, {"CTT",  57}, {"CTN",  58}, {"CTX",  59},
-    {"CNA",  60}, {"CNC",  61}, {"CNG",  62}, {"CNT",  63}, {"CNN",  64},
-    {"CNX",  65}, {"CXA",  66}, {"CXC",  67}, {"CXG",  68}, {"CXT",  69},
-    {"CXN",  70}, {"CXX",  71}, {"GAA",  72}, {"GAC",  73}, {"GAG",  74},
-    {"GAT",  75}, {"GAN",  76}, {"GAX",  77}, {"GCA",  78}, {"GCC",  79},
-    {"GCG",  80}, {"GCT",  81}, {"GCN",  82}, {"GCX",  83}, {"GGA",  84},
-    {"GGC",  85}, {"GGG",  86}, {"GGT",  87}, {"GGN",  88}, {"GGX",  89},
-    {"GTA",  90}, {"GTC",  91}, {"GTG",  92}, {"GTT",  93}, {"GTN",  94},
-    {"GTX",  95}, {"GNA",  96}, {"GNC",  97}, {"GNG",  98}, {"GNT",  99},
-    {"GNN", 100}, {"GNX", 101}, {"GXA", 102}, {"GXC", 103}, {"GXG", 104},
-    {"GXT", 105}, {"GXN", 106}, {"GXX", 107}, {"TAA", 108}, {"TAC", 109},
-    {"TAG", 110}, {"TAT", 111}, {"TAN", 112}, {"TAX", 113}, {"TCA", 114},
-    {"TCC", 115}, {"TCG", 116}, {"TCT", 117}, {"TCN", 118}, {"TCX", 119},
-    {"TGA", 120}, {"TGC", 121}, {"TGG", 122}, {"TGT", 123}, {"TGN", 124},
-    {"TGX", 125}, {"TTA", 126}, {"TTC", 127}, {"TTG", 128}, {"TTT", 129},
-    {"TTN", 130}, {"TTX", 131}, {"TNA", 132}, {"TNC", 133}, {"TNG", 134},
-    {"TNT", 135}, {"TNN", 136}, {"TNX", 137}, {"TXA", 138}, {"TXC", 139},
-    {"TXG", 140}, {"TXT", 141}, {"TXN", 142}, {"TXX", 143}, {"NAA", 144},
-    {"NAC", 145}, {"NAG", 146}, {"NAT", 147}, {"NAN", 148}, {"NAX", 149},
-    {"NCA", 150}, {"NCC", 151}, {"NCG", 152}, {"NCT", 153}, {"NCN", 154},
-    {"NCX", 155}, {"NGA", 156}, {"NGC", 157}, {"NGG", 158}, {"NGT", 159},
-    {"NGN", 160}, {"NGX", 161}, {"NTA", 162}, {"NTC", 163}, {"NTG", 164},
-    {"NTT", 165}, {"NTN", 166}, {"NTX", 167}, {"NNA", 168}, {"NNC", 169},
-    {"NNG", 170}, {"NNT", 171}, {"NNN", 172}, {"NNX", 173}, {"NXA", 174},
-    {"NXC", 175}, {"NXG", 176}, {"NXT", 177}, {"NXN", 178}, {"NXX", 179},
-    {"XAA", 180}, {"XAC", 181}, {"XAG", 182}, {"XAT", 183}, {"XAN", 184},
-    {"XAX", 185}, {"XCA", 186}, {"XCC", 187}, {"XCG", 188}, {"XCT", 189},
-    {"XCN", 190}, {"XCX", 191}, {"XGA", 192}, {"XGC", 193}, {"XGG", 194},
-    {"XGT", 195}, {"XGN", 196}, {"XGX", 197}, {"XTA", 198}, {"XTC", 199},
-    {"XTG", 200}, {"XTT", 201}, {"XTN", 202}, {"XTX", 203}, {"XNA", 204},
-    {"XNC", 205}, {"XNG", 206}, {"XNT", 207}, {"XNN", 208}, {"XNX", 209},
-    {"XXA", 210}, {"XXC", 211}, {"XXG", 212}, {"XXT", 213}, {"XXN", 214},
-    {"XXX", 215}
-};
-
 
 /**
  * @brief Usage guide
@@ -176,7 +206,7 @@ inline void Help ()
 {
     cout                                                                << '\n'
         << "Synopsis:"                                                  << '\n'
-        << "    cryfa [OPTION]... -k [KEY_FILE] [INPUT_FILE]"           << '\n'
+        << "    cryfa [OPTION]... -k [KEY_FILE] [INPUT_FILE]..."        << '\n'
                                                                         << '\n'
         << "Options:"                                                   << '\n'
         << "    -h,  --help"                                            << '\n'
@@ -197,6 +227,56 @@ inline void Help ()
         << "    -t [NUMBER],  --thread [NUMBER]"                        << '\n'
         << "         number of threads"                                 << '\n'
                                                                         << '\n'
+        << "    -c [SIZE],  --chunk [SIZE]"                             << '\n'
+        << "         size of input chunks, in bytes, each packed by"    << '\n'
+        << "         one thread. By default, 1M, or less for small"     << '\n'
+        << "         inputs, whatever the number of threads, so the"    << '\n'
+        << "         output is the same with any. K, M or G may follow" << '\n'
+                                                                        << '\n'
+        << "    -m [SIZE],  --max-memory [SIZE]"                        << '\n'
+        << "         keep memory under SIZE, e.g. 512M, by sizing"      << '\n'
+        << "         I/O buffers and the number of threads, and"        << '\n'
+        << "         chunks, if not given. With -v, the peak is"        << '\n'
+        << "         reported"                                          << '\n'
+                                                                        << '\n'
+        << "    -N,  --numa"                                            << '\n'
+        << "         bind threads to cores, spread over NUMA nodes,"    << '\n'
+        << "         keeping each chunk on one node. With -v, the"      << '\n'
+        << "         throughput of each node is reported"               << '\n'
+                                                                        << '\n'
+        << "    -r,  --reorder"                                         << '\n'
+        << "         reorder FASTQ reads to improve packing locality;"  << '\n'
+        << "         original order is not kept"                        << '\n'
+                                                                        << '\n'
+        << "    -R,  --reorder_keep"                                    << '\n'
+        << "         reorder FASTQ reads, and keep a permutation to"    << '\n'
+        << "         restore the original order in decryption"          << '\n'
+                                                                        << '\n'
+        << "    -p [FILE],  --pair [FILE]"                              << '\n'
+        << "         paired-end FASTQ: mate (R2) file. INPUT_FILE is"   << '\n'
+        << "         R1. With -d, R2 is written to FILE; otherwise,"    << '\n'
+        << "         mates are interleaved on standard output"          << '\n'
+                                                                        << '\n'
+        << "    -x [NAME],  --extract [NAME]"                           << '\n'
+        << "         with -d, write only member NAME of an archive to"  << '\n'
+        << "         standard output. Archives are made by giving more" << '\n'
+        << "         than one INPUT_FILE; all members are otherwise"    << '\n'
+        << "         written to files with their stored names"          << '\n'
+                                                                        << '\n'
+        << "    -o [FILE],  --output [FILE]"                            << '\n'
+        << "         write to FILE, not standard output. Encrypted"     << '\n'
+        << "         output goes in large aligned blocks, past the"     << '\n'
+        << "         page cache where the file system allows it."       << '\n'
+        << "         Decrypted output is written by all threads,"       << '\n'
+        << "         each chunk at its place"                           << '\n'
+                                                                        << '\n'
+        << "    --stats [FILE]"                                         << '\n'
+        << "         write a report of the run to FILE, in JSON:"       << '\n'
+        << "         wall and CPU time of each stage, and the stage"    << '\n'
+        << "         it is run in, bytes in and out, records,"          << '\n'
+        << "         chunks, busy, idle and queue wait time of each"    << '\n'
+        << "         thread, and peak memory"                           << '\n'
+                                                                        << '\n'
         << "    -a,  --about"                                           << '\n'
         << "         about cryfa"                                       << '\n'
                                                                         << '\n';
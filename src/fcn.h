@@ -11,8 +11,93 @@
 #define CRYFA_FCN_H
 
 #include <fstream>
+#include <vector>
+#include <cctype>
+#include <ctime>
+#include <sys/resource.h>
+#include "def.h"
 using std::ifstream;
 using std::cerr;
+using std::vector;
+
+/**
+ * @brief  Size of a file
+ * @param  fileName  File name
+ * @return Size, in bytes
+ */
+inline u64 fileSize (const string &fileName)
+{
+    ifstream in(fileName, std::ios::binary | std::ios::ate);
+    if (!in.good())
+        throw CryfaError(ErrCode::OPEN_FAILED,
+                         "failed opening \"" + fileName + "\".");
+    
+    return (u64) in.tellg();
+}
+
+/**
+ * @brief  Parse a size, e.g. 512K, 64M or 2G -- Suffixes are powers of 1024
+ * @param  str  Size
+ * @return Size, in bytes
+ */
+inline u64 parseSize (const string &str)
+{
+    string::size_type n = 0;
+    while (n != str.size() && isdigit(str[n]))    ++n;
+    
+    u64 unit = 1;
+    const string suffix = str.substr(n);
+    if      (suffix == "K" || suffix == "k")    unit = 1024;
+    else if (suffix == "M" || suffix == "m")    unit = 1024*1024;
+    else if (suffix == "G" || suffix == "g")    unit = 1024*1024*1024;
+    else if (!suffix.empty())    n = 0;
+    
+    if (!n)
+        throw CryfaError(ErrCode::BAD_OPTIONS, "invalid size \"" + str + "\".");
+    return std::stoull(str.substr(0, n)) * unit;
+}
+
+/**
+ * @brief  Peak memory of this process -- Resident set
+ * @return Size, in bytes. 0, if unknown
+ */
+inline u64 peakMemory ()
+{
+    rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage))    return 0;
+#ifdef __APPLE__
+    return (u64) usage.ru_maxrss;                         // In bytes
+#else
+    return (u64) usage.ru_maxrss * 1024;                  // In KB
+#endif
+}
+
+/**
+ * @brief  CPU time of this process, in all threads
+ * @return Seconds, user and system
+ */
+inline double cpuTime ()
+{
+    rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage))    return 0;
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+           (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+/**
+ * @brief  CPU time of the calling thread. Without a clock of threads, that
+ *         of the process
+ * @return Seconds, user and system
+ */
+inline double threadCpuTime ()
+{
+#ifdef CLOCK_THREAD_CPUTIME_ID
+    timespec t;
+    if (!clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t))
+        return t.tv_sec + t.tv_nsec / 1e9;
+#endif
+    return cpuTime();
+}
 
 /**
  * @brief  Find file type: FASTA (A), FASTQ (Q), none (n)
@@ -25,7 +110,8 @@ inline char fileType (const string& inFileName)
     ifstream in(inFileName);
     
     if (!in.good())
-    { cerr << "Error: failed opening '" << inFileName << "'.\n";    exit(1); }
+        throw CryfaError(ErrCode::OPEN_FAILED,
+                         "failed opening \"" + inFileName + "\".");
     
     // Skip leading blank lines (0xA='\n') or spaces (0x20=' ')
     while (in.peek()==0xA || in.peek()==0x20)    in.get(c);
@@ -64,6 +150,18 @@ inline char fileType (const string& inFileName)
     return 'n';
 }
 
+/**
+ * @brief Check size of password
+ * @param pass  Password
+ */
+inline void checkPassSize (const string &pass)
+{
+    if (pass.size() < 8)
+        throw CryfaError(ErrCode::BAD_KEY, "password size is " +
+                         std::to_string(pass.size()) + ". It must be at "
+                         "least 8.");
+}
+
 /**
  * @brief  Check password taken from a file
  * @param  keyFileName  Name of the file containing the password
@@ -71,42 +169,93 @@ inline char fileType (const string& inFileName)
  */
 inline void checkPass (const string& keyFileName, const bool k_flag)
 {
-    if (!k_flag) { cerr<< "Error: no password file has been set.\n";  exit(1); }
-    else
+    if (!k_flag)
+        throw CryfaError(ErrCode::BAD_KEY, "no password file has been set.");
+    
+    ifstream in(keyFileName);
+    if (!in.good())
+        throw CryfaError(ErrCode::OPEN_FAILED,
+                         "failed opening \"" + keyFileName + "\".");
+    if (in.peek() == EOF)
+        throw CryfaError(ErrCode::BAD_KEY, "password file is empty.");
+    
+    // Extract the password
+    char c;
+    string pass;
+    while (in.get(c))    pass += c;
+    in.close();
+    
+    checkPassSize(pass);
+}
+
+/**
+ * @brief      Split a string by a delimiter. Empty fields are kept
+ * @param[out] fields  Fields
+ * @param[in]  str     String
+ * @param[in]  delim   Delimiter
+ */
+inline void split (vector<string> &fields, const string &str, const char delim)
+{
+    string::size_type beg = 0,  end;
+    fields.clear();
+    
+    while ((end = str.find(delim, beg)) != string::npos)
     {
-        ifstream in(keyFileName);
-        
-        if (in.peek() == EOF)
-        {
-            cerr << "Error: password file is empty.\n";
-            in.close();
-            exit(1);
-        }
-        else if (!in.good())
+        fields.emplace_back(str, beg, end - beg);
+        beg = end + 1;
+    }
+    fields.emplace_back(str, beg, string::npos);
+}
+
+/**
+ * @brief  Hash a 64 bit value -- Finalizer of splitmix64
+ * @param  x  Value
+ * @return Hashed value
+ */
+inline u64 hash64 (u64 x)
+{
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+/**
+ * @brief  Minimizer of a read: the smallest hash of its canonical k-mers.
+ *         k-mers including any symbol other than A, C, G, T are skipped
+ * @param  seq  Sequence
+ * @param  k    k-mer size -- At most 31
+ * @return Minimizer. Max of u64 if the read has no valid k-mer
+ */
+inline u64 minimizer (const string &seq, const byte k = MINIMIZER_K)
+{
+    const u64 mask = (1ULL << 2*k) - 1;
+    const byte revShift = (byte) (2*(k-1));
+    u64  fwd = 0,  rev = 0,  minHash = ~0ULL,  b;
+    u32  valid = 0;                   // Number of valid bases in the window
+    
+    for (const char &c : seq)
+    {
+        switch (c)
         {
-            cerr << "Error opening \"" << keyFileName << "\".\n";
-            in.close();
-            exit(1);
+            case 'A':   b = 0;   break;
+            case 'C':   b = 1;   break;
+            case 'G':   b = 2;   break;
+            case 'T':   b = 3;   break;
+            default:    valid = 0;   continue;
         }
-        else
+        
+        fwd = ((fwd << 2) | b) & mask;             // Forward k-mer
+        rev = (rev >> 2) | ((3-b) << revShift);    // Reverse complement k-mer
+        
+        if (++valid >= k)
         {
-            // Extract the password
-            char c;
-            string pass;
-            pass.clear();
-            while (in.get(c))    pass += c;
-    
-            if (pass.size() < 8)
-            {
-                cerr << "Error: password size is " << pass.size()
-                     << ". It must be at least 8.\n";
-                in.close();
-                exit(1);
-            }
-    
-            in.close();
+            valid = k;
+            const u64 h = hash64(fwd < rev ? fwd : rev);
+            if (h < minHash)    minHash = h;
         }
     }
+    
+    return minHash;
 }
 
 #endif //CRYFA_FCN_H
\ No newline at end of file
@@ -0,0 +1,294 @@
+/**
+ * @file      gunzip.h
+ * @brief     Gzip/BGZF input
+ * @author    Morteza Hosseini  (seyedmorteza@ua.pt)
+ * @author    Diogo Pratas      (pratas@ua.pt)
+ * @author    Armando J. Pinho  (ap@ua.pt)
+ * @copyright The GNU General Public License v3.0
+ */
+
+#ifndef CRYFA_GUNZIP_H
+#define CRYFA_GUNZIP_H
+
+#include <fstream>
+#include <cstdio>
+#include <vector>
+#include "def.h"
+#include "pool.h"
+#include "cryptopp/files.h"
+#include "cryptopp/zinflate.h"
+using std::string;
+using std::vector;
+using std::ifstream;
+using std::ofstream;
+using std::fstream;
+
+/**
+ * @brief  CRC-32 of gzip (RFC 1952), going on from that of the data before
+ * @param  crc   CRC-32 of the data before. 0 at the beginning
+ * @param  data  Data
+ * @param  size  Size of data
+ * @return CRC-32
+ */
+inline u32 gzipCrc32 (u32 crc, const byte *data, size_t size)
+{
+    static const vector<u32> table = [] {
+        vector<u32> t(256);
+        for (u32 n = 0; n != 256; ++n)
+        {
+            u32 c = n;
+            for (byte k = 0; k != 8; ++k)
+                c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+            t[n] = c;
+        }
+        return t;
+    }();
+    
+    crc = ~crc;
+    while (size--)    crc = table[(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+/**
+ * @brief Inflator for gzip members (RFC 1952), one after another. CRC-32
+ *        and size of each member, in its trailer, are checked
+ */
+class GzipInflator : public CryptoPP::Inflator
+{
+public:
+    /** @brief Error in gzip format */
+    class FormatErr : public Err
+    {
+    public:
+        explicit FormatErr (const string &s)
+                : Err(INVALID_DATA_FORMAT, "Gzip: " + s) {}
+    };
+    
+    /** @brief Constructor */
+    explicit GzipInflator (CryptoPP::BufferedTransformation *attachment)
+            : Inflator(attachment, true, 0), memberCrc(0), memberSize(0),
+              betweenMembers(true) {}
+    
+    /**
+     * @brief Inflate. At the end, flushing is only needed if a member is left
+     *        unprocessed, since Inflator would look for a header after the
+     *        last member
+     */
+    size_t Put2 (const byte *inStr, size_t length, int messageEnd,
+                 bool blocking) override
+    {
+        Inflator::Put2(inStr, length, 0, blocking);
+        if (messageEnd && !(betweenMembers && m_inQueue.IsEmpty()))
+            Inflator::Put2(nullptr, 0, messageEnd, blocking);
+        return 0;
+    }
+    
+private:
+    enum { FHCRC = 2,  FEXTRA = 4,  FNAME = 8,  FCOMMENT = 16 };
+    u32  memberCrc;                      /**< @brief CRC-32 of inflated data */
+    u32  memberSize;                     /**< @brief Inflated size of member */
+    bool betweenMembers;                 /**< @brief Last member is finished */
+    
+    unsigned int MaxPrestreamHeaderSize () const override { return 1024; }
+    unsigned int MaxPoststreamTailSize  () const override { return 8;    }
+    
+    /** @brief Skip header of a member */
+    void ProcessPrestreamHeader () override
+    {
+        byte magic[3], flags, b;
+        CryptoPP::word16 xLen;
+        
+        if (m_inQueue.Get(magic, 3) != 3 || magic[0] != 0x1F ||
+            magic[1] != 0x8B || magic[2] != 8 || !m_inQueue.Get(flags) ||
+            m_inQueue.Skip(6) != 6)                  // MTIME, XFL and OS
+            throw FormatErr("bad member header");
+        
+        if (flags & FEXTRA)
+        {
+            if (m_inQueue.GetWord16(xLen, CryptoPP::LITTLE_ENDIAN_ORDER) != 2
+                || m_inQueue.Skip(xLen) != xLen)
+                throw FormatErr("bad extra field");
+        }
+        if (flags & FNAME)       do if (!m_inQueue.Get(b))    break; while (b);
+        if (flags & FCOMMENT)    do if (!m_inQueue.Get(b))    break; while (b);
+        if (flags & FHCRC)       m_inQueue.Skip(2);
+        
+        memberCrc      = 0;
+        memberSize     = 0;
+        betweenMembers = false;
+    }
+    
+    /** @brief Pass inflated data on, counting its CRC-32 and size */
+    void ProcessDecompressedData (const byte *str, size_t length) override
+    {
+        memberCrc   = gzipCrc32(memberCrc, str, length);
+        memberSize += (u32) length;
+        AttachedTransformation()->Put(str, length);
+    }
+    
+    /** @brief Check the trailer: CRC-32 and size (modulo 2^32) */
+    void ProcessPoststreamTail () override
+    {
+        CryptoPP::word32 crc, size;
+        
+        if (m_inQueue.GetWord32(crc, CryptoPP::LITTLE_ENDIAN_ORDER) != 4 ||
+            crc != memberCrc)
+            throw FormatErr("bad CRC");
+        if (m_inQueue.GetWord32(size, CryptoPP::LITTLE_ENDIAN_ORDER) != 4 ||
+            size != memberSize)
+            throw FormatErr("bad member size");
+        
+        betweenMembers = true;
+    }
+};
+
+/** @brief BGZF block -- A gzip member of at most 64 KB */
+struct bgzf_s
+{
+    u64 begin;                 /**< @brief Position in compressed file */
+    u64 size;                  /**< @brief Size in compressed file */
+    u64 outBegin;              /**< @brief Position in inflated file */
+};
+
+/**
+ * @brief  Check if a file is gzip compressed
+ * @param  inFileName  Input file name
+ * @return True, if it begins with the gzip magic bytes
+ */
+inline bool isGzip (const string &inFileName)
+{
+    ifstream in(inFileName, std::ios::binary);
+    return in.get() == 0x1F && in.get() == 0x8B;
+}
+
+/**
+ * @brief      Find the blocks of a BGZF file. Any member without the "BC"
+ *             extra subfield makes it an ordinary gzip file
+ * @param[in]  inFileName  Input file name
+ * @param[out] blocks      Blocks
+ * @return     True, if the file is BGZF
+ */
+inline bool findBgzfBlocks (const string &inFileName, vector<bgzf_s> &blocks)
+{
+    ifstream in(inFileName, std::ios::binary);
+    byte     hdr[12], isize[4];
+    u64      pos=0, outPos=0, bSize;
+    u16      xLen, subLen;
+    string   extra;
+    
+    blocks.clear();
+    while (in.read((char*) hdr, 12).gcount() == 12)
+    {
+        if (hdr[0]!=0x1F || hdr[1]!=0x8B || hdr[2]!=8 || !(hdr[3] & 4))
+            return false;
+        
+        // Look for subfield "BC", having the size of block minus 1
+        xLen = (u16) (hdr[10] | hdr[11]<<8);
+        extra.resize(xLen);
+        if (!in.read(&extra[0], xLen))    return false;
+        bSize = 0;
+        for (u16 i = 0; i + 4 <= xLen; i += 4 + subLen)
+        {
+            subLen = (u16) ((byte) extra[i+2] | (byte) extra[i+3]<<8);
+            if (extra[i]=='B' && extra[i+1]=='C' && subLen==2 && i+6 <= xLen)
+                bSize = (u64) ((byte) extra[i+4] | (byte) extra[i+5]<<8) + 1;
+        }
+        if (bSize < 12u + xLen + 8)    return false;
+        
+        // Inflated size, from the last 4 bytes of block
+        in.seekg((std::streamoff) (pos + bSize - 4));
+        if (in.read((char*) isize, 4).gcount() != 4)    return false;
+        
+        blocks.push_back({pos, bSize, outPos});
+        pos    += bSize;
+        outPos += (u64) isize[0]     | (u64) isize[1]<<8 |
+                  (u64) isize[2]<<16 | (u64) isize[3]<<24;
+    }
+    
+    return !blocks.empty();
+}
+
+/**
+ * @brief Inflate a range of BGZF blocks, into their place in output file
+ * @param inFileName   Input file name
+ * @param outFileName  Output file name
+ * @param blocks       All blocks
+ * @param first        First block of the range
+ * @param last         One after the last block of the range
+ */
+inline void inflateBgzfBlocks (const string &inFileName,
+                               const string &outFileName,
+                               const vector<bgzf_s> &blocks, u64 first,
+                               u64 last)
+{
+    if (first == last)    return;
+    
+    ifstream in (inFileName, std::ios::binary);
+    fstream  out(outFileName, std::ios::in|std::ios::out|std::ios::binary);
+    string   block;
+    
+    in.seekg ((std::streamoff) blocks[first].begin);
+    out.seekp((std::streamoff) blocks[first].outBegin);
+    
+    GzipInflator inflator(new CryptoPP::FileSink(out));
+    for (u64 b = first; b != last; ++b)
+    {
+        block.resize(blocks[b].size);
+        in.read(&block[0], (std::streamsize) block.size());
+        inflator.Put((const byte*) block.data(), block.size());
+        ThreadPool::count(block.size());
+    }
+    inflator.MessageEnd();
+}
+
+/**
+ * @brief Decompress a gzip file. BGZF blocks are shared among workers, each
+ *        inflating a contiguous range of them
+ * @param inFileName   Input file name
+ * @param outFileName  Output file name
+ * @param pool         Workers
+ */
+inline void gunzip (const string &inFileName, const string &outFileName,
+                    ThreadPool &pool)
+{
+    vector<bgzf_s> blocks;
+    
+    try
+    {
+        if (pool.size() > 1 && findBgzfBlocks(inFileName, blocks))
+        {
+            ofstream(outFileName, std::ios::binary).close();    // Empty it
+            
+            const u64 nBlocks = blocks.size(),  nRanges = pool.size();
+            for (u64 r = 0; r != nRanges; ++r)
+                pool.submit([&, r] {
+                    inflateBgzfBlocks(inFileName, outFileName, blocks,
+                                      nBlocks*r/nRanges, nBlocks*(r+1)/nRanges);
+                });
+            pool.wait();
+        }
+        else
+        {
+            CryptoPP::FileSource(inFileName.c_str(), true,
+                new GzipInflator(new CryptoPP::FileSink(outFileName.c_str())));
+        }
+    }
+    catch (CryptoPP::Exception const &e)
+    {
+        std::remove(outFileName.c_str());
+        throw CryfaError(ErrCode::BAD_GZIP, "failed decompressing \""
+                         + inFileName + "\". " + e.what());
+    }
+}
+
+/**
+ * @brief Remove gunzipped input files, if any
+ * @param prefix  Prefix of temporary files
+ */
+inline void removeGunzipped (const string &prefix)
+{
+    std::remove((prefix + GZ_FILENAME "0").c_str());
+    std::remove((prefix + GZ_FILENAME "1").c_str());
+}
+
+#endif //CRYFA_GUNZIP_H
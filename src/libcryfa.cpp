@@ -0,0 +1,234 @@
+/**
+ * @file      libcryfa.cpp
+ * @brief     Library API -- Streaming encoder and decoder
+ * @author    Morteza Hosseini  (seyedmorteza@ua.pt)
+ * @author    Diogo Pratas      (pratas@ua.pt)
+ * @author    Armando J. Pinho  (ap@ua.pt)
+ * @copyright The GNU General Public License v3.0
+ */
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+#include "libcryfa.h"
+#include "EnDecrypto.h"
+#include "fcn.h"
+#include "cryptopp/cryptlib.h"
+
+using std::to_string;
+
+namespace cryfa
+{
+/** @brief Gives each object its own files */
+static std::atomic<u64> objectNo(0);
+
+/**
+ * @brief  Prefix of the files of a new object, unique in the system
+ * @param  opts  Options
+ * @return Directory, then "cryfa", process ID and object number
+ */
+static string filePrefix (const options_s &opts)
+{
+    string dir = opts.tmp_dir;
+    if (dir.empty())
+    {
+        const char *env = std::getenv("TMPDIR");
+        dir = env && *env ? env : "/tmp";
+    }
+    if (dir.back() != '/')    dir += '/';
+    
+    return dir + "cryfa" + to_string(getpid()) + "_" + to_string(objectNo++)
+           + "_";
+}
+
+/**
+ * @brief Set up an EnDecrypto object, from the options
+ * @param obj       EnDecrypto object
+ * @param password  Password
+ * @param opts      Options
+ */
+static void setUp (EnDecrypto &obj, const string &password,
+                   const options_s &opts)
+{
+    obj.password        = password;
+    obj.n_threads       = opts.n_threads ? opts.n_threads : (byte) 1;
+    obj.verbose         = opts.verbose;
+    obj.disable_shuffle = opts.disable_shuffle;
+    obj.reorder         = opts.reorder;
+    obj.reorder_keep    = opts.reorder_keep;
+    obj.numa            = opts.numa;
+    obj.chunkBytes      = opts.chunk_bytes;
+    obj.maxMemory       = opts.max_memory;
+    obj.extractName     = opts.member;
+    obj.pool            = opts.pool;
+}
+
+/**
+ * @brief  Run a job, turning exceptions into an error code and a message
+ * @param  job      Job
+ * @param  message  Error message
+ * @return Error code
+ */
+template <typename Job>
+static ErrCode run (Job job, string &message)
+{
+    try
+    {
+        job();
+        return ErrCode::NONE;
+    }
+    catch (CryfaError const &e)
+    {
+        message = e.what();
+        return e.code;
+    }
+    catch (CryptoPP::Exception const &e)            // E.g. wrong password
+    {
+        message = e.what();
+        return ErrCode::BAD_ENCRYPTED;
+    }
+}
+
+
+/**
+ * @brief Constructor
+ * @param password  Password -- At least 8 chars
+ * @param options   Options
+ */
+Encoder::Encoder (const string &password, const options_s &options)
+        : password(password), opts(options), prefix(filePrefix(options)),
+          inFileName(prefix + "ENC_IN")
+{
+    status = run([&] { checkPassSize(password); }, message);
+    if (status == ErrCode::NONE)    inFile.open(inFileName, std::ios::binary);
+}
+
+/**
+ * @brief Destructor -- Deletes the buffered input
+ */
+Encoder::~Encoder ()
+{
+    inFile.close();
+    std::remove(inFileName.c_str());
+}
+
+/**
+ * @brief  Give a piece of input
+ * @param  data  Input
+ * @param  size  Size of input
+ * @return Error code
+ */
+ErrCode Encoder::write (const char *data, size_t size)
+{
+    if (status != ErrCode::NONE)    return status;
+    
+    if (!inFile.write(data, (std::streamsize) size))
+    {
+        message = "failed buffering input in \"" + inFileName + "\".";
+        status  = ErrCode::OPEN_FAILED;
+    }
+    return status;
+}
+
+/**
+ * @brief  Compact and encrypt all the input given
+ * @param  out  Output
+ * @return Error code
+ */
+ErrCode Encoder::finish (std::ostream &out)
+{
+    if (status != ErrCode::NONE)    return status;
+    inFile.close();
+    
+    EnDecrypto obj;
+    setUp(obj, password, opts);
+    obj.tmpPrefix  = prefix;
+    obj.inFileName = inFileName;
+    obj.outStream  = &out;
+    
+    return status = run([&] { obj.compress(); }, message);
+}
+
+
+/**
+ * @brief Constructor
+ * @param password  Password -- At least 8 chars
+ * @param options   Options
+ */
+Decoder::Decoder (const string &password, const options_s &options)
+        : password(password), opts(options), prefix(filePrefix(options)),
+          inFileName(prefix + "DEC_IN"), outFileName(prefix + "DEC_OUT")
+{
+    status = run([&] { checkPassSize(password); }, message);
+    if (status == ErrCode::NONE)    inFile.open(inFileName, std::ios::binary);
+}
+
+/**
+ * @brief Destructor -- Deletes the buffered input and output
+ */
+Decoder::~Decoder ()
+{
+    inFile.close();
+    outFile.close();
+    std::remove(inFileName.c_str());
+    std::remove(outFileName.c_str());
+}
+
+/**
+ * @brief  Give a piece of encrypted input
+ * @param  data  Input
+ * @param  size  Size of input
+ * @return Error code
+ */
+ErrCode Decoder::write (const char *data, size_t size)
+{
+    if (status != ErrCode::NONE)    return status;
+    
+    if (!inFile.write(data, (std::streamsize) size))
+    {
+        message = "failed buffering input in \"" + inFileName + "\".";
+        status  = ErrCode::OPEN_FAILED;
+    }
+    return status;
+}
+
+/**
+ * @brief  Decrypt and unpack all the input given
+ * @return Error code
+ */
+ErrCode Decoder::finish ()
+{
+    if (status != ErrCode::NONE)    return status;
+    inFile.close();
+    
+    {
+        EnDecrypto obj;
+        setUp(obj, password, opts);
+        obj.tmpPrefix  = prefix;
+        obj.inFileName = inFileName;
+        std::ofstream out(outFileName, std::ios::binary);
+        obj.outStream  = &out;
+        
+        status = run([&] { obj.decrypt();    obj.decompress(); }, message);
+        std::remove((prefix + DEC_FILENAME).c_str());
+    }
+    
+    if (status == ErrCode::NONE)    outFile.open(outFileName, std::ios::binary);
+    return status;
+}
+
+/**
+ * @brief  Take a piece of output, after finish()
+ * @param  data  Output
+ * @param  size  Max size of output
+ * @return Size of output. 0 at the end, or if there is an error
+ */
+size_t Decoder::read (char *data, size_t size)
+{
+    if (status != ErrCode::NONE || !outFile.is_open())    return 0;
+    
+    outFile.read(data, (std::streamsize) size);
+    return (size_t) outFile.gcount();
+}
+}
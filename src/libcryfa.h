@@ -0,0 +1,105 @@
+/**
+ * @file      libcryfa.h
+ * @brief     Library API -- Streaming encoder and decoder
+ * @author    Morteza Hosseini  (seyedmorteza@ua.pt)
+ * @author    Diogo Pratas      (pratas@ua.pt)
+ * @author    Armando J. Pinho  (ap@ua.pt)
+ * @copyright The GNU General Public License v3.0
+ */
+
+#ifndef CRYFA_LIBCRYFA_H
+#define CRYFA_LIBCRYFA_H
+
+#include <fstream>
+#include "def.h"
+#include "pool.h"
+
+namespace cryfa
+{
+/**
+ * @brief Options of encoder and decoder
+ */
+struct options_s
+{
+    byte   n_threads       = DEFAULT_N_THR;   /**< @brief Number of threads */
+    bool   verbose         = false;           /**< @brief Verbose mode */
+    bool   disable_shuffle = false;           /**< @brief Disable shuffle */
+    bool   reorder         = false;           /**< @brief Reorder FASTQ reads */
+    bool   reorder_keep    = false;           /**< @brief Reorder, keep order */
+    bool   numa            = false;           /**< @brief Bind own workers */
+    u64    chunk_bytes     = 0;               /**< @brief 0: automatic */
+    u64    max_memory      = 0;               /**< @brief 0: no limit */
+    string member;           /**< @brief Archive member to decode, if any */
+    string tmp_dir;          /**< @brief Of buffers. Empty: $TMPDIR or /tmp */
+    ThreadPool *pool = nullptr;  /**< @brief Workers -- Can be shared */
+};
+
+/**
+ * @brief Streaming encoder. Input (FASTA, FASTQ or SAM, plain or gzip) is
+ *        given piece by piece, and buffered in a file of options_s::tmp_dir.
+ *        On finish, it is compacted and encrypted into an output stream.
+ * @note  Errors are returned as codes, never thrown. After an error, every
+ *        call returns the same code, and error() describes it.
+ *        Objects can be used by many threads at once, each one by a single
+ *        thread. A pool given in options_s can be shared by all of them.
+ *        Otherwise, each object makes its own.
+ *        Progress is reported on standard error, as in the command line.
+ */
+class Encoder
+{
+public:
+    explicit Encoder (const string &password,
+                      const options_s &options = options_s());
+    ~Encoder ();
+    Encoder (const Encoder&) = delete;
+    Encoder& operator= (const Encoder&) = delete;
+    
+    ErrCode write  (const char *data, size_t size);  // Give input
+    ErrCode finish (std::ostream &out);              // Compact and encrypt
+    const string &error () const { return message; } // Last error message
+    
+private:
+    string        password;                   /**< @brief Password */
+    options_s     opts;                       /**< @brief Options */
+    string        prefix;                     /**< @brief Of its files */
+    string        inFileName;                 /**< @brief Input, buffered */
+    std::ofstream inFile;                     /**< @brief Input, buffered */
+    ErrCode       status = ErrCode::NONE;     /**< @brief Last error code */
+    string        message;                    /**< @brief Last error message */
+};
+
+/**
+ * @brief Streaming decoder. Encrypted input is given piece by piece. On
+ *        finish, it is decrypted and unpacked, then the output can be read
+ *        piece by piece. Input and output are buffered, as in Encoder.
+ * @note  Errors are handled as in Encoder. Archives are decoded into files
+ *        with their members' names, unless options_s::member is set.
+ */
+class Decoder
+{
+public:
+    explicit Decoder (const string &password,
+                      const options_s &options = options_s());
+    ~Decoder ();
+    Decoder (const Decoder&) = delete;
+    Decoder& operator= (const Decoder&) = delete;
+    
+    ErrCode write  (const char *data, size_t size);  // Give encrypted input
+    ErrCode finish ();                               // Decrypt and unpack
+    size_t  read   (char *data, size_t size);        // Take output. 0 at end
+    const string &error () const { return message; } // Last error message
+    
+private:
+    string        password;                   /**< @brief Password */
+    options_s     opts;                       /**< @brief Options */
+    string        prefix;                     /**< @brief Of its files */
+    string        inFileName;                 /**< @brief Input, buffered */
+    string        outFileName;                /**< @brief Output, buffered */
+    std::ofstream inFile;                     /**< @brief Input, buffered */
+    std::ifstream outFile;                    /**< @brief Output, buffered */
+    ErrCode       status = ErrCode::NONE;     /**< @brief Last error code */
+    string        message;                    /**< @brief Last error message */
+};
+}
+
+#endif //CRYFA_LIBCRYFA_H
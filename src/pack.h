@@ -11,369 +11,244 @@
 #define CRYFA_PACK_H
 
 #include <iostream>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+#include <numeric>
 #include "def.h"
 using std::string;
 using std::vector;
 using std::cout;
 using std::cerr;
-using std::make_pair;
 
-/** @brief Headers' chars. Up to 39 values -- A global variable */
-string Hdrs_g;
-/** @brief Quality scores' chars. Up to 39 values -- A global variable */
-string QSs_g;
 
 
 /**
- * @brief      Build a hash table
- * @param[out] map     Hash table
+ * @brief      Build a table for packing. With an extra char as the last key,
+ *             for # > 39, all symbols but the keys are given its index
+ * @param[out] map     Table
  * @param[in]  strIn   The string including the keys
  * @param[in]  keyLen  Length of the keys
  */
-inline void buildHashTable (htbl_t &map, const string &strIn, short keyLen)
+inline void buildPack (ptbl_t &map, const string &strIn, u16 keyLen)
 {
-    u64 elementNo = 0;
-    string element;    element.reserve(keyLen);
-    map.clear();
-    map.reserve((u64) std::pow(strIn.size(), keyLen));
+    std::memset(map.index, (int) strIn.size() - 1, sizeof(map.index));
+    for (byte k = 0; k != strIn.size(); ++k)    map.index[(byte) strIn[k]] = k;
     
-    switch (keyLen)
-    {
-        case 3:
-            LOOP3(i, j, k, strIn)
-            {
-                element=i;    element+=j;    element+=k;
-                map.insert(make_pair(element, elementNo++));
-////            map.insert({element, elementNo++});
-////            map[element] = elementNo++;
-            }
-            break;
-    
-        case 2:
-            LOOP2(i, j, strIn)
-            {
-                element=i;    element+=j;
-                map.insert(make_pair(element, elementNo++));
-            }
-            break;
-
-        case 1:
-            LOOP(i, strIn)
-            {
-                element=i;
-                map.insert(make_pair(element, elementNo++));
-            }
-            break;
-
-        case 5:
-            LOOP5(i, j, k, l, m, strIn)
-            {
-                element=i;  element+=j;  element+=k;  element+=l;  element+=m;
-                map.insert(make_pair(element, elementNo++));
-            }
-            break;
-
-        case 7:
-            LOOP7(i, j, k, l, m, n, o, strIn)
-            {
-                element =i;  element+=j;  element+=k;  element+=l;  element+=m;
-                element+=n;  element+=o;
-                map.insert(make_pair(element, elementNo++));
-            }
-            break;
-
-        case 4:
-            LOOP4(i, j, k, l, strIn)
-            {
-                element=i;    element+=j;    element+=k;    element+=l;
-                map.insert(make_pair(element, elementNo++));
-            }
-            break;
-
-        case 6:
-            LOOP6(i, j, k, l, m, n, strIn)
-            {
-                element =i;  element+=j;  element+=k;  element+=l;  element+=m;
-                element+=n;
-                map.insert(make_pair(element, elementNo++));
-            }
-            break;
-            
-        case 8:
-            LOOP8(i, j, k, l, m, n, o, p, strIn)
-            {
-                element =i;  element+=j;  element+=k;  element+=l;  element+=m;
-                element+=n;  element+=o;  element+=p;
-                map.insert(make_pair(element, elementNo++));
-            }
-            break;
-            
-        default: break;
-    }
-    
-    
-    // Test
-//    for (htbl_t::iterator i = map.begin(); i != map.end(); ++i)
-//        cerr << i->first << "\t" << i->second << '\n';
-//    cerr << "elementNo = " << elementNo << '\n';
+    map.n      = (u16) strIn.size();
+    map.keyLen = keyLen;
 }
 
 /**
  * @brief      Build a table for unpacking
- * @param[out] unpack  Table (vector of strings)
+ * @param[out] unpack  Table -- Symbols of all codes, in one string
  * @param[in]  strIn   The string including the keys
  * @param[in]  keyLen  Length of the keys
  */
-inline void buildUnpack(vector<string> &unpack, const string &strIn, u16 keyLen)
+inline void buildUnpack (utbl_t &unpack, const string &strIn, u16 keyLen)
 {
-    u64 elementNo = 0;
-    string element;    element.reserve(keyLen);
-    unpack.clear();
-    unpack.reserve((u64) std::pow(strIn.size(), keyLen));
+    string syms;
+    syms.reserve((u64) std::pow(strIn.size(), keyLen) * keyLen);
     
     switch (keyLen)
     {
         case 3:
             LOOP3(i, j, k, strIn)
-            {
-                element=i;    element+=j;    element+=k;
-                unpack.push_back(element);
-            }
+            {   syms+=i;    syms+=j;    syms+=k;                              }
             break;
 
         case 2:
             LOOP2(i, j, strIn)
-            {
-                element=i;    element+=j;
-                unpack.push_back(element);
-            }
+            {   syms+=i;    syms+=j;                                          }
             break;
 
         case 1:
             LOOP(i, strIn)
-            {
-                element=i;
-                unpack.push_back(element);
-            }
+            {   syms+=i;                                                      }
             break;
 
         case 5:
             LOOP5(i, j, k, l, m, strIn)
-            {
-                element=i;  element+=j;  element+=k;  element+=l;  element+=m;
-                unpack.push_back(element);
-            }
+            {   syms+=i;  syms+=j;  syms+=k;  syms+=l;  syms+=m;              }
             break;
 
         case 7:
             LOOP7(i, j, k, l, m, n, o, strIn)
-            {
-                element =i;  element+=j;  element+=k;  element+=l;  element+=m;
-                element+=n;  element+=o;
-                unpack.push_back(element);
-            }
+            {   syms+=i;  syms+=j;  syms+=k;  syms+=l;  syms+=m;  syms+=n;
+                syms+=o;                                                      }
             break;
 
         case 4:
             LOOP4(i, j, k, l, strIn)
-            {
-                element=i;    element+=j;    element+=k;    element+=l;
-                unpack.push_back(element);
-            }
+            {   syms+=i;    syms+=j;    syms+=k;    syms+=l;                  }
             break;
 
         case 6:
             LOOP6(i, j, k, l, m, n, strIn)
-            {
-                element =i;  element+=j;  element+=k;  element+=l;  element+=m;
-                element+=n;
-                unpack.push_back(element);
-            }
+            {   syms+=i;  syms+=j;  syms+=k;  syms+=l;  syms+=m;  syms+=n;    }
             break;
 
         case 8:
             LOOP8(i, j, k, l, m, n, o, p, strIn)
-            {
-                element =i;  element+=j;  element+=k;  element+=l;  element+=m;
-                element+=n;  element+=o;  element+=p;
-                unpack.push_back(element);
-            }
+            {   syms+=i;  syms+=j;  syms+=k;  syms+=l;  syms+=m;  syms+=n;
+                syms+=o;  syms+=p;                                            }
             break;
             
         default: break;
     }
     
-    
-//    // Test
-//    u64 arrSize = (u64) std::pow(strIn.size(), keyLen);
-//    for (u64 i = 0; i != arrSize; ++i)
-//        cerr << unpack[i] << '\n';
+    unpack.syms   = std::make_shared<const string>(std::move(syms));
+    unpack.keyLen = keyLen;
 }
 
 /**
- * @brief  Index of each DNA bases pack
- * @param  key  Key
- * @return Value (based on the idea of key-value in a hash table)
+ * @brief  Index of a base in DNA_UNPACK: A, C, G, T, N, and X for others
+ * @param  c  Base
+ * @return Index, 0 to 5
  */
-inline byte dnaPack (const string &key)     // Maybe byte <-> u16 replacement
+inline byte baseIndex (char c)
 {
-    htbl_t::const_iterator got = DNA_MAP.find(key);
-    if (got == DNA_MAP.end())
-    { cerr << "Error: key '" << key << "'not found!\n";    return 0; }
-    else  return got->second;
+    switch (c)
+    {
+        case 'A': return 0;    case 'C': return 1;    case 'G': return 2;
+        case 'T': return 3;    case 'N': return 4;    default:  return 5;
+    }
 }
 
 /**
- * @brief  Index of each pack, when # > 39
- * @param  key  Key
- * @param  map  Hash table
- * @return Value (based on the idea of key-value in a hash table)
+ * @brief  Alphabet of the printable symbols counted, in ASCII order. If they
+ *         are more than 39, the 39 most frequent ones go last, in ASCII
+ *         order, since packers keep the last 39 and escape the rest
+ * @param  count  Number of each symbol
+ * @param  skip   Symbol left out, e.g. '>' beginning FASTA headers
+ * @return Alphabet
  */
-inline u16 largePack (const string &key, const htbl_t &map)
+inline string freqAlphabet (const u64 *count, char skip = 0)
 {
-    htbl_t::const_iterator got = map.find(key);
-    if (got == map.end())
-    { cerr << "Error: key '" << key << "' not found!\n";    return 0; }
-    else  return got->second;
+    string alphabet;
+    for (byte c = 32; c != 127; ++c)
+        if (count[c] && c != (byte) skip)    alphabet += (char) c;
+    if (alphabet.length() <= MAX_C5)    return alphabet;
+    
+    // The most frequent first. Ties, in ASCII order
+    string ranked = alphabet;
+    std::stable_sort(ranked.begin(), ranked.end(), [&] (char a, char b)
+                     { return count[(byte) a] > count[(byte) b]; });
+    string top = ranked.substr(0, MAX_C5),  rest = ranked.substr(MAX_C5);
+    std::sort(top.begin(),  top.end());
+    std::sort(rest.begin(), rest.end());
+    
+    return rest + top;
 }
 
 /**
- * @brief      Encapsulate each 3 DNA bases in 1 byte. Reduction: ~2/3
- * @param[out] packedSeq  Packed sequence
- * @param[in]  seq        Sequence
+ * @brief  Alphabet of sequences, if packing them by its category (as headers
+ *         are) is smaller than packing 3 bases in 1 byte with all symbols
+ *         but A, C, G, T and N escaped. Alphabets of unprintable symbols are
+ *         packed as DNA
+ * @param  count  Number of each symbol in sequences
+ * @return Alphabet. Empty, if sequences are packed as DNA
  */
-inline void packSeq_3to1 (string &packedSeq, const string &seq)
+inline string seqAlphabet (const u64 *count)
 {
-    bool firstNotIn, secondNotIn, thirdNotIn;
-    char s0, s1, s2;
-    string tuple;   tuple.reserve(3);
-    string::const_iterator i = seq.begin(),   iEnd = seq.end()-2;
+    u64 nSym=0, nEsc=0;              // Symbols, and those escaped as DNA
     
-    for (; i < iEnd; i += 3)
+    for (u16 c = 0; c != 256; ++c)
     {
-        s0 = *i,    s1 = *(i+1),    s2 = *(i+2);
+        if (!count[c])    continue;
+        if (c < 32 || c > 126)    return "";
         
-        tuple.clear();
-        tuple +=
-           (firstNotIn = (s0!='A' && s0!='C' && s0!='G' && s0!='T' && s0!='N'))
-           ? 'X' : s0;
-        tuple +=
-           (secondNotIn = (s1!='A' && s1!='C' && s1!='G' && s1!='T' && s1!='N'))
-           ? 'X' : s1;
-        tuple +=
-           (thirdNotIn = (s2!='A' && s2!='C' && s2!='G' && s2!='T' && s2!='N'))
-           ? 'X' : s2;
-        
-        packedSeq += dnaPack(tuple);
-        if (firstNotIn)  packedSeq += s0;
-        if (secondNotIn) packedSeq += s1;
-        if (thirdNotIn)  packedSeq += s2;
+        nSym += count[c];
+        if (baseIndex((char) c) == 5)    nEsc += count[c];
     }
     
-    // If seq len isn't multiple of 3, add (char) 255 before each sym
-    switch (seq.length() % 3)
+    // Bytes per 210 symbols, for each category. If # > 39, symbols but the
+    // last 39, i.e. the most frequent, are escaped
+    const string alphabet = freqAlphabet(count);
+    const size_t len = alphabet.length();
+    u64 cost, nCatEsc=0;
+    if      (len > MAX_C5)
     {
-        case 1:
-            packedSeq += 255;   packedSeq += *i;
-            break;
-
-        case 2:
-            packedSeq += 255;   packedSeq += *i;
-            packedSeq += 255;   packedSeq += *(i+1);
-            break;
-
-        default: break;
+        cost = 140;                                              // 3 to 2
+        for (size_t c = 0; c != len - MAX_C5; ++c)
+            nCatEsc += count[(byte) alphabet[c]];
     }
+    else if (len > MAX_C4)     cost = 140;                       // 3 to 2
+    else if (len > MAX_C3)     cost = 105;                       // 2 to 1
+    else if (len >= MIN_C3)    cost = 70;                        // 3 to 1
+    else if (len == C2)        cost = 42;                        // 5 to 1
+    else if (len == C1)        cost = 30;                        // 7 to 1
+    else                       cost = 210;                       // 1 to 1
+    
+    return (cost*nSym + 210*nCatEsc < 70*nSym + 210*nEsc) ? alphabet : "";
 }
 
 /**
- * @brief      Encapsulate 3 header symbols in 2 bytes, when # >= 40.
- *             Reduction ~1/3
- * @param[out] packed  Packed header
- * @param[in]  strIn   Header
- * @param[in]  map     Hash table
+ * @brief      Encapsulate each 3 DNA bases in 1 byte. Reduction: ~2/3.
+ *             The byte is the index of the tuple in DNA_UNPACK, i.e. its
+ *             bases' indices, in base 6
+ * @param[out] packedSeq  Packed sequence
+ * @param[in]  seq        Sequence
  */
-inline void packLargeHdr_3to2 (string &packed, const string &strIn,
-                               const htbl_t &map)
+inline void packSeq_3to1 (string &packedSeq, const string &seq)
 {
-    string tuple;    tuple.reserve(3);
-    bool firstNotIn, secondNotIn, thirdNotIn;
-    char s0, s1, s2;
-    u16 shortTuple;
-    string hdrs = Hdrs_g;
-    // ASCII char after the last char in HEADERS string
-    const char XChar = (char) (hdrs.back() + 1);
-    string::const_iterator i = strIn.begin(),   iEnd = strIn.end()-2;
+    byte b0, b1, b2;
+    string::const_iterator i = seq.begin();
     
-    for (; i < iEnd; i += 3)
+    for (u64 n = seq.size() / 3; n--; i += 3)
     {
-        s0 = *i,    s1 = *(i+1),    s2 = *(i+2);
-        
-        tuple.clear();
-        tuple  = (firstNotIn  = (hdrs.find(s0)==string::npos)) ? XChar : s0;
-        tuple += (secondNotIn = (hdrs.find(s1)==string::npos)) ? XChar : s1;
-        tuple += (thirdNotIn  = (hdrs.find(s2)==string::npos)) ? XChar : s2;
-    
-        shortTuple = largePack(tuple, map);
-        packed += (unsigned char) (shortTuple >> 8);      // Left byte
-        packed += (unsigned char) (shortTuple & 0xFF);    // Right byte
+        b0 = baseIndex(*i),  b1 = baseIndex(*(i+1)),  b2 = baseIndex(*(i+2));
         
-        if (firstNotIn)   packed += s0;
-        if (secondNotIn)  packed += s1;
-        if (thirdNotIn)   packed += s2;
+        packedSeq += (char) (36*b0 + 6*b1 + b2);
+        if (b0 == 5)    packedSeq += *i;
+        if (b1 == 5)    packedSeq += *(i+1);
+        if (b2 == 5)    packedSeq += *(i+2);
     }
     
-    // If len isn't multiple of 3, add (char) 255 before each sym
-    switch (strIn.length() % 3)
+    // If seq len isn't multiple of 3, add (char) 255 before each sym
+    switch (seq.length() % 3)
     {
         case 1:
-            packed += 255;   packed += *i;
+            packedSeq += 255;   packedSeq += *i;
             break;
-        
+
         case 2:
-            packed += 255;   packed += *i;
-            packed += 255;   packed += *(i+1);
+            packedSeq += 255;   packedSeq += *i;
+            packedSeq += 255;   packedSeq += *(i+1);
             break;
-        
+
         default: break;
     }
 }
 
 /**
- * @brief      Encapsulate 3 quality score symbols in 2 bytes, when # >= 40.
- *             Reduction ~1/3
- * @param[out] packed  Packed qulity scores
- * @param[in]  strIn   Quality scores
- * @param[in]  map     Hash table
+ * @brief      Encapsulate 3 symbols in 2 bytes, when # >= 40. Symbols not in
+ *             the table come after the 2 bytes. Reduction ~1/3
+ * @param[out] packed  Packed string
+ * @param[in]  strIn   Input string
+ * @param[in]  map     Table for packing -- The last key is the extra char
  */
-inline void packLargeQs_3to2 (string &packed, const string &strIn,
-                              const htbl_t &map)
+inline void packLarge_3to2 (string &packed, const string &strIn,
+                            const ptbl_t &map)
 {
-    string tuple;    tuple.reserve(3);
-    bool firstNotIn, secondNotIn, thirdNotIn;
-    char s0, s1, s2;
+    const byte X = (byte) (map.n - 1);      // Index of the extra char
+    byte b0, b1, b2;
     u16 shortTuple;
-    string qss = QSs_g;
-    // ASCII char after the last char in QUALITY_SCORES string
-    const char XChar = (char) (qss.back() + 1);
     string::const_iterator i = strIn.begin(),   iEnd = strIn.end()-2;
     
     for (; i < iEnd; i += 3)
     {
-        s0 = *i,    s1 = *(i+1),  s2 = *(i+2);
-        
-        tuple.clear();
-        tuple  = (firstNotIn  = (qss.find(s0)==string::npos)) ? XChar : s0;
-        tuple += (secondNotIn = (qss.find(s1)==string::npos)) ? XChar : s1;
-        tuple += (thirdNotIn  = (qss.find(s2)==string::npos)) ? XChar : s2;
+        b0 = map.index[(byte) *i];
+        b1 = map.index[(byte) *(i+1)];
+        b2 = map.index[(byte) *(i+2)];
         
-        shortTuple = largePack(tuple, map);
+        shortTuple = (u16) ((b0*map.n + b1)*map.n + b2);
         packed += (unsigned char) (shortTuple >> 8);      // Left byte
         packed += (unsigned char) (shortTuple & 0xFF);    // Right byte
         
-        if (firstNotIn)   packed += s0;
-        if (secondNotIn)  packed += s1;
-        if (thirdNotIn)   packed += s2;
+        if (b0 == X)    packed += *i;
+        if (b1 == X)    packed += *(i+1);
+        if (b2 == X)    packed += *(i+2);
     }
     
     // If len isn't multiple of 3, add (char) 255 before each sym
@@ -397,18 +272,16 @@ inline void packLargeQs_3to2 (string &packed, const string &strIn,
  *             Reduction ~1/3
  * @param[out] packed  Packed string
  * @param[in]  strIn   Input string
- * @param[in]  map     Hash table
+ * @param[in]  map     Table for packing
  */
-inline void pack_3to2 (string &packed, const string &strIn, const htbl_t &map)
+inline void pack_3to2 (string &packed, const string &strIn, const ptbl_t &map)
 {
-    string tuple;    tuple.reserve(3);
     u16 shortTuple;
     string::const_iterator i = strIn.begin(),   iEnd = strIn.end()-2;
     
     for (; i < iEnd; i += 3)
     {
-        tuple.clear();    tuple=*i;    tuple+=*(i+1);    tuple+=*(i+2);
-        shortTuple = map.find(tuple)->second;
+        shortTuple = map.code(i);
         packed += (byte) (shortTuple >> 8);      // Left byte
         packed += (byte) (shortTuple & 0xFF);    // Right byte
     }
@@ -434,19 +307,13 @@ inline void pack_3to2 (string &packed, const string &strIn, const htbl_t &map)
  *             Reduction ~1/2
  * @param[out] packed  Packed string
  * @param[in]  strIn   Input string
- * @param[in]  map     Hash table
+ * @param[in]  map     Table for packing
  */
-inline void pack_2to1 (string &packed, const string &strIn, const htbl_t &map)
+inline void pack_2to1 (string &packed, const string &strIn, const ptbl_t &map)
 {
-    string tuple;    tuple.reserve(2);
-    
     string::const_iterator i = strIn.begin(),   iEnd = strIn.end()-1;
     
-    for (; i < iEnd; i += 2)
-    {
-        tuple.clear();    tuple = *i;    tuple += *(i+1);
-        packed += (char) map.find(tuple)->second;
-    }
+    for (; i < iEnd; i += 2)    packed += (char) map.code(i);
     
     // If len isn't multiple of 2 (it's odd), add (char) 255 before each sym
     if (strIn.length() & 1) { packed += 255;    packed += *i; }
@@ -457,19 +324,13 @@ inline void pack_2to1 (string &packed, const string &strIn, const htbl_t &map)
  *                Reduction ~2/3
  * @param packed  Packed string
  * @param strIn   Input string
- * @param map     Hash table
+ * @param map     Table for packing
  */
-inline void pack_3to1 (string &packed, const string &strIn, const htbl_t &map)
+inline void pack_3to1 (string &packed, const string &strIn, const ptbl_t &map)
 {
-    string tuple;    tuple.reserve(3);
-    
     string::const_iterator i = strIn.begin(),   iEnd = strIn.end()-2;
 
-    for (; i < iEnd; i += 3)
-    {
-        tuple.clear();    tuple=*i;    tuple+=*(i+1);    tuple+=*(i+2);
-        packed += (char) map.find(tuple)->second;
-    }
+    for (; i < iEnd; i += 3)    packed += (char) map.code(i);
 
     // If len isn't multiple of 3, add (char) 255 before each sym
     switch (strIn.length() % 3)
@@ -491,19 +352,13 @@ inline void pack_3to1 (string &packed, const string &strIn, const htbl_t &map)
  * @brief      Encapsulate 5 symbols in 1 byte, when # = 3. Reduction ~4/5
  * @param[out] packed  Packed string
  * @param[in]  strIn   Input string
- * @param[in]  map     Hash table
+ * @param[in]  map     Table for packing
  */
-inline void pack_5to1 (string &packed, const string &strIn, const htbl_t &map)
+inline void pack_5to1 (string &packed, const string &strIn, const ptbl_t &map)
 {
-    string tuple;    tuple.reserve(5);
     string::const_iterator i = strIn.begin(),   iEnd = strIn.end()-4;
     
-    for (; i < iEnd; i += 5)
-    {
-        tuple.clear();    tuple=*i;         tuple+=*(i+1);
-        tuple+=*(i+2);    tuple+=*(i+3);    tuple+=*(i+4);
-        packed += (char) map.find(tuple)->second;
-    }
+    for (; i < iEnd; i += 5)    packed += (char) map.code(i);
 
     // If len isn't multiple of 5, add (char) 255 before each sym
     switch (strIn.length() % 5)
@@ -538,19 +393,13 @@ inline void pack_5to1 (string &packed, const string &strIn, const htbl_t &map)
  * @brief      Encapsulate 7 symbols in 1 byte, when # = 2. Reduction ~6/7
  * @param[out] packed  Packed string
  * @param[in]  strIn   Input string
- * @param[in]  map     Hash table
+ * @param[in]  map     Table for packing
  */
-inline void pack_7to1 (string &packed, const string &strIn, const htbl_t &map)
+inline void pack_7to1 (string &packed, const string &strIn, const ptbl_t &map)
 {
-    string tuple;    tuple.reserve(7);
     string::const_iterator i = strIn.begin(),   iEnd = strIn.end()-6;
     
-    for (; i < iEnd; i += 7)
-    {
-        tuple.clear();    tuple=*i;         tuple+=*(i+1);    tuple+=*(i+2);
-        tuple+=*(i+3);    tuple+=*(i+4);    tuple+=*(i+5);    tuple+=*(i+6);
-        packed += (char) map.find(tuple)->second;
-    }
+    for (; i < iEnd; i += 7)    packed += (char) map.code(i);
 
     // If len isn't multiple of 7, add (char) 255 before each sym
     switch (strIn.length() % 7)
@@ -602,17 +451,208 @@ inline void pack_7to1 (string &packed, const string &strIn, const htbl_t &map)
  * @brief      Encapsulate 1 symbol in 1 byte, when # = 1.
  * @param[out] packed  Packed string
  * @param[in]  strIn   Input string
- * @param[in]  map     Hash table
+ * @param[in]  map     Table for packing
  */
-inline void pack_1to1 (string &packed, const string &strIn, const htbl_t &map)
+inline void pack_1to1 (string &packed, const string &strIn, const ptbl_t &map)
 {
-    string single;    single.reserve(1);
     string::const_iterator i = strIn.begin(),   iEnd = strIn.end();
     
-    for (; i < iEnd; ++i)
+    for (; i < iEnd; ++i)    packed += (char) map.index[(byte) *i];
+}
+
+/**
+ * @brief      Pack an unsigned integer in a variable number of bytes, 7 bits
+ *             in each. The high bit of a byte shows that more bytes follow
+ * @param[out] packed  Packed string
+ * @param[in]  n       Number
+ */
+inline void packVarint (string &packed, u64 n)
+{
+    for (; n > 0x7F; n >>= 7)    packed += (char) (0x80 | (n & 0x7F));
+    packed += (char) n;
+}
+
+/**
+ * @brief  Unpack an unsigned integer packed by packVarint
+ * @param  i  Input string iterator -- After the number, on return
+ * @return Number
+ */
+inline u64 unpackVarint (string::iterator &i)
+{
+    u64  n = 0;
+    byte shift = 0;
+    
+    for (; (byte) *i & 0x80; ++i, shift += 7)
+        n |= (u64) ((byte) *i & 0x7F) << shift;
+    n |= (u64) (byte) *i++ << shift;
+    
+    return n;
+}
+
+/**
+ * @brief  Map a signed integer to an unsigned one (zigzag): 0, -1, 1, -2 ...
+ *         to 0, 1, 2, 3 ... So small deltas pack in few bytes
+ * @param  n  Signed integer
+ * @return Unsigned integer
+ */
+inline u64 zigzag (i64 n)
+{
+    return ((u64) n << 1) ^ (u64) (n >> 63);
+}
+
+/**
+ * @brief  Inverse of zigzag
+ * @param  n  Unsigned integer
+ * @return Signed integer
+ */
+inline i64 unzigzag (u64 n)
+{
+    return (i64) (n >> 1) ^ -(i64) (n & 1);
+}
+
+/**
+ * @brief      Pack the line layout of a FASTA sequence, whose bases are
+ *             packed as one stream: number of line feeds, the width, and
+ *             lines of other lengths, as (index delta, length). The last
+ *             line has the bases left
+ * @param[out] packed  Packed layout
+ * @param[in]  lens    Length of lines -- At least two
+ */
+inline void packLayout (string &packed, const vector<u64> &lens)
+{
+    const u64 nBreaks = lens.size() - 1;
+    
+    // Width: the line before the last, mostly. Otherwise, the most common
+    u64 width = lens[nBreaks-1],  nOther = 0;
+    for (u64 l = 0; l != nBreaks; ++l)    nOther += (lens[l] != width);
+    if (2 * nOther > nBreaks)
     {
-        single.clear();   single = *i;
-        packed += (char) map.find(single)->second;
+        vector<u64> sorted(lens.begin(), lens.end()-1);
+        std::sort(sorted.begin(), sorted.end());
+        for (u64 beg = 0, end, most = 0; beg != nBreaks; beg = end)
+        {
+            for (end = beg; end != nBreaks && sorted[end]==sorted[beg]; ++end);
+            if (end - beg > most) { most = end - beg;    width = sorted[beg]; }
+        }
+        nOther = 0;
+        for (u64 l = 0; l != nBreaks; ++l)    nOther += (lens[l] != width);
+    }
+    
+    packVarint(packed, nBreaks);
+    packVarint(packed, width);
+    packVarint(packed, nOther);
+    for (u64 l = 0, prev = 0; l != nBreaks; ++l)
+        if (lens[l] != width)
+        {
+            packVarint(packed, l - prev);
+            packVarint(packed, lens[l]);
+            prev = l;
+        }
+}
+
+/**
+ * @brief         Unpack the line layout of a FASTA sequence, and break its
+ *                bases into lines
+ * @param[in,out] out  Bases, then lines
+ * @param[in]     i    Input string iterator -- On (char) 252 before the
+ *                     layout. On its last byte, on return
+ */
+inline void unpackLayout (string &out, string::iterator &i)
+{
+    const u64 nBreaks = unpackVarint(++i);
+    const u64 width   = unpackVarint(i);
+    u64       nOther  = unpackVarint(i);
+    u64       next    = nOther ? unpackVarint(i) : nBreaks,  len,  pos = 0;
+    
+    string lines;
+    lines.reserve(out.size() + nBreaks);
+    for (u64 l = 0; l != nBreaks; ++l)
+    {
+        len = width;
+        if (l == next)
+        {
+            len  = unpackVarint(i);
+            next = --nOther ? next + unpackVarint(i) : nBreaks;
+        }
+        lines.append(out, pos, len);
+        lines += '\n';
+        pos += len;
+    }
+    lines.append(out, pos, string::npos);
+    out.swap(lines);
+    --i;
+}
+
+/**
+ * @brief      Parse a number which is written in canonical form, i.e. only
+ *             decimal digits, without leading zeros
+ * @param[in]  str  Input string
+ * @param[out] n    Number
+ * @return     True if the string is a canonical number
+ */
+inline bool canonicalNumber (const string &str, u64 &n)
+{
+    if (str.empty() || str.size() > 18 || (str[0] == '0' && str.size() > 1))
+        return false;
+    
+    n = 0;
+    for (const char &c : str)
+    {
+        if (c < '0' || c > '9')    return false;
+        n = 10*n + (c - '0');
+    }
+    return true;
+}
+
+/**
+ * @brief      Pack a SAM CIGAR string: number of operations, then length and
+ *             code of each operation (len << 4 | code), all as varints.
+ *             "*" is packed as zero operations
+ * @param[out] packed  Packed string
+ * @param[in]  cigar   CIGAR string
+ * @return     False (and nothing packed) if CIGAR is not canonical
+ */
+inline bool packCigar (string &packed, const string &cigar)
+{
+    if (cigar == "*")    { packed += (char) 0;    return true; }
+    
+    vector<u64> ops;
+    string len;
+    for (const char &c : cigar)
+    {
+        if (c >= '0' && c <= '9')    { len += c;    continue; }
+        
+        const char *op = std::strchr(CIGAR_OPS, c);
+        u64 n;
+        if (!c || !op || !canonicalNumber(len, n))    return false;
+        
+        ops.push_back(n << 4 | (u64) (op - CIGAR_OPS));
+        len.clear();
+    }
+    if (!len.empty() || ops.empty())    return false;
+    
+    packVarint(packed, ops.size());
+    for (const u64 &op : ops)    packVarint(packed, op);
+    return true;
+}
+
+/**
+ * @brief      Unpack a SAM CIGAR string packed by packCigar
+ * @param[out] out  CIGAR string
+ * @param[in]  i    Input string iterator -- After the CIGAR, on return
+ */
+inline void unpackCigar (string &out, string::iterator &i)
+{
+    u64 nOps = unpackVarint(i),  op;
+    out.clear();
+    
+    if (!nOps)    { out = "*";    return; }
+    
+    while (nOps--)
+    {
+        op = unpackVarint(i);
+        out += std::to_string(op >> 4);
+        out += CIGAR_OPS[op & 0xF];
     }
 }
 
@@ -632,13 +672,15 @@ char penaltySym (char c)
 }
 
 /**
- * @brief      Unpack 1 byte to 3 DNA bases -- FASTA
+ * @brief      Unpack 1 byte to 3 DNA bases -- FASTA. Bases end at (char)
+ *             254, or at (char) 252 if a line layout follows. In files of
+ *             older versions, (char) 252 escapes stand for line feeds
  * @param[out] out  DNA bases
  * @param[in]  i    Input string iterator
  */
 inline void unpackSeqFA_3to1 (string &out, string::iterator &i)
 {
-    string tpl;    tpl.reserve(3);     // Tuplet
+    const char *tpl;                   // Tuplet
     out.clear();
     byte s;
 
@@ -646,13 +688,15 @@ inline void unpackSeqFA_3to1 (string &out, string::iterator &i)
     {
         s = (byte) *i;
         
+        if (s == 252) { unpackLayout(out, i);    break; }
+
         if (s == 255) { out += penaltySym(*(++i)); }
         else
         {
             tpl = DNA_UNPACK[s];
 
             if (tpl[0]!='X' && tpl[1]!='X' && tpl[2]!='X')                // ...
-            { out+=tpl;                                                        }
+            { out.append(tpl, 3);                                              }
             // Using just one 'out' makes trouble
             else if (tpl[0]=='X' && tpl[1]!='X' && tpl[2]!='X')           // X..
             { out+=penaltySym(*(++i));    out+=tpl[1];    out+=tpl[2];         }
@@ -685,7 +729,7 @@ inline void unpackSeqFA_3to1 (string &out, string::iterator &i)
  */
 inline void unpackSeqFQ_3to1 (string &out, string::iterator &i)
 {
-    string tpl;    tpl.reserve(3);
+    const char *tpl;
     out.clear();
     
     for (; *i != (char) 254; ++i)
@@ -721,21 +765,23 @@ inline void unpackSeqFQ_3to1 (string &out, string::iterator &i)
 }
 
 /**
- * @brief      Unpack by reading 2 byte by 2 byte, when # > 39
+ * @brief      Unpack by reading 2 byte by 2 byte, when # > 39. Stops at
+ *             (char) 254, or at (char) 252, which no packing function
+ *             makes in place of a code, as for the other unpackers
  * @param[out] out     Unpacked string
  * @param[in]  i       Input string iterator
  * @param[in]  XChar   Extra character for unpacking
  * @param[in]  unpack  Table for unpacking
  */
 inline void unpackLarge_read2B (string &out, string::iterator &i,
-                                const char XChar, const vector<string> &unpack)
+                                const char XChar, const utbl_t &unpack)
 {
     byte leftB, rightB;
     u16 doubleB;                      // Double byte
-    string tpl;    tpl.reserve(3);    // Tuplet
+    const char *tpl;                  // Tuplet
     out.clear();
 
-    while (*i != (char) 254)
+    while (*i != (char) 254 && *i != (char) 252)
     {
         // Hdr len not multiple of keyLen
         if (*i == (char) 255) { out += penaltySym(*(i+1));   i+=2;   continue; }
@@ -747,7 +793,7 @@ inline void unpackLarge_read2B (string &out, string::iterator &i,
         tpl = unpack[doubleB];
 
         if (tpl[0]!=XChar && tpl[1]!=XChar && tpl[2]!=XChar)              // ...
-        { out+=tpl;                                                      i+=2; }
+        { out.append(tpl, 3);                                            i+=2; }
 
         else if (tpl[0]==XChar && tpl[1]!=XChar && tpl[2]!=XChar)         // X..
         { out+=penaltySym(*(i+2));    out+=tpl[1];    out+=tpl[2];       i+=3; }
@@ -773,19 +819,19 @@ inline void unpackLarge_read2B (string &out, string::iterator &i,
 }
 
 /**
- * @brief      Unpack by reading 2 byte by 2 byte
+ * @brief      Unpack by reading 2 byte by 2 byte, up to (char) 254 or 252
  * @param[out] out     Unpacked string
  * @param[in]  i       Input string iterator
  * @param[in]  unpack  Table for unpacking
  */
 inline void unpack_read2B (string &out, string::iterator &i,
-                           const vector<string> &unpack)
+                           const utbl_t &unpack)
 {
     byte leftB, rightB;
     u16 doubleB;     // Double byte
     out.clear();
     
-    for (; *i != (char) 254; i += 2)
+    for (; *i != (char) 254 && *i != (char) 252; i += 2)
     {
         // Hdr len not multiple of keyLen
         if (*i == (char) 255) { out += penaltySym(*(i+1));    continue; }
@@ -794,27 +840,158 @@ inline void unpack_read2B (string &out, string::iterator &i,
         rightB  = *(i+1);
         doubleB = leftB<<8 | rightB;    // Join two bytes
         
-        out += unpack[doubleB];
+        out.append(unpack[doubleB], unpack.keyLen);
     }
 }
 
 /**
- * @brief      Unpack by reading 1 byte by 1 byte
+ * @brief      Unpack by reading 1 byte by 1 byte, up to (char) 254 or 252
  * @param[out] out     Unpacked string
  * @param[in]  i       Input string iterator
  * @param[in]  unpack  Table for unpacking
  */
 inline void unpack_read1B (string &out, string::iterator &i,
-                           const vector<string> &unpack)
+                           const utbl_t &unpack)
 {
     out.clear();
     
-    for (; *i != (char) 254; ++i)
+    for (; *i != (char) 254 && *i != (char) 252; ++i)
     {
         // Hdr len not multiple of keyLen
         if (*i == (char) 255) { out += penaltySym(*(++i));    continue; }
-        out += unpack[(byte) *i];
+        out.append(unpack[(byte) *i], unpack.keyLen);
+    }
+}
+
+/**
+ * @brief  Packed size of a string of a fixed length, with keyLen symbols in
+ *         each code of codeLen bytes, and (char) 255 before each of the rest
+ * @param  len      Length of string
+ * @param  keyLen   Symbols in a code
+ * @param  codeLen  Bytes of a code
+ * @return Packed size
+ */
+inline u64 fixedPackedSize (u64 len, u16 keyLen, u16 codeLen)
+{
+    return len/keyLen*codeLen + 2*(len%keyLen);
+}
+
+/**
+ * @brief      Unpack DNA bases of a fixed number, packed 3 in 1 byte, with
+ *             none escaped -- No terminator is needed
+ * @param[out] out  DNA bases
+ * @param[in]  i    Input string iterator
+ * @param[in]  len  Number of bases
+ */
+inline void unpackSeqFixed_3to1 (string &out, string::iterator &i, u64 len)
+{
+    out.resize(len + 1);                // Tuples are copied with their '\0'
+    char *o = &out[0];
+
+    for (u64 n = len / 3; n--; ++i, o += 3)
+        std::memcpy(o, DNA_UNPACK[(byte) *i], 4);
+    for (u64 n = len % 3; n--; i += 2)    *o++ = *(i+1);
+    out.resize(len);
+}
+
+/**
+ * @brief      Unpack a string of a fixed length, with codes of codeLen
+ *             bytes -- No terminator is needed
+ * @param[out] out      Unpacked string
+ * @param[in]  i        Input string iterator
+ * @param[in]  len      Length of string
+ * @param[in]  unpack   Table for unpacking
+ * @param[in]  codeLen  Bytes of a code: 1 or 2
+ */
+inline void unpackFixed (string &out, string::iterator &i, u64 len,
+                         const utbl_t &unpack, u16 codeLen)
+{
+    const u16 keyLen = unpack.keyLen;
+    out.resize(len);
+    char *o = &out[0];
+
+    if (codeLen == 2)
+        for (u64 n = len / keyLen; n--; i += 2, o += keyLen)
+            std::memcpy(o, unpack[(byte) *i << 8 | (byte) *(i+1)], keyLen);
+    else
+        for (u64 n = len / keyLen; n--; ++i, o += keyLen)
+            std::memcpy(o, unpack[(byte) *i], keyLen);
+
+    for (u64 n = len % keyLen; n--; i += 2)    *o++ = *(i+1);
+}
+
+/**
+ * @brief      Unpack a string of a known length, reading 2 byte by 2 byte,
+ *             when # > 39 -- No terminator is needed
+ * @param[out] out     Unpacked string
+ * @param[in]  i       Input string iterator
+ * @param[in]  len     Length of string
+ * @param[in]  XChar   Extra character for unpacking
+ * @param[in]  unpack  Table for unpacking
+ */
+inline void unpackLargeFixed (string &out, string::iterator &i, u64 len,
+                              const char XChar, const utbl_t &unpack)
+{
+    const char *tpl;                  // Tuplet
+    out.clear();
+    
+    for (u64 n = len / 3; n--;)
+    {
+        tpl = unpack[(byte) *i << 8 | (byte) *(i+1)];
+        i += 2;
+        
+        // Symbols escaped come after the 2 bytes, in order
+        for (byte k = 0; k != 3; ++k)
+            out += (tpl[k] != XChar) ? tpl[k] : *i++;
     }
+    
+    for (u64 n = len % 3; n--; i += 2)    out += *(i+1);
+}
+
+/**
+ * @brief          Shuffle a packed string
+ * @param[in, out] str   String
+ * @param[in]      seed  Seed
+ */
+inline void shuffleStr (string &str, u64 seed)
+{
+    std::shuffle(str.begin(), str.end(), std::mt19937(seed));
+}
+
+/**
+ * @brief       Unshuffle, by shuffling a vector of positions. Swaps depend
+ *              only on the size, so they are the same for any type of them
+ * @tparam Pos  Type of positions
+ * @param i     Shuffled string iterator
+ * @param size  Size of shuffled string
+ * @param seed  Seed used in shuffling
+ */
+template <typename Pos>
+inline void unshuffleBy (string::iterator i, u64 size, u64 seed)
+{
+    const string shuffledStr(i, i + size);    // Copy of shuffled string
+    string::const_iterator shIt = shuffledStr.begin();
+    
+    // Shuffle vector of positions
+    vector<Pos> vPos(size);
+    std::iota(vPos.begin(), vPos.end(), 0);     // Insert 0 .. N-1
+    std::shuffle(vPos.begin(), vPos.end(), std::mt19937(seed));
+
+    // Insert unshuffled data
+    for (const Pos& vI : vPos)  *(i + vI) = *shIt++;       // *shIt, then ++shIt
+}
+
+/**
+ * @brief       Unshuffle a packed string
+ * @param i     Shuffled string iterator
+ * @param size  Size of shuffled string
+ * @param seed  Seed used in shuffling
+ */
+inline void unshuffleStr (string::iterator i, u64 size, u64 seed)
+{
+    // Positions fit in 32 bits, for any chunk but a huge one: half memory
+    if (size >> 32)    unshuffleBy<u64>(i, size, seed);
+    else               unshuffleBy<u32>(i, size, seed);
 }
 
 #endif //CRYFA_PACK_H
\ No newline at end of file
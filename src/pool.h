@@ -0,0 +1,415 @@
+/**
+ * @file      pool.h
+ * @brief     Thread pool
+ * @author    Morteza Hosseini  (seyedmorteza@ua.pt)
+ * @author    Diogo Pratas      (pratas@ua.pt)
+ * @author    Armando J. Pinho  (ap@ua.pt)
+ * @copyright The GNU General Public License v3.0
+ */
+
+#ifndef CRYFA_POOL_H
+#define CRYFA_POOL_H
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <exception>
+#include <queue>
+#include <map>
+#include <vector>
+#include <chrono>
+#include <fstream>
+#include <ostream>
+#include <iomanip>
+#include <cctype>
+#include "def.h"
+#include "fcn.h"
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+using std::vector;
+
+/**
+ * @brief Thread pool. Workers are made once and run the tasks of all
+ *        stages, for as many files as needed
+ * @note  Tasks must not wait for the pool themselves. Many threads can
+ *        share a pool: each one waits for the tasks it submitted only.
+ *        If pinned, workers are spread over NUMA nodes, in blocks, and each
+ *        one is bound to a core of its node. Since a worker is bound before
+ *        it allocates anything, its buffers are placed on its node by first
+ *        touch. Task k after a wait() is queued on the node of worker k, so
+ *        a stage whose task k handles chunks k, k+n, ... keeps each chunk,
+ *        from reading to writing, on one node. Idle workers take tasks of
+ *        other nodes.
+ */
+class ThreadPool
+{
+public:
+    /**
+     * @brief Constructor
+     * @param n    Number of workers
+     * @param pin  Bind workers to cores, node by node
+     */
+    explicit ThreadPool (byte n, bool pin = false)
+            : workers(n ? n : 1), pinned(pin), made(steady_clock::now())
+    {
+        vector<vector<int>> nodeCpus(1);
+        if (pinned)    pinned = findNodes(nodeCpus);
+
+        const u64 nNodes = pinned ? nodeCpus.size() : 1,  nW = workers.size();
+        vector<u64> used(nNodes, 0);
+        for (u64 w = 0; w != nW; ++w)
+        {
+            workers[w].node = (byte) (w * nNodes / nW);
+            if (pinned)
+            {
+                const vector<int> &cpus = nodeCpus[workers[w].node];
+                workers[w].cpu = cpus[used[workers[w].node]++ % cpus.size()];
+            }
+        }
+        nodeNames = pinned ? nodeIds : vector<int>(1, 0);
+        tasks.resize(nNodes);
+
+        for (u64 w = 0; w != nW; ++w)
+            workers[w].thr = std::thread(&ThreadPool::work, this, w);
+    }
+
+    /**
+     * @brief Destructor -- Waits for the tasks left
+     */
+    ~ThreadPool ()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mut);
+            stop = true;
+        }
+        taskCond.notify_all();
+        for (worker_s &w : workers)    w.thr.join();
+    }
+
+    ThreadPool (const ThreadPool&) = delete;
+    ThreadPool& operator= (const ThreadPool&) = delete;
+
+    /** @brief Number of workers */
+    byte size () const    { return (byte) workers.size(); }
+
+    /**
+     * @brief Add a task
+     * @param task  Task
+     */
+    void submit (std::function<void()> task)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mut);
+            if (!timing) { since = steady_clock::now();    timing = true; }
+            group_s &g = groups[std::this_thread::get_id()];
+            tasks[workers[g.nextTask++ % workers.size()].node]
+                    .push({std::move(task), steady_clock::now(), &g});
+            ++g.pending;
+        }
+        taskCond.notify_all();
+    }
+
+    /**
+     * @brief Wait until all tasks submitted by this thread are done. The
+     *        first exception thrown by them, if any, is thrown here
+     */
+    void wait ()
+    {
+        std::unique_lock<std::mutex> lock(mut);
+        const std::map<std::thread::id, group_s>::iterator g =
+                groups.find(std::this_thread::get_id());
+        if (g == groups.end())    return;
+
+        doneCond.wait(lock, [&] { return g->second.pending == 0; });
+        waitedCpu() += g->second.cpu;
+        const std::exception_ptr e = g->second.error;
+        groups.erase(g);
+        if (e)    std::rethrow_exception(e);
+    }
+
+    /**
+     * @brief  CPU time of this thread, with that of the tasks it submitted
+     *         and waited for, on any pool
+     * @return Seconds
+     */
+    static double cpuTime ()    { return threadCpuTime() + waitedCpu(); }
+
+    /**
+     * @brief Count bytes handled by the task running on this thread. Out of
+     *        the pool, it does nothing
+     * @param bytes  Number of bytes
+     */
+    static void count (u64 bytes)
+    {
+        if (u64 *c = current())    *c += bytes;
+    }
+
+    /**
+     * @brief Report throughput of each node, from the first task after the
+     *        last report, if workers are pinned. Call it after wait()
+     * @param os  Output stream
+     */
+    void report (std::ostream &os)
+    {
+        std::lock_guard<std::mutex> lock(mut);
+        if (!timing)    return;
+        const std::chrono::duration<double> elapsed =
+                steady_clock::now() - since;
+
+        for (byte n = 0; pinned && n != tasks.size(); ++n)
+        {
+            u64    bytes=0, nW=0;
+            double busy=0;
+            for (const worker_s &w : workers)
+                if (w.node == n)
+                {
+                    bytes += w.bytes - w.bytesMark;
+                    busy  += w.busy  - w.busyMark;
+                    ++nW;
+                }
+
+            os << "Node " << nodeNames[n] << " (" << nW << " workers): "
+               << std::fixed << std::setprecision(1) << bytes / 1e6
+               << " MB, " << bytes / 1e6 / elapsed.count() << " MB/s, "
+               << std::setprecision(0)
+               << 100 * busy / (nW * elapsed.count()) << "% busy.\n";
+        }
+
+        for (worker_s &w : workers)
+        { w.bytesMark = w.bytes;    w.busyMark = w.busy; }
+        timing = false;
+    }
+
+    /** @brief Totals of a worker, since the pool was made */
+    struct usage_s
+    {
+        u64    tasks;            /**< @brief Tasks run */
+        u64    bytes;            /**< @brief Bytes handled by its tasks */
+        double busy;             /**< @brief Seconds running tasks */
+        double wait;             /**< @brief Seconds its tasks were queued */
+    };
+
+    /**
+     * @brief  Totals of each worker. Call it after wait()
+     * @return Totals
+     */
+    vector<usage_s> usage () const
+    {
+        std::lock_guard<std::mutex> lock(mut);
+        vector<usage_s> u;
+        for (const worker_s &w : workers)
+            u.push_back({w.tasks, w.bytes, w.busy, w.wait});
+        return u;
+    }
+
+    /** @brief Seconds since the pool was made */
+    double age () const
+    {
+        const std::chrono::duration<double> t = steady_clock::now() - made;
+        return t.count();
+    }
+
+private:
+    using steady_clock = std::chrono::steady_clock;
+
+    /** @brief Worker */
+    struct worker_s
+    {
+        std::thread thr;         /**< @brief Thread */
+        byte        node = 0;    /**< @brief NUMA node, among those used */
+        int         cpu  = -1;   /**< @brief Core bound to. -1: any */
+        u64         bytes = 0;   /**< @brief Bytes handled by its tasks */
+        double      busy  = 0;   /**< @brief Seconds running tasks */
+        double      wait  = 0;   /**< @brief Seconds its tasks were queued */
+        u64         tasks = 0;   /**< @brief Tasks run */
+        u64         bytesMark = 0;  /**< @brief Bytes, at the last report */
+        double      busyMark  = 0;  /**< @brief Busy, at the last report */
+    };
+
+    /** @brief Tasks submitted by a thread, since it last waited */
+    struct group_s
+    {
+        u64                pending  = 0;   /**< @brief Tasks not done */
+        u64                nextTask = 0;   /**< @brief Tasks submitted */
+        double             cpu      = 0;   /**< @brief CPU time of tasks done */
+        std::exception_ptr error;          /**< @brief First exception */
+    };
+
+    /** @brief Task, and when it was queued */
+    struct task_s
+    {
+        std::function<void()>    run;      /**< @brief Task */
+        steady_clock::time_point queued;   /**< @brief Submitted */
+        group_s                 *group;    /**< @brief Of the submitter */
+    };
+
+    vector<worker_s>                    workers;  /**< @brief Workers */
+    vector<std::queue<task_s>>          tasks;    /**< @brief Per node */
+    bool                    pinned;              /**< @brief Bound to cores */
+    vector<int>             nodeIds;             /**< @brief Online nodes */
+    vector<int>             nodeNames;           /**< @brief Nodes used */
+    mutable std::mutex      mut;                 /**< @brief Guards the rest */
+    std::condition_variable taskCond;            /**< @brief New task/stop */
+    std::condition_variable doneCond;            /**< @brief A group done */
+    std::map<std::thread::id, group_s> groups;   /**< @brief By submitter */
+    bool                    stop = false;        /**< @brief Pool is closing */
+    bool                    timing = false;      /**< @brief Since is set */
+    steady_clock::time_point since;              /**< @brief First task */
+    steady_clock::time_point made;               /**< @brief Pool made */
+
+    /**
+     * @brief  Byte counter of the worker running on this thread
+     * @return Counter. Null, out of the pool
+     */
+    static u64 *&current ()
+    {
+        static thread_local u64 *c = nullptr;
+        return c;
+    }
+
+    /**
+     * @brief  CPU time of the tasks this thread submitted and waited for
+     * @return Seconds
+     */
+    static double &waitedCpu ()
+    {
+        static thread_local double c = 0;
+        return c;
+    }
+
+    /**
+     * @brief  Parse a list of ids, e.g. "0-3,8,10-11", as in sysfs
+     * @param  list  List
+     * @return Ids
+     */
+    static vector<int> parseList (const string &list)
+    {
+        vector<int> ids;
+        string::size_type beg = 0, end;
+
+        while (beg < list.size())
+        {
+            end = list.find(',', beg);
+            if (end == string::npos)    end = list.size();
+
+            const string item = list.substr(beg, end - beg);
+            const string::size_type dash = item.find('-');
+            if (!item.empty() && isdigit(item[0]))
+            {
+                const int first = std::stoi(item);
+                const int last  = dash == string::npos
+                                  ? first : std::stoi(item.substr(dash + 1));
+                for (int i = first; i <= last; ++i)    ids.push_back(i);
+            }
+            beg = end + 1;
+        }
+        return ids;
+    }
+
+    /**
+     * @brief      Find NUMA nodes and their cores, among those this process
+     *             may run on. Without sysfs, all cores make one node
+     * @param[out] nodeCpus  Cores of each node
+     * @return     False, if cores can't be bound on this system
+     */
+    bool findNodes (vector<vector<int>> &nodeCpus)
+    {
+#ifdef __linux__
+        cpu_set_t allowed;
+        if (sched_getaffinity(0, sizeof(allowed), &allowed))    return false;
+
+        const string sys = "/sys/devices/system/node/";
+        string       list;
+        std::getline(std::ifstream(sys + "online"), list);
+
+        nodeCpus.clear();
+        nodeIds.clear();
+        for (int node : parseList(list))
+        {
+            list.clear();
+            std::getline(std::ifstream(sys + "node" + std::to_string(node) +
+                                       "/cpulist"), list);
+            vector<int> cpus;
+            for (int cpu : parseList(list))
+                if (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed))
+                    cpus.push_back(cpu);
+
+            if (!cpus.empty())
+            { nodeCpus.push_back(cpus);    nodeIds.push_back(node); }
+        }
+
+        if (nodeCpus.empty())
+        {
+            nodeCpus.assign(1, vector<int>());
+            nodeIds.assign(1, 0);
+            for (int cpu = 0; cpu != CPU_SETSIZE; ++cpu)
+                if (CPU_ISSET(cpu, &allowed))    nodeCpus[0].push_back(cpu);
+        }
+        return !nodeCpus[0].empty();
+#else
+        return false;
+#endif
+    }
+
+    /**
+     * @brief Run tasks, until the pool is closed. Tasks of its own node
+     *        are taken first
+     * @param id  Worker
+     */
+    void work (u64 id)
+    {
+        worker_s &self = workers[id];
+        task_s    task;
+
+#ifdef __linux__
+        if (self.cpu >= 0)
+        {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(self.cpu, &set);
+            pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        }
+#endif
+        current() = &self.bytes;
+
+        while (true)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mut);
+                std::queue<task_s> *q = nullptr;
+                taskCond.wait(lock, [&] {
+                    q = &tasks[self.node];
+                    for (u64 n = 1; q->empty() && n != tasks.size(); ++n)
+                        q = &tasks[(self.node + n) % tasks.size()];
+                    return stop || !q->empty();
+                });
+                if (q->empty())    return;
+
+                task = std::move(q->front());
+                q->pop();
+            }
+
+            const steady_clock::time_point start = steady_clock::now();
+            const double cpuStart = threadCpuTime();
+            std::exception_ptr e;
+            try                  { task.run(); }
+            catch (...)          { e = std::current_exception(); }
+            const double cpu = threadCpuTime() - cpuStart;
+            const std::chrono::duration<double> ran =
+                    steady_clock::now() - start,  queued = start - task.queued;
+
+            std::lock_guard<std::mutex> lock(mut);
+            self.busy += ran.count();
+            self.wait += queued.count();
+            ++self.tasks;
+            task.group->cpu += cpu;
+            if (e && !task.group->error)    task.group->error = e;
+            if (--task.group->pending == 0)    doneCond.notify_all();
+        }
+    }
+};
+
+#endif //CRYFA_POOL_H
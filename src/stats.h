@@ -0,0 +1,209 @@
+/**
+ * @file      stats.h
+ * @brief     Statistics of a run -- Time of stages, sizes and workers, for
+ *            a report in JSON
+ * @author    Morteza Hosseini  (seyedmorteza@ua.pt)
+ * @author    Diogo Pratas      (pratas@ua.pt)
+ * @author    Armando J. Pinho  (ap@ua.pt)
+ * @copyright The GNU General Public License v3.0
+ */
+
+#ifndef CRYFA_STATS_H
+#define CRYFA_STATS_H
+
+#include <chrono>
+#include <atomic>
+#include <algorithm>
+#include <mutex>
+#include <fstream>
+#include <iomanip>
+#include "def.h"
+#include "fcn.h"
+#include "pool.h"
+
+/**
+ * @brief Stage of a run. Time of all its calls is summed. Stages nest: time
+ *        of a stage counts that of the stages run in it
+ */
+struct stage_s
+{
+    string name;                      /**< @brief Name */
+    string parent;                    /**< @brief Stage it is run in, if any */
+    u64    calls = 0;                 /**< @brief Number of calls */
+    double wall  = 0;                 /**< @brief Wall time, in seconds */
+    double cpu   = 0;                 /**< @brief CPU time, see StageTimer */
+};
+
+/**
+ * @brief Statistics of a run
+ * @note  Updated between stages, by the threads running them. Objects of
+ *        the library API, used at once, add up into the same statistics
+ */
+struct stats_s
+{
+    string           mode;            /**< @brief "encrypt" or "decrypt" */
+    std::atomic<u64> bytesIn{0};      /**< @brief Input files */
+    std::atomic<u64> bytesOut{0};     /**< @brief Output, of all files */
+    std::atomic<u64> records{0};      /**< @brief Reads, sequences or lines */
+    std::atomic<u64> chunks{0};       /**< @brief Chunks packed or unpacked */
+    vector<stage_s>  stages;          /**< @brief In order of first call */
+    mutable std::mutex mut;           /**< @brief Guards stages */
+
+    /**
+     * @brief Add a call of a stage
+     * @param name    Name
+     * @param parent  Stage it is run in. Empty: none
+     * @param wall    Wall time
+     * @param cpu     CPU time
+     */
+    void add (const string &name, const string &parent, double wall,
+              double cpu)
+    {
+        std::lock_guard<std::mutex> lock(mut);
+        vector<stage_s>::iterator s = stages.begin();
+        while (s != stages.end() && s->name != name)    ++s;
+        if (s == stages.end())
+        {
+            stages.push_back(stage_s());
+            s = stages.end() - 1;
+            s->name   = name;
+            s->parent = parent;
+        }
+        ++s->calls;    s->wall += wall;    s->cpu += cpu;
+    }
+};
+
+/**
+ * @brief  Statistics of this process
+ * @return Statistics
+ */
+inline stats_s &stats ()
+{
+    static stats_s s;
+    return s;
+}
+
+/**
+ * @brief Time a stage, from construction to stop() or destruction. CPU time
+ *        is that of the thread running the stage, and of the tasks it
+ *        waited for on workers -- Not of other stages run at once
+ */
+class StageTimer
+{
+public:
+    /**
+     * @brief Constructor -- Starts timing. The last stage started on this
+     *        thread, and not stopped, is its parent
+     * @param name  Name of stage
+     */
+    explicit StageTimer (const string &name)
+            : name(name), start(std::chrono::steady_clock::now()),
+              cpuStart(ThreadPool::cpuTime())
+    {
+        if (!running().empty())    parent = running().back()->name;
+        running().push_back(this);
+    }
+
+    /** @brief Destructor -- Stops timing, if not stopped */
+    ~StageTimer ()    { stop(); }
+
+    StageTimer (const StageTimer&) = delete;
+    StageTimer& operator= (const StageTimer&) = delete;
+
+    /**
+     * @brief  Stop timing, and add the call to the statistics, once
+     * @return Wall time, in seconds
+     */
+    double stop ()
+    {
+        if (!stopped)
+        {
+            const std::chrono::duration<double> wall =
+                    std::chrono::steady_clock::now() - start;
+            seconds = wall.count();
+            stats().add(name, parent, seconds,
+                        ThreadPool::cpuTime() - cpuStart);
+            stopped = true;
+            running().erase(std::find(running().begin(), running().end(),
+                                      this));
+        }
+        return seconds;
+    }
+
+private:
+    string name;                                    /**< @brief Stage */
+    string parent;                                  /**< @brief Run in it */
+    std::chrono::steady_clock::time_point start;    /**< @brief Wall, start */
+    double cpuStart;                                /**< @brief CPU, start */
+    double seconds = 0;                             /**< @brief Wall time */
+    bool   stopped = false;                         /**< @brief Added */
+
+    /**
+     * @brief  Stages started on this thread, and not stopped
+     * @return Stages, in order of start
+     */
+    static vector<StageTimer*> &running ()
+    {
+        static thread_local vector<StageTimer*> r;
+        return r;
+    }
+};
+
+/**
+ * @brief Write statistics of the run, with those of workers, in JSON.
+ *        Wall time of the run is counted from when the workers were made
+ * @param fileName  Output file name
+ * @param pool      Workers
+ */
+inline void writeStats (const string &fileName, const ThreadPool &pool)
+{
+    std::ofstream out(fileName);
+    if (!out.good())
+        throw CryfaError(ErrCode::OPEN_FAILED,
+                         "failed opening \"" + fileName + "\".");
+
+    const stats_s &s = stats();
+    std::lock_guard<std::mutex> lock(s.mut);
+    const vector<ThreadPool::usage_s> workers = pool.usage();
+    const double age = pool.age();
+
+    out << "{\n"
+        << "  \"version\": \"" << VERSION_CRYFA << "." << RELEASE_CRYFA
+                               << "\",\n"
+        << std::fixed << std::setprecision(6)
+        << "  \"mode\": \"" << s.mode << "\",\n"
+        << "  \"wall_seconds\": " << age << ",\n"
+        << "  \"cpu_seconds\": " << cpuTime() << ",\n"
+        << "  \"bytes_in\": " << s.bytesIn.load() << ",\n"
+        << "  \"bytes_out\": " << s.bytesOut.load() << ",\n"
+        << "  \"records\": " << s.records.load() << ",\n"
+        << "  \"chunks\": " << s.chunks.load() << ",\n"
+        << "  \"peak_rss_bytes\": " << peakMemory() << ",\n"
+        << "  \"stages\": [";
+    for (u64 i = 0; i != s.stages.size(); ++i)
+    {
+        const stage_s &st = s.stages[i];
+        out << (i ? ",\n" : "\n")
+            << "    {\"name\": \"" << st.name << "\", \"parent\": "
+            << (st.parent.empty() ? "null" : "\"" + st.parent + "\"")
+            << ", \"calls\": " << st.calls
+            << ", \"wall_seconds\": " << st.wall
+            << ", \"cpu_seconds\": " << st.cpu << "}";
+    }
+    out << "\n  ],\n"
+        << "  \"threads\": [";
+    for (u64 w = 0; w != workers.size(); ++w)
+    {
+        const ThreadPool::usage_s &u = workers[w];
+        out << (w ? ",\n" : "\n")
+            << "    {\"id\": " << w << ", \"tasks\": " << u.tasks
+            << ", \"bytes\": " << u.bytes
+            << ", \"busy_seconds\": " << u.busy
+            << ", \"idle_seconds\": " << std::max(0.0, age - u.busy)
+            << ", \"queue_wait_seconds\": " << u.wait << "}";
+    }
+    out << "\n  ]\n"
+        << "}\n";
+}
+
+#endif //CRYFA_STATS_H